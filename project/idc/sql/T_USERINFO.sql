@@ -0,0 +1,13 @@
+/* The columns of T_USERINFO used by the rate limit and the scheduling of webserver, run once on an existing database.
+   The defaults keep the present behaviour of the users: no limit and the same share of the worker threads. */
+
+alter table T_USERINFO add ratelimit number(8,2) default 0;
+alter table T_USERINFO add burst number(8) default 0;
+alter table T_USERINFO add weight number(4) default 1;
+
+/* ratelimit: requests per second allowed to the user by webserver, 0 means no limit. The requests over the rate are answered with 429.
+   burst: requests the user can send at once over the rate, 0 means the requests of one second.
+   weight: share of the worker threads of webserver when the requests of several users are waiting, default 1.
+   Give the interactive users a larger weight, so their requests do not wait behind the bulk queries of the others. */
+
+exit;
@@ -0,0 +1,27 @@
+/* T_USERLOG: invocation log of the interfaces of the data service bus, one row for each successful call.
+   webserver inserts the rows in batches from a background thread, SEQ_USERLOG numbers them.
+   Create the table once on the database of the data service bus: */
+
+create table T_USERLOG
+(
+  logid      number(15)    not null,
+  username   varchar2(30)  not null,
+  intername  varchar2(30)  not null,
+  upttime    date          default sysdate not null,
+  ip         varchar2(30),
+  rpc        number(8),
+  bytes      number(12),
+  elapsed    number(8),
+  primary key(logid)
+);
+
+create sequence SEQ_USERLOG increment by 1 minvalue 1 nomaxvalue start with 1 cache 1000;
+
+create index IDX_USERLOG_1 on T_USERLOG(upttime);
+create index IDX_USERLOG_2 on T_USERLOG(username, intername);
+
+/* rpc: rows sent, bytes: size of the response body, elapsed: time of the call in milliseconds.
+   The table grows with every call, delete the old rows regularly:
+   delete from T_USERLOG where upttime<sysdate-30; */
+
+exit;
@@ -0,0 +1,33 @@
+/* webbench.sql: fixture of the data service bus for the load generator webbench, so the benchmarks of webserver
+   do not depend on the live data and can be repeated. Run it on a test database with the tables of the data service bus:
+   sqlplus scott/tiger@snorcl11g_130 @webbench.sql
+
+   It adds the user bench (password benchpwd) with the permissions of all the interfaces, the stations 90001-90050,
+   and the minute data of these stations in the last 24 hours, 72000 rows. Run it again before a benchmark to move the
+   minute data to the current time. */
+
+delete from T_USERINFO where username='bench';
+insert into T_USERINFO(username, passwd, rsts) values ('bench', 'benchpwd', 1);
+
+/* bench has no rate limit, so webbench measures webserver itself. To see the 429 of the rate limit and the weighted
+   fair queue under load, limit bench like a bulk user scanning long time periods:
+   update T_USERINFO set ratelimit=2, burst=10, weight=1 where username='bench'; */
+
+delete from T_USERANDINTER where username='bench';
+insert into T_USERANDINTER select 'bench', intername from T_INTERCFG where rsts=1;
+
+delete from T_ZHOBTCODE where obtid between '90001' and '90050';
+insert into T_ZHOBTCODE(obtid, cityname, provname, lat, lon, height)
+select to_char(90000+level), 'Bench'||level, 'Bench', 2000+level*10, 11000+level*10, 100+level from dual connect by level<=50;
+
+/* keyid continues from the rows already in the table, the pagination of getzhobtmind2/3 goes by keyid. */
+delete from T_ZHOBTMIND where obtid between '90001' and '90050';
+insert into T_ZHOBTMIND(obtid, ddatetime, t, p, u, wd, wf, r, vis, keyid)
+select to_char(90000+s.n), trunc(sysdate, 'mi')-m.n/1440,
+       150+mod(s.n*7+m.n, 200), 10000+mod(m.n, 300), 40+mod(s.n+m.n, 60), mod(m.n*13, 360), mod(m.n, 120), mod(m.n, 5), 10000+s.n*100,
+       (select nvl(max(keyid), 0) from T_ZHOBTMIND)+m.n*50+s.n
+  from (select level n from dual connect by level<=50) s, (select level-1 n from dual connect by level<=1440) m;
+
+commit;
+
+exit;
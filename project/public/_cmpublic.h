@@ -38,6 +38,10 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+#include <sys/signalfd.h>
+#include <sys/uio.h>
 
 #include <iostream>
 #include <string>
@@ -46,6 +50,12 @@
 #include <list>
 #include <vector>
 #include <deque>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <atomic>
 #include <algorithm>
 
 // Using the std namespace from the STL standard library.
@@ -1222,6 +1222,285 @@ bool CLogFile::WriteEx(const char *fmt, ...)
 }
 
 
+CAsyncLog::CAsyncLog(const long MaxLogSize, const int RingSize)
+{
+  m_tracefp = 0;
+  memset(m_filename, 0, sizeof(m_filename));
+  memset(m_openmode, 0, sizeof(m_openmode));
+  m_bBackup = true;
+  m_MaxLogSize = MaxLogSize;
+  if (m_MaxLogSize < 10) m_MaxLogSize = 10;
+
+  // The size of the ring buffer is a power of 2, so the position in the buffer is the byte count masked.
+  // It holds at least one line of the longest length, or Append() would wait for the space forever.
+  m_RingSize = 16384;
+  while (m_RingSize < (size_t)RingSize * 1024) m_RingSize = m_RingSize * 2;
+
+  m_brun = false;
+  m_bthread = false;
+  pthread_key_create(&m_key, ringexit);
+  pthread_mutex_init(&m_mutex, 0);
+  pthread_cond_init(&m_cond, 0);
+}
+
+CAsyncLog::~CAsyncLog()
+{
+  Close();
+
+  for (int ii = 0; ii < m_rings.size(); ii++)
+  {
+    delete[] m_rings[ii]->buf; delete m_rings[ii];
+  }
+  m_rings.clear();
+
+  pthread_key_delete(m_key);
+  pthread_mutex_destroy(&m_mutex);
+  pthread_cond_destroy(&m_cond);
+}
+
+// Open the log file and start the background thread.
+bool CAsyncLog::Open(const char *filename, const char *openmode, bool bBackup)
+{
+  Close();
+
+  STRCPY(m_filename, sizeof(m_filename), filename);
+  m_bBackup = bBackup;
+  if (openmode == 0) STRCPY(m_openmode, sizeof(m_openmode), "a+");
+  else STRCPY(m_openmode, sizeof(m_openmode), openmode);
+
+  if ((m_tracefp = FOPEN(m_filename, m_openmode)) == 0) return false;
+
+  m_brun = true;
+  if (pthread_create(&m_thid, NULL, thmain, this) != 0)
+  {
+    m_brun = false; fclose(m_tracefp); m_tracefp = 0; return false;
+  }
+  m_bthread = true;
+
+  return true;
+}
+
+// Write the content of the ring buffers to the log file, stop the background thread and close the log file.
+void CAsyncLog::Close()
+{
+  // The background thread may have stopped already, because the log file could not be reopened.
+  if (m_bthread == true)
+  {
+    pthread_mutex_lock(&m_mutex);
+    m_brun = false;
+    pthread_cond_signal(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+
+    pthread_join(m_thid, NULL);   // The background thread drains the ring buffers before it exits.
+    m_bthread = false;
+  }
+
+  if (m_tracefp != 0) { fclose(m_tracefp); m_tracefp = 0; }
+
+  memset(m_filename, 0, sizeof(m_filename));
+  memset(m_openmode, 0, sizeof(m_openmode));
+  m_bBackup = true;
+}
+
+bool CAsyncLog::Write(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  bool bret = Append(true, fmt, ap);
+  va_end(ap);
+
+  return bret;
+}
+
+bool CAsyncLog::WriteEx(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  bool bret = Append(false, fmt, ap);
+  va_end(ap);
+
+  return bret;
+}
+
+// Append a line to the ring buffer of the current thread, wait if the ring buffer is full.
+bool CAsyncLog::Append(const bool btime, const char *fmt, va_list ap)
+{
+  if (m_brun == false) return false;
+
+  // The ring buffer of the current thread is created when the thread writes the log for the first time.
+  struct st_logring *ring = (struct st_logring *)pthread_getspecific(m_key);
+  if (ring == 0)
+  {
+    ring = new struct st_logring;
+    ring->buf = new char[m_RingSize];
+    ring->size = m_RingSize;
+    ring->head = ring->tail = 0;
+    ring->bexited = false;
+    ring->lasttime = 0;
+    memset(ring->strtime, 0, sizeof(ring->strtime));
+
+    pthread_mutex_lock(&m_mutex);
+    m_rings.push_back(ring);
+    pthread_mutex_unlock(&m_mutex);
+
+    pthread_setspecific(m_key, ring);
+  }
+
+  // Format the line, the time string is formatted again only when the second has changed.
+  char strline[16385];
+  int len = 0;
+
+  if (btime == true)
+  {
+    time_t now = time(0);
+    if (now != ring->lasttime)
+    {
+      timetostr(now, ring->strtime);
+      ring->lasttime = now;
+    }
+    len = snprintf(strline, sizeof(strline), "%s ", ring->strtime);
+  }
+
+  int ret = vsnprintf(strline + len, sizeof(strline) - len, fmt, ap);
+  if (ret < 0) return false;
+  len = len + ret;
+  if (len > sizeof(strline) - 1) len = sizeof(strline) - 1;
+
+  // Wait for the background thread if the ring buffer does not have enough space.
+  size_t head = ring->head.load(memory_order_relaxed);
+  while (ring->size - (head - ring->tail.load(memory_order_acquire)) < (size_t)len)
+  {
+    if (m_brun == false) return false;
+    pthread_cond_signal(&m_cond);
+    usleep(100);
+  }
+
+  // Copy the line into the ring buffer, in two pieces if it wraps around the end.
+  size_t pos = head & (ring->size - 1);
+  size_t first = ring->size - pos;
+  if (first > (size_t)len) first = len;
+  memcpy(ring->buf + pos, strline, first);
+  memcpy(ring->buf, strline + first, len - first);
+
+  ring->head.store(head + len, memory_order_release);   // The line is visible to the background thread after it is complete.
+
+  // Wake the background thread if the ring buffer is more than half full, it wakes every 100 milliseconds anyway.
+  if ((head + len - ring->tail.load(memory_order_relaxed)) > ring->size / 2) pthread_cond_signal(&m_cond);
+
+  return true;
+}
+
+// Write the content of all the ring buffers to the log file, return the number of bytes written.
+size_t CAsyncLog::Drain()
+{
+  size_t total = 0;
+
+  pthread_mutex_lock(&m_mutex);
+  vector<struct st_logring *> rings = m_rings;
+  pthread_mutex_unlock(&m_mutex);
+
+  for (int ii = 0; ii < rings.size(); ii++)
+  {
+    struct st_logring *ring = rings[ii];
+
+    bool bexited = ring->bexited.load(memory_order_acquire);   // Read before head, so no line is left behind.
+    size_t tail = ring->tail.load(memory_order_relaxed);
+    size_t head = ring->head.load(memory_order_acquire);
+
+    if (head != tail)
+    {
+      size_t pos = tail & (ring->size - 1);
+      size_t first = ring->size - pos;
+      if (first > head - tail) first = head - tail;
+      // Without the log file (it could not be reopened), the lines are discarded.
+      if (m_tracefp != 0)
+      {
+        fwrite(ring->buf + pos, 1, first, m_tracefp);
+        if (head - tail > first) fwrite(ring->buf, 1, head - tail - first, m_tracefp);
+      }
+
+      ring->tail.store(head, memory_order_release);
+      total = total + (head - tail);
+    }
+
+    // The thread has exited and its ring buffer is empty, release it.
+    if (bexited == true)
+    {
+      pthread_mutex_lock(&m_mutex);
+      m_rings.erase(find(m_rings.begin(), m_rings.end(), ring));
+      pthread_mutex_unlock(&m_mutex);
+      delete[] ring->buf; delete ring;
+    }
+  }
+
+  if ((total > 0) && (m_tracefp != 0)) fflush(m_tracefp);
+
+  return total;
+}
+
+// Switch the log file if it is larger than m_MaxLogSize, it is called by the background thread only.
+bool CAsyncLog::BackupLogFile()
+{
+  if (m_bBackup == false) return true;
+
+  if (ftell(m_tracefp) > m_MaxLogSize * 1024 * 1024)
+  {
+    fclose(m_tracefp);
+    m_tracefp = 0;
+
+    char strLocalTime[21];
+    memset(strLocalTime, 0, sizeof(strLocalTime));
+    LocalTime(strLocalTime, "yyyymmddhh24miss");
+
+    char bak_filename[301];
+    SNPRINTF(bak_filename, sizeof(bak_filename), 300, "%s.%s", m_filename, strLocalTime);
+    rename(m_filename, bak_filename);
+
+    if ((m_tracefp = FOPEN(m_filename, m_openmode)) == 0) return false;
+  }
+
+  return true;
+}
+
+// Main function of the background thread.
+void *CAsyncLog::thmain(void *arg)
+{
+  CAsyncLog *log = (CAsyncLog *)arg;
+
+  while (true)
+  {
+    // The log file could not be reopened, the threads writing the log must not wait for this thread any more.
+    if ((log->Drain() > 0) && (log->BackupLogFile() == false))
+    {
+      pthread_mutex_lock(&log->m_mutex);
+      log->m_brun = false;
+      pthread_mutex_unlock(&log->m_mutex);
+      break;
+    }
+
+    pthread_mutex_lock(&log->m_mutex);
+    if (log->m_brun == false) { pthread_mutex_unlock(&log->m_mutex); break; }
+
+    struct timespec abstime;
+    clock_gettime(CLOCK_REALTIME, &abstime);
+    abstime.tv_nsec = abstime.tv_nsec + 100000000;
+    if (abstime.tv_nsec >= 1000000000) { abstime.tv_sec++; abstime.tv_nsec = abstime.tv_nsec - 1000000000; }
+    pthread_cond_timedwait(&log->m_cond, &log->m_mutex, &abstime);
+    pthread_mutex_unlock(&log->m_mutex);
+  }
+
+  log->Drain();   // The lines written before Close().
+
+  return 0;
+}
+
+// Called when a thread exits, it hands its ring buffer to the background thread.
+void CAsyncLog::ringexit(void *arg)
+{
+  ((struct st_logring *)arg)->bexited.store(true, memory_order_release);
+}
+
+
 CIniFile::CIniFile()
 {
   
@@ -2035,6 +2314,32 @@ bool Writen(const int sockfd, const char *buffer, const size_t n)
   return true;
 }
 
+// Write several buffers to a socket that is ready for writing, with as few system calls as possible.
+bool Writev(const int sockfd, struct iovec *iov, int iovcnt)
+{
+  ssize_t nwritten; // Number of bytes written in each call to writev().
+
+  while (iovcnt > 0)
+  {
+    if ((nwritten = writev(sockfd, iov, iovcnt)) <= 0) return false;
+
+    // Skip the buffers that have been sent completely, and move the start of the one that has been sent partially.
+    while ((iovcnt > 0) && (nwritten >= (ssize_t)iov->iov_len))
+    {
+      nwritten = nwritten - iov->iov_len;
+      iov++; iovcnt--;
+    }
+
+    if (iovcnt > 0)
+    {
+      iov->iov_base = (char *)iov->iov_base + nwritten;
+      iov->iov_len = iov->iov_len - nwritten;
+    }
+  }
+
+  return true;
+}
+
 // Copy a file, similar to the Linux "cp" command.
 // srcfilename: The name of the source file, it is recommended to use the absolute path of the file.
 // dstfilename: The name of the destination file, it is recommended to use the absolute path of the file.
@@ -449,6 +449,76 @@ public:
   ~CLogFile();  // Destructor, calls the Close method.
 };
 
+// Asynchronous log file for multi-threaded programs, it is used in the same way as CLogFile.
+// Each thread that writes the log has its own ring buffer, Write() formats the line into it without any lock,
+// and a background thread drains the buffers into the file, so the threads neither wait for the disk nor
+// contend on the FILE*. The lines of a thread keep their order, the lines of different threads are in the order drained.
+// Note: Close() must be called before the program exits, or the lines still in the buffers are lost.
+class CAsyncLog
+{
+private:
+  // Ring buffer of a thread, written by the thread and read by the background thread.
+  struct st_logring
+  {
+    char *buf;                 // Buffer, its size is a power of 2.
+    size_t size;               // Size of the buffer.
+    atomic<size_t> head;       // Total bytes written by the thread.
+    atomic<size_t> tail;       // Total bytes written to the file.
+    atomic<bool> bexited;      // Whether the thread has exited, the ring is released after it is drained.
+    time_t lasttime;           // Time of the last line of the thread, the time string is formatted once a second.
+    char strtime[21];
+  };
+
+  FILE   *m_tracefp;           // Log file pointer.
+  char    m_filename[301];     // Log file name.
+  char    m_openmode[11];      // Log file open mode.
+  bool    m_bBackup;           // Whether to switch the log file when it exceeds m_MaxLogSize.
+  long    m_MaxLogSize;        // Maximum size of the log file in MB.
+  size_t  m_RingSize;          // Size of the ring buffer of each thread in bytes.
+
+  pthread_key_t m_key;         // Ring buffer of the current thread.
+  pthread_mutex_t m_mutex;     // Mutex for m_rings and m_cond.
+  pthread_cond_t m_cond;       // The background thread is woken when a ring buffer is half full.
+  vector<struct st_logring *> m_rings; // Ring buffers of all the threads.
+  pthread_t m_thid;            // Background thread.
+  bool m_bthread;              // Whether the background thread has been started and not joined yet.
+  atomic<bool> m_brun;         // Whether the log accepts lines, false after Close() or when the file cannot be reopened.
+
+  // Append a line to the ring buffer of the current thread, wait if the ring buffer is full.
+  bool Append(const bool btime, const char *fmt, va_list ap);
+
+  // Write the content of all the ring buffers to the log file, return the number of bytes written.
+  size_t Drain();
+
+  // Switch the log file if it is larger than m_MaxLogSize, it is called by the background thread only.
+  bool BackupLogFile();
+
+  static void *thmain(void *arg);          // Main function of the background thread.
+  static void ringexit(void *arg);         // Called when a thread exits, it hands its ring buffer to the background thread.
+public:
+  // MaxLogSize: Maximum size of the log file in MB, default is 100MB, minimum is 10MB.
+  // RingSize: Size of the ring buffer of each thread in KB, default is 256KB, it is rounded up to a power of 2,
+  // and it is at least 16KB, the longest line.
+  CAsyncLog(const long MaxLogSize = 100, const int RingSize = 256);
+
+  // Open the log file and start the background thread.
+  // filename: Log file name, it is recommended to use an absolute path. If the directory for the file does not exist, it will be created.
+  // openmode: Log file open mode, same as the mode in the fopen library function. Default value is "a+".
+  // bBackup: Whether to automatically switch log files, true - switch, false - do not switch.
+  bool Open(const char *filename, const char *openmode = 0, bool bBackup = true);
+
+  // Write content to the log file. The fmt is a variable parameter, used similar to the printf library function.
+  // Write method will write the current time, WriteEx method will not write time.
+  // A line longer than 16KB is truncated.
+  bool Write(const char *fmt, ...);
+  bool WriteEx(const char *fmt, ...);
+
+  // Write the content of the ring buffers to the log file, stop the background thread and close the log file.
+  void Close();
+
+  ~CAsyncLog();  // Destructor, calls the Close method.
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 /*
@@ -618,6 +688,13 @@ bool Readn(const int sockfd, char* buffer, const size_t n);
 // Returns true after successfully sending n bytes of data; false if the socket connection is no longer available.
 bool Writen(const int sockfd, const char* buffer, const size_t n);
 
+// Write several buffers to a socket that is ready for writing, with as few system calls as possible.
+// sockfd: The socket connection that is ready for writing.
+// iov: The buffers to be sent, the array is modified while the data is being sent.
+// iovcnt: Number of the buffers.
+// Returns true after successfully sending all the data; false if the socket connection is no longer available.
+bool Writev(const int sockfd, struct iovec *iov, int iovcnt);
+
 // The above are functions and classes for socket communication.
 ///////////////////////////////////// /////////////////////////////////////
 
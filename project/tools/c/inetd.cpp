@@ -2,6 +2,8 @@
  * Program Name: inetd.cpp, Network Proxy Service Program.
 */
 #include "_public.h"
+#include <openssl/ssl.h>
+#include <openssl/err.h>
 
 // Structure for proxy route parameters.
 struct st_route
@@ -10,19 +12,100 @@ struct st_route
   char dstip[31];       // Destination host's IP address.
   int  dstport;         // Destination host's communication port.
   int  listensock;      // Local listening socket.
+  char certfile[301];   // Certificate file (PEM) of the TLS listening route, empty if the route is not TLS.
+  char keyfile[301];    // Private key file (PEM) of the TLS listening route.
+  SSL_CTX *sslctx;      // TLS context of the route, 0 if the route is not TLS.
 } stroute;
 vector<struct st_route> vroute;       // Container for proxy routes.
-bool loadroute(const char *inifile);  // Load proxy route parameters into the vroute container.
+bool loadroute(const char *inifile, vector<struct st_route> &routes);  // Load proxy route parameters into the routes container.
+
+// Open the listening socket of a proxy route and add it to epoll.
+bool openroute(struct st_route *route);
+
+// Reload the proxy route parameters, open and close listening sockets for the routes that changed.
+// Connections that are already being relayed are not affected.
+void reloadroute(const char *inifile);
 
 // Initialize the server's listening port.
 int initserver(int port);
 
 int epollfd = 0;  // Epoll handle.
 int tfd = 0;      // Timer handle.
+int sfd = 0;      // Signal handle, SIGHUP is received through it to reload the proxy routes.
 
 #define MAXSOCK  1024
 int clientsocks[MAXSOCK];       // Store the value of the socket at the other end of each socket connection.
 int clientatime[MAXSOCK];       // Store the timestamp of the last send/receive message for each socket.
+string clientwbuf[MAXSOCK];     // Data read from the other end that could not be sent to this socket yet (send buffer full).
+
+// The client sockets are registered with EPOLLIN|EPOLLOUT|EPOLLET, one event drains the socket until EAGAIN,
+// so bulk transfers need far fewer epoll_wait() calls than one 5000-byte read per level-triggered event.
+#define RELAYBUFSIZE 65536      // Size of one read of the relay.
+
+// Read from sock until EAGAIN and send the data to the other end, return false if the connection should be closed.
+bool relay(const int sock);
+
+// Send the data waiting in clientwbuf to sock, return false if the connection should be closed.
+bool flush(const int sock);
+
+// Close both ends of a relayed connection.
+void closeclient(const int sock);
+
+// TLS termination: the client end of a TLS route is decrypted here and relayed to the destination in plain text.
+SSL  *clientssl[MAXSOCK];       // TLS connection of each socket, 0 if the socket is not TLS.
+bool clienttlsok[MAXSOCK];      // Whether the TLS handshake of the socket has finished.
+bool clientktls[MAXSOCK];       // Whether the kernel (kTLS) encrypts and decrypts the socket, then plain recv()/send() are used.
+
+// Create the TLS context of a route from its certificate and private key, return 0 if failed.
+SSL_CTX *initsslctx(struct st_route *route);
+
+// Continue the TLS handshake of sock, return false if the connection should be closed.
+bool handshake(const int sock);
+
+// Read from sock, through TLS if it is a TLS connection.
+// Return the number of bytes read, 0 if the connection is closed, -1 with errno EAGAIN if there is no more data, -1 if failed.
+int sockread(const int sock, char *buffer, const int size);
+
+// Write to sock, through TLS if it is a TLS connection.
+// Return the number of bytes written, -1 with errno EAGAIN if the socket cannot accept data now, -1 if failed.
+int sockwrite(const int sock, const char *buffer, const int size);
+
+// Upper bounds (milliseconds) of the first-byte latency histogram buckets, the last bucket holds the rest.
+#define LATENCYBUCKETS 11
+const int latencybound[LATENCYBUCKETS - 1] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000};
+
+// Traffic statistics of a proxy route, kept per listening port so that they survive a route reload.
+struct st_routestat
+{
+  int  listenport;      // Local listening communication port.
+  long conns;           // Number of connections accepted.
+  long actives;         // Number of connections being relayed.
+  long inbytes;         // Bytes relayed from the clients to the destination.
+  long inpackets;       // Number of reads relayed from the clients to the destination.
+  long outbytes;        // Bytes relayed from the destination to the clients.
+  long outpackets;      // Number of reads relayed from the destination to the clients.
+  long latency[LATENCYBUCKETS];  // First-byte latency histogram, from accepting the client to the first byte of the destination.
+};
+map<int, struct st_routestat> mroutestat;  // Traffic statistics of all routes, the key is the listening port.
+
+// The relay loop is single-threaded, so the counters below are updated without any lock.
+struct st_routestat *clientstat[MAXSOCK];  // Statistics of the route each socket belongs to.
+bool clientissrc[MAXSOCK];      // Whether the socket is the client end (true) or the destination end (false).
+long clientbytes[MAXSOCK];      // Bytes received from each socket.
+long clientpackets[MAXSOCK];    // Number of reads with data from each socket.
+long clientctime[MAXSOCK];      // Time (microseconds) the connection was accepted.
+long clientfbtime[MAXSOCK];     // For the destination end, the accept time until the first byte arrives, then 0.
+
+char statfile[301];             // Statistics file, written every time the timer expires, empty means not written.
+
+// Update the statistics after buflen bytes are read from sock.
+void updatestat(const int sock, const int buflen);
+
+// Write the statistics of the routes and connections to the statistics file.
+void writestat();
+
+// Current time in microseconds.
+long usecnow();
 
 // Initiate a socket connection to the target IP and port.
 int conntodst(const char *ip, const int port);
@@ -35,12 +118,18 @@ CPActive PActive;     // Process heartbeat.
 
 int main(int argc, char *argv[])
 {
-  if (argc != 3)
+  if ((argc != 3) && (argc != 4))
   {
     printf("\n");
-    printf("Usage: ./inetd logfile inifile\n\n");
+    printf("Usage: ./inetd logfile inifile [statfile]\n\n");
     printf("Sample: ./inetd /tmp/inetd.log /etc/inetd.conf\n\n");
+    printf("        ./inetd /tmp/inetd.log /etc/inetd.conf /tmp/inetd.stat\n\n");
     printf("        /project/tools1/bin/procctl 5 /project/tools1/bin/inetd /tmp/inetd.log /etc/inetd.conf\n\n");
+    printf("statfile: Optional, the per-route and per-connection traffic statistics are written to it every 20 seconds.\n\n");
+    printf("One route per line in inifile: listenport dstip dstport [certfile keyfile]\n");
+    printf("With certfile and keyfile (PEM), the route accepts TLS on listenport and relays plain text to dstip:dstport.\n");
+    printf("After modifying inifile, use \"kill -HUP + process number\" to reload the proxy routes,\n");
+    printf("the connections being relayed will not be disconnected.\n\n");
     return -1;
   }
 
@@ -60,38 +149,40 @@ int main(int argc, char *argv[])
 
   PActive.AddPInfo(30, "inetd");       // Set the process heartbeat timeout to 30 seconds.
 
+  memset(statfile, 0, sizeof(statfile));
+  if (argc == 4) STRCPY(statfile, sizeof(statfile), argv[3]);
+
   // Load proxy route parameters into the vroute container.
-  if (loadroute(argv[2]) == false)
+  if (loadroute(argv[2], vroute) == false)
     return -1;
 
   logfile.Write("Loaded proxy route parameters successfully (%d).\n", vroute.size());
 
-  // Initialize the server's listening sockets.
-  for (int ii = 0; ii < vroute.size(); ii++)
-  {
-    if ((vroute[ii].listensock = initserver(vroute[ii].listenport)) < 0)
-    {
-      logfile.Write("initserver(%d) failed.\n", vroute[ii].listenport);
-      EXIT(-1);
-    }
-
-    // Set the listening socket to non-blocking.
-    fcntl(vroute[ii].listensock, F_SETFL, fcntl(vroute[ii].listensock, F_GETFD, 0) | O_NONBLOCK);
-  }
-
   // Create the epoll handle.
   epollfd = epoll_create(1);
 
   struct epoll_event ev;  // Declare the event data structure.
 
-  // Prepare the read events for the listening sockets.
+  // Initialize the server's listening sockets and prepare their read events.
   for (int ii = 0; ii < vroute.size(); ii++)
   {
-    ev.events = EPOLLIN;                 // Read event.
-    ev.data.fd = vroute[ii].listensock;  // Specify the custom data for the event, it will be returned together with the events by epoll_wait().
-    epoll_ctl(epollfd, EPOLL_CTL_ADD, vroute[ii].listensock, &ev); // Add the listening socket event to epollfd.
+    if (openroute(&vroute[ii]) == false)
+      EXIT(-1);
   }
 
+  // SIGHUP is ignored by CloseIOAndSignal(), restore it and block it, then receive it through signalfd,
+  // so that the routes are reloaded in the epoll loop and not in a signal handler.
+  sigset_t sigmask;
+  sigemptyset(&sigmask);
+  sigaddset(&sigmask, SIGHUP);
+  signal(SIGHUP, SIG_DFL);
+  sigprocmask(SIG_BLOCK, &sigmask, 0);
+  sfd = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+  ev.events = EPOLLIN;
+  ev.data.fd = sfd;
+  epoll_ctl(epollfd, EPOLL_CTL_ADD, sfd, &ev);
+
   // Create the timer.
   tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);  // Create the timerfd.
 
@@ -106,12 +197,12 @@ int main(int argc, char *argv[])
   ev.data.fd = tfd;
   epoll_ctl(epollfd, EPOLL_CTL_ADD, tfd, &ev);
 
-  struct epoll_event evs[10];      // Store the events returned by epoll.
+  struct epoll_event evs[64];      // Store the events returned by epoll.
 
   while (true)
   {
     // Wait for events on the monitored sockets.
-    int infds = epoll_wait(epollfd, evs, 10, -1);
+    int infds = epoll_wait(epollfd, evs, 64, -1);
 
     // Failed to return.
     if (infds < 0) {
@@ -138,14 +229,25 @@ int main(int argc, char *argv[])
           if ((clientsocks[jj] > 0) && ((time(0) - clientatime[jj]) > 80))
           {
             logfile.Write("client(%d,%d) timeout.\n", clientsocks[jj], clientsocks[clientsocks[jj]]);
-            close(clientsocks[jj]);  close(clientsocks[clientsocks[jj]]);
-            // Set the socket value of the other end in the array to zero, these two lines of code cannot be reversed.
-            clientsocks[clientsocks[jj]] = 0;
-            // Set the socket value of this end in the array to zero, these two lines of code cannot be reversed.
-            clientsocks[jj] = 0;
+            closeclient(jj);
           }
         }
 
+        writestat();     // Write the statistics file.
+
+        continue;
+      }
+      ////////////////////////////////////////////////////////
+
+      ////////////////////////////////////////////////////////
+      // If SIGHUP has been received, reload the proxy routes.
+      if (evs[ii].data.fd == sfd)
+      {
+        struct signalfd_siginfo siginfo;
+        while (read(sfd, &siginfo, sizeof(siginfo)) == sizeof(siginfo)) ;  // Consume all pending signals.
+
+        reloadroute(argv[2]);
+
         continue;
       }
       ////////////////////////////////////////////////////////
@@ -168,27 +270,57 @@ int main(int argc, char *argv[])
             close(srcsock); break;
           }
 
+          // The relay reads until EAGAIN, so the client socket must be non-blocking.
+          fcntl(srcsock, F_SETFL, fcntl(srcsock, F_GETFL, 0) | O_NONBLOCK);
+
+          // For a TLS route, create the TLS connection of the client, the handshake is driven by the epoll events.
+          clientssl[srcsock] = 0; clienttlsok[srcsock] = false; clientktls[srcsock] = false;
+          if (vroute[jj].sslctx != 0)
+          {
+            clientssl[srcsock] = SSL_new(vroute[jj].sslctx);
+            SSL_set_fd(clientssl[srcsock], srcsock);
+            SSL_set_accept_state(clientssl[srcsock]);
+          }
+
           // Initiate a socket connection to the target IP and port.
           int dstsock = conntodst(vroute[jj].dstip, vroute[jj].dstport);
-          if (dstsock < 0) break;
+          if (dstsock < 0)
+          {
+            if (clientssl[srcsock] != 0) { SSL_free(clientssl[srcsock]); clientssl[srcsock] = 0; }
+            close(srcsock); break;
+          }
           if (dstsock >= MAXSOCK)
           {
             logfile.Write("The number of connections has exceeded the maximum value %d.\n", MAXSOCK);
+            if (clientssl[srcsock] != 0) { SSL_free(clientssl[srcsock]); clientssl[srcsock] = 0; }
             close(srcsock); close(dstsock); break;
           }
+          clientssl[dstsock] = 0; clienttlsok[dstsock] = false; clientktls[dstsock] = false;
 
           logfile.Write("Accept on port %d client(%d,%d) ok.\n", vroute[jj].listenport, srcsock, dstsock);
 
-          // Prepare read events for the two newly connected sockets and add them to epoll.
-          ev.data.fd = srcsock; ev.events = EPOLLIN;
+          // Prepare read and write events for the two newly connected sockets in ET mode and add them to epoll.
+          // The write event of dstsock also reports the completion of the non-blocking connect().
+          ev.data.fd = srcsock; ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
           epoll_ctl(epollfd, EPOLL_CTL_ADD, srcsock, &ev);
-          ev.data.fd = dstsock; ev.events = EPOLLIN;
+          ev.data.fd = dstsock; ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
           epoll_ctl(epollfd, EPOLL_CTL_ADD, dstsock, &ev);
 
           // Update the socket values and active time in the clientsocks array for the two ends of the new connection.
           clientsocks[srcsock] = dstsock; clientsocks[dstsock] = srcsock;
           clientatime[srcsock] = time(0); clientatime[dstsock] = time(0);
 
+          // Initialize the statistics of the two ends of the new connection.
+          struct st_routestat *stat = &mroutestat[vroute[jj].listenport];
+          stat->listenport = vroute[jj].listenport;
+          stat->conns++; stat->actives++;
+          clientstat[srcsock] = clientstat[dstsock] = stat;
+          clientissrc[srcsock] = true; clientissrc[dstsock] = false;
+          clientbytes[srcsock] = clientbytes[dstsock] = 0;
+          clientpackets[srcsock] = clientpackets[dstsock] = 0;
+          clientctime[srcsock] = clientctime[dstsock] = usecnow();
+          clientfbtime[srcsock] = 0; clientfbtime[dstsock] = clientctime[dstsock];
+
           break;
         }
       }
@@ -198,32 +330,34 @@ int main(int argc, char *argv[])
       ////////////////////////////////////////////////////////
 
       ////////////////////////////////////////////////////////
-      // If there is an event on a client connection socket, it means there is data sent or the connection is disconnected.
+      // If there is an event on a client connection socket, it means there is data sent, the socket is writable again,
+      // or the connection is disconnected.
 
-      char buffer[5000];   // Store the data read from the client.
-      int  buflen = 0;       // Size of the data read from the socket.
+      // The connection may have been closed by an earlier event of the same epoll_wait().
+      if (clientsocks[evs[ii].data.fd] == 0) continue;
 
-      // Read data from one end.
-      memset(buffer, 0, sizeof(buffer));
-      if ((buflen = recv(evs[ii].data.fd, buffer, sizeof(buffer), 0)) <= 0)
-      {
-        // If the connection is disconnected, we need to close both sockets.
-        logfile.Write("Client(%d,%d) disconnected.\n", evs[ii].data.fd, clientsocks[evs[ii].data.fd]);
-        close(evs[ii].data.fd);                            // Close the client's connection.
-        close(clientsocks[evs[ii].data.fd]);               // Close the other end of the client's connection.
-        clientsocks[clientsocks[evs[ii].data.fd]] = 0;       // These two lines of code cannot be reversed.
-        clientsocks[evs[ii].data.fd] = 0;                    // These two lines of code cannot be reversed.
+      bool bok = true;
 
-        continue;
+      if ((clientssl[evs[ii].data.fd] != 0) && (clienttlsok[evs[ii].data.fd] == false))
+      {
+        // The TLS handshake with the client has not finished, continue it.
+        bok = handshake(evs[ii].data.fd);
       }
+      else
+      {
+        // The socket is writable, send the data waiting for it, this also resumes reading from the other end.
+        if (evs[ii].events & EPOLLOUT) bok = flush(evs[ii].data.fd);
 
-      // Successfully read data, send the received content back to the other end without modification.
-      // logfile.Write("From %d to %d, %d bytes.\n", evs[ii].data.fd, clientsocks[evs[ii].data.fd], buflen);
-      send(clientsocks[evs[ii].data.fd], buffer, buflen, 0);
+        // Read data from this end until EAGAIN and send it to the other end without modification.
+        if ((bok == true) && (evs[ii].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) bok = relay(evs[ii].data.fd);
+      }
 
-      // Update the last active time of the client connection.
-      clientatime[evs[ii].data.fd] = time(0);
-      clientatime[clientsocks[evs[ii].data.fd]] = time(0);
+      if (bok == false)
+      {
+        // If the connection is disconnected, we need to close both sockets.
+        logfile.Write("Client(%d,%d) disconnected.\n", evs[ii].data.fd, clientsocks[evs[ii].data.fd]);
+        closeclient(evs[ii].data.fd);
+      }
     }
   }
 
@@ -257,7 +391,7 @@ int initserver(int port)
     return -1;
   }
 
-  if (listen(sock, 5) != 0)
+  if (listen(sock, SOMAXCONN) != 0)
   {
     perror("listen() failed");
     close(sock);
@@ -267,8 +401,8 @@ int initserver(int port)
   return sock;
 }
 
-// Load proxy route parameters into the vroute container.
-bool loadroute(const char *inifile)
+// Load proxy route parameters into the routes container.
+bool loadroute(const char *inifile, vector<struct st_route> &routes)
 {
   CFile File;
 
@@ -278,35 +412,146 @@ bool loadroute(const char *inifile)
     return false;
   }
 
-  char strBuffer[256];
+  char strBuffer[1024];
   CCmdStr CmdStr;
 
   while (true)
   {
     memset(strBuffer, 0, sizeof(strBuffer));
 
-    if (File.FFGETS(strBuffer, 200) == false)
+    if (File.FFGETS(strBuffer, 1000) == false)
       break;
     char *pos = strstr(strBuffer, "#");
     if (pos != 0)
       pos[0] = 0;                  // Remove comment.
+    DeleteRChar(strBuffer, '\n');           // Remove the line break, the last field may be a file name.
+    DeleteRChar(strBuffer, '\r');
     DeleteRChar(strBuffer, ' ');            // Remove right spaces.
     UpdateStr(strBuffer, "  ", " ", true);    // Replace two spaces with one space.
     CmdStr.SplitToCmd(strBuffer, " ");
-    if (CmdStr.CmdCount() != 3)
+    if ((CmdStr.CmdCount() != 3) && (CmdStr.CmdCount() != 5))
       continue;
 
     memset(&stroute, 0, sizeof(struct st_route));
     CmdStr.GetValue(0, &stroute.listenport);
-    CmdStr.GetValue(1, stroute.dstip);
+    CmdStr.GetValue(1, stroute.dstip, 30);
     CmdStr.GetValue(2, &stroute.dstport);
+    CmdStr.GetValue(3, stroute.certfile, 300);   // TLS route.
+    CmdStr.GetValue(4, stroute.keyfile, 300);
+    stroute.listensock = -1;
+
+    // A port can only be listened on once, the first route wins.
+    int ii = 0;
+    for (ii = 0; ii < routes.size(); ii++)
+      if (routes[ii].listenport == stroute.listenport) break;
+    if (ii < routes.size())
+    {
+      logfile.Write("Route on port %d is duplicated, ignored.\n", stroute.listenport);
+      continue;
+    }
+
+    routes.push_back(stroute);
+  }
+
+  return true;
+}
+
+// Open the listening socket of a proxy route and add it to epoll.
+bool openroute(struct st_route *route)
+{
+  // Load the certificate of the TLS route before listening, so a bad certificate never accepts clients.
+  if ((strlen(route->certfile) > 0) && ((route->sslctx = initsslctx(route)) == 0))
+    return false;
 
-    vroute.push_back(stroute);
+  if ((route->listensock = initserver(route->listenport)) < 0)
+  {
+    logfile.Write("initserver(%d) failed.\n", route->listenport);
+    if (route->sslctx != 0) { SSL_CTX_free(route->sslctx); route->sslctx = 0; }
+    return false;
   }
 
+  // Set the listening socket to non-blocking.
+  fcntl(route->listensock, F_SETFL, fcntl(route->listensock, F_GETFL, 0) | O_NONBLOCK);
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN;               // Read event.
+  ev.data.fd = route->listensock;    // Specify the custom data for the event, it will be returned together with the events by epoll_wait().
+  epoll_ctl(epollfd, EPOLL_CTL_ADD, route->listensock, &ev); // Add the listening socket event to epollfd.
+
   return true;
 }
 
+// Reload the proxy route parameters, open and close listening sockets for the routes that changed.
+// Connections that are already being relayed only use clientsocks, so they are not affected.
+void reloadroute(const char *inifile)
+{
+  vector<struct st_route> vnewroute;
+
+  if (loadroute(inifile, vnewroute) == false)
+  {
+    logfile.Write("Reload proxy routes failed, the current routes are kept.\n");
+    return;
+  }
+
+  // Close the listening sockets of the routes that have been removed.
+  for (int ii = 0; ii < vroute.size(); ii++)
+  {
+    int jj = 0;
+    for (jj = 0; jj < vnewroute.size(); jj++)
+      if (vnewroute[jj].listenport == vroute[ii].listenport) break;
+
+    if (jj < vnewroute.size()) continue;
+
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, vroute[ii].listensock, 0);
+    close(vroute[ii].listensock);
+    // The TLS connections being relayed hold their own reference to the context.
+    if (vroute[ii].sslctx != 0) SSL_CTX_free(vroute[ii].sslctx);
+    logfile.Write("Route on port %d removed.\n", vroute[ii].listenport);
+  }
+
+  // Keep the listening sockets of the existing ports, open listening sockets for the new ports.
+  vector<struct st_route> vroutetmp;
+  for (int jj = 0; jj < vnewroute.size(); jj++)
+  {
+    int ii = 0;
+    for (ii = 0; ii < vroute.size(); ii++)
+      if (vroute[ii].listenport == vnewroute[jj].listenport) break;
+
+    if (ii < vroute.size())
+    {
+      vnewroute[jj].listensock = vroute[ii].listensock;
+
+      // The certificate is loaded again, so a renewed certificate is used without restarting.
+      // If it cannot be loaded, the route keeps its current parameters.
+      if (strlen(vnewroute[jj].certfile) > 0)
+      {
+        if ((vnewroute[jj].sslctx = initsslctx(&vnewroute[jj])) == 0)
+        {
+          logfile.Write("Route on port %d is not changed.\n", vroute[ii].listenport);
+          vroutetmp.push_back(vroute[ii]);
+          continue;
+        }
+      }
+      if (vroute[ii].sslctx != 0) SSL_CTX_free(vroute[ii].sslctx);
+
+      // The new destination only applies to the connections accepted from now on.
+      if ((strcmp(vnewroute[jj].dstip, vroute[ii].dstip) != 0) || (vnewroute[jj].dstport != vroute[ii].dstport))
+        logfile.Write("Route on port %d changed to %s:%d.\n", vnewroute[jj].listenport, vnewroute[jj].dstip, vnewroute[jj].dstport);
+    }
+    else
+    {
+      if (openroute(&vnewroute[jj]) == false) continue;   // Skip the route whose port cannot be listened on.
+      logfile.Write("Route on port %d added (%s:%d).\n", vnewroute[jj].listenport, vnewroute[jj].dstip, vnewroute[jj].dstport);
+    }
+
+    vroutetmp.push_back(vnewroute[jj]);
+  }
+
+  vroute.swap(vroutetmp);
+
+  logfile.Write("Reloaded proxy route parameters successfully (%d).\n", vroute.size());
+}
+
 // Initiate a socket connection to the target IP and port.
 int conntodst(const char *ip, const int port)
 {
@@ -354,5 +599,313 @@ void EXIT(int sig)
 
   close(tfd);       // Close the timer.
 
+  close(sfd);       // Close the signal handle.
+
   exit(0);
 }
+
+// Read from sock until EAGAIN and send the data to the other end, return false if the connection should be closed.
+// If the other end cannot accept all the data, the rest is kept in its clientwbuf and reading from sock stops,
+// it is resumed by flush() when the other end becomes writable, so a slow receiver throttles the sender.
+bool relay(const int sock)
+{
+  static char buffer[RELAYBUFSIZE];   // Store the data read from the socket.
+  int peer = clientsocks[sock];
+
+  // The other end still has data waiting, do not read more until it has been sent.
+  if (clientwbuf[peer].empty() == false) return true;
+
+  // The TLS handshake of either end has not finished, the data is relayed when it finishes.
+  if ((clientssl[sock] != 0) && (clienttlsok[sock] == false)) return true;
+  if ((clientssl[peer] != 0) && (clienttlsok[peer] == false)) return true;
+
+  while (true)
+  {
+    int buflen = sockread(sock, buffer, sizeof(buffer));
+
+    if (buflen == 0) return false;      // The connection is disconnected.
+
+    if (buflen < 0)
+    {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return true;  // All the data has been read.
+      if (errno == EINTR) continue;
+      return false;
+    }
+
+    updatestat(sock, buflen);
+
+    // Update the last active time of the client connection.
+    clientatime[sock] = clientatime[peer] = time(0);
+
+    // logfile.Write("From %d to %d, %d bytes.\n", sock, peer, buflen);
+    int sendlen = sockwrite(peer, buffer, buflen);
+    if (sendlen < 0)
+    {
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) return false;
+      sendlen = 0;
+    }
+
+    if (sendlen < buflen)
+    {
+      clientwbuf[peer].assign(buffer + sendlen, buflen - sendlen);
+      return true;
+    }
+  }
+}
+
+// Send the data waiting in clientwbuf to sock, return false if the connection should be closed.
+bool flush(const int sock)
+{
+  if (clientwbuf[sock].empty() == true) return true;
+
+  int sendlen = sockwrite(sock, clientwbuf[sock].c_str(), clientwbuf[sock].size());
+  if (sendlen < 0)
+  {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return true;
+    return false;
+  }
+
+  clientwbuf[sock].erase(0, sendlen);
+
+  // All the data has been sent, the other end has not been read since its last edge, read it now.
+  if (clientwbuf[sock].empty() == true) return relay(clientsocks[sock]);
+
+  return true;
+}
+
+// Close both ends of a relayed connection.
+void closeclient(const int sock)
+{
+  int peer = clientsocks[sock];
+
+  clientstat[sock]->actives--;
+
+  // Send close_notify to the TLS client without waiting for its reply, and free the TLS connection.
+  if (clientssl[sock] != 0)
+  {
+    if (clienttlsok[sock] == true) SSL_shutdown(clientssl[sock]);
+    SSL_free(clientssl[sock]); clientssl[sock] = 0;
+  }
+  if (clientssl[peer] != 0)
+  {
+    if (clienttlsok[peer] == true) SSL_shutdown(clientssl[peer]);
+    SSL_free(clientssl[peer]); clientssl[peer] = 0;
+  }
+
+  close(sock);                     // Close the client's connection.
+  close(peer);                     // Close the other end of the client's connection.
+  clientwbuf[sock].clear();
+  clientwbuf[peer].clear();
+  clientsocks[peer] = 0;           // These two lines of code cannot be reversed.
+  clientsocks[sock] = 0;           // These two lines of code cannot be reversed.
+}
+
+// Create the TLS context of a route from its certificate and private key, return 0 if failed.
+SSL_CTX *initsslctx(struct st_route *route)
+{
+  SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+  if (ctx == 0)
+  {
+    logfile.Write("SSL_CTX_new() failed.\n");
+    return 0;
+  }
+
+  if ( (SSL_CTX_use_certificate_chain_file(ctx, route->certfile) != 1) ||
+       (SSL_CTX_use_PrivateKey_file(ctx, route->keyfile, SSL_FILETYPE_PEM) != 1) ||
+       (SSL_CTX_check_private_key(ctx) != 1) )
+  {
+    char errmsg[256];
+    ERR_error_string_n(ERR_get_error(), errmsg, sizeof(errmsg));
+    logfile.Write("Load TLS certificate of port %d (%s,%s) failed.\n%s\n", route->listenport, route->certfile, route->keyfile, errmsg);
+    SSL_CTX_free(ctx);
+    return 0;
+  }
+
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+  // SSL_write() may send part of the data, the rest is kept in clientwbuf and written again from another address.
+  SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+  // Session resumption, by the server-side session cache (session id) and by session tickets (enabled by default).
+  SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_sess_set_cache_size(ctx, 10000);
+  SSL_CTX_set_session_id_context(ctx, (const unsigned char *)&route->listenport, sizeof(route->listenport));
+
+#ifdef SSL_OP_ENABLE_KTLS
+  // Let the kernel do the record encryption when it supports kTLS, see handshake().
+  SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+  return ctx;
+}
+
+// Continue the TLS handshake of sock, return false if the connection should be closed.
+bool handshake(const int sock)
+{
+  SSL *ssl = clientssl[sock];
+
+  int iret = SSL_do_handshake(ssl);
+  if (iret != 1)
+  {
+    int err = SSL_get_error(ssl, iret);
+    if ((err == SSL_ERROR_WANT_READ) || (err == SSL_ERROR_WANT_WRITE)) return true;   // Wait for the next event.
+
+    char errmsg[256];
+    ERR_error_string_n(ERR_get_error(), errmsg, sizeof(errmsg));
+    logfile.Write("TLS handshake of client(%d) failed.\n%s\n", sock, errmsg);
+    return false;
+  }
+
+  clienttlsok[sock] = true;
+
+  // If the kernel encrypts and decrypts the socket in both directions and nothing is buffered in OpenSSL,
+  // the socket is relayed with plain recv()/send(), like a socket that is not TLS (it can also be spliced).
+#ifdef BIO_get_ktls_send
+  if ( (BIO_get_ktls_send(SSL_get_wbio(ssl)) == 1) && (BIO_get_ktls_recv(SSL_get_rbio(ssl)) == 1) &&
+       (SSL_has_pending(ssl) == 0) )
+    clientktls[sock] = true;
+#endif
+
+  logfile.Write("TLS handshake of client(%d) ok (%s%s%s).\n", sock, SSL_get_version(ssl),
+                SSL_session_reused(ssl) == 1 ? ",resumed" : "", clientktls[sock] == true ? ",ktls" : "");
+
+  // Relay the data that arrived with the handshake, and the data the destination sent meanwhile.
+  if (relay(sock) == false) return false;
+
+  return relay(clientsocks[sock]);
+}
+
+// Read from sock, through TLS if it is a TLS connection.
+// Return the number of bytes read, 0 if the connection is closed, -1 with errno EAGAIN if there is no more data, -1 if failed.
+int sockread(const int sock, char *buffer, const int size)
+{
+  if ((clientssl[sock] == 0) || (clientktls[sock] == true)) return recv(sock, buffer, size, 0);
+
+  int iret = SSL_read(clientssl[sock], buffer, size);
+  if (iret > 0) return iret;
+
+  int err = SSL_get_error(clientssl[sock], iret);
+  if ((err == SSL_ERROR_WANT_READ) || (err == SSL_ERROR_WANT_WRITE)) { errno = EAGAIN; return -1; }
+  if (err == SSL_ERROR_ZERO_RETURN) return 0;          // close_notify from the client.
+  if ((err == SSL_ERROR_SYSCALL) && (iret == 0)) return 0;   // The client closed without close_notify.
+
+  errno = ECONNRESET;
+  return -1;
+}
+
+// Write to sock, through TLS if it is a TLS connection.
+// Return the number of bytes written, -1 with errno EAGAIN if the socket cannot accept data now, -1 if failed.
+int sockwrite(const int sock, const char *buffer, const int size)
+{
+  if ((clientssl[sock] == 0) || (clientktls[sock] == true)) return send(sock, buffer, size, MSG_NOSIGNAL);
+
+  // With SSL_MODE_ENABLE_PARTIAL_WRITE, SSL_write() returns after each record even if the socket can take more,
+  // but the callers take a short write as a full socket and wait for EPOLLOUT, so write until all or EAGAIN.
+  int total = 0;
+  while (total < size)
+  {
+    int iret = SSL_write(clientssl[sock], buffer + total, size - total);
+    if (iret > 0) { total = total + iret; continue; }
+
+    int err = SSL_get_error(clientssl[sock], iret);
+    if ((err == SSL_ERROR_WANT_READ) || (err == SSL_ERROR_WANT_WRITE))
+    {
+      if (total > 0) return total;
+      errno = EAGAIN; return -1;
+    }
+
+    errno = ECONNRESET;
+    return -1;
+  }
+
+  return total;
+}
+
+// Current time in microseconds.
+long usecnow()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+// Update the statistics after buflen bytes are read from sock.
+void updatestat(const int sock, const int buflen)
+{
+  struct st_routestat *stat = clientstat[sock];
+
+  clientbytes[sock] += buflen;
+  clientpackets[sock]++;
+
+  if (clientissrc[sock] == true)
+  {
+    stat->inbytes += buflen; stat->inpackets++;
+    return;
+  }
+
+  stat->outbytes += buflen; stat->outpackets++;
+
+  // The first byte from the destination, record the first-byte latency.
+  if (clientfbtime[sock] > 0)
+  {
+    long ms = (usecnow() - clientfbtime[sock]) / 1000;
+    int bucket = 0;
+    for (bucket = 0; bucket < LATENCYBUCKETS - 1; bucket++)
+      if (ms < latencybound[bucket]) break;
+    stat->latency[bucket]++;
+    clientfbtime[sock] = 0;
+  }
+}
+
+// Write the statistics of the routes and connections to the statistics file.
+// The file is written to a temporary file first and then renamed, so readers never see a half-written file.
+void writestat()
+{
+  if (strlen(statfile) == 0) return;
+
+  CFile File;
+  if (File.OpenForRename(statfile, "w") == false)
+  {
+    logfile.Write("File.OpenForRename(%s) failed.\n", statfile);
+    return;
+  }
+
+  char strtime[21];
+  LocalTime(strtime, "yyyy-mm-dd hh24:mi:ss");
+  File.Fprintf("# inetd statistics at %s.\n", strtime);
+
+  // One line for every route, latency buckets are in milliseconds.
+  File.Fprintf("# route listenport dst conns actives inbytes inpackets outbytes outpackets");
+  for (int ii = 0; ii < LATENCYBUCKETS - 1; ii++) File.Fprintf(" lt%dms", latencybound[ii]);
+  File.Fprintf(" ge%dms\n", latencybound[LATENCYBUCKETS - 2]);
+
+  for (map<int, struct st_routestat>::iterator it = mroutestat.begin(); it != mroutestat.end(); it++)
+  {
+    struct st_routestat *stat = &it->second;
+
+    // Routes removed by a reload are reported with "-" as the destination.
+    char dst[51];
+    strcpy(dst, "-");
+    for (int ii = 0; ii < vroute.size(); ii++)
+      if (vroute[ii].listenport == stat->listenport) { SNPRINTF(dst, sizeof(dst), 50, "%s:%d", vroute[ii].dstip, vroute[ii].dstport); break; }
+
+    File.Fprintf("route %d %s %ld %ld %ld %ld %ld %ld", stat->listenport, dst, stat->conns, stat->actives,
+                 stat->inbytes, stat->inpackets, stat->outbytes, stat->outpackets);
+    for (int ii = 0; ii < LATENCYBUCKETS; ii++) File.Fprintf(" %ld", stat->latency[ii]);
+    File.Fprintf("\n");
+  }
+
+  // One line for every connection being relayed.
+  File.Fprintf("# conn listenport srcsock dstsock seconds inbytes inpackets outbytes outpackets\n");
+  long now = usecnow();
+  for (int ii = 0; ii < MAXSOCK; ii++)
+  {
+    if ((clientsocks[ii] <= 0) || (clientissrc[ii] == false)) continue;
+
+    int dstsock = clientsocks[ii];
+    File.Fprintf("conn %d %d %d %ld %ld %ld %ld %ld\n", clientstat[ii]->listenport, ii, dstsock, (now - clientctime[ii]) / 1000000,
+                 clientbytes[ii], clientpackets[ii], clientbytes[dstsock], clientpackets[dstsock]);
+  }
+
+  File.CloseAndRename();
+}
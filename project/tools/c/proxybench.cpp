@@ -0,0 +1,449 @@
+/*
+ * Program Name: proxybench.cpp, Load generator and benchmark for the network proxy programs (inetd/rinetd/rinetdin).
+ * It starts an echo or sink server on the loopback, opens many concurrent connections through a proxy route
+ * whose destination is that server, and reports connections/sec, throughput, relay latency and proxy CPU.
+*/
+#include "_public.h"
+
+// Structure for program running parameters.
+struct st_arg
+{
+  char ip[31];        // IP address of the proxy.
+  int  port;          // Listening port of the proxy route to benchmark.
+  int  echoport;      // Port of the built-in server, the destination of the route must be 127.0.0.1:echoport.
+  int  conns;         // Number of concurrent connections.
+  int  msgsize;       // Size of one message in bytes.
+  int  seconds;       // Duration of the benchmark in seconds.
+  int  mode;          // 1-echo, the server sends every message back and the round trip is measured; 2-sink, the server discards the data.
+  int  pid;           // Process id of the proxy, used to measure its CPU, 0 means not measured.
+} starg;
+
+CLogFile logfile;
+
+void _help();
+
+// Parse XML to st_arg structure.
+bool _xmltoarg(char *strxmlbuffer);
+
+// Main function of the built-in echo/sink server thread.
+void *srvmain(void *arg);
+int listensock = -1;   // Listening socket of the built-in server.
+
+// State of one client connection.
+struct st_client
+{
+  int  sock;          // Client socket, -1 if closed.
+  bool connected;     // Whether the connection has been established.
+  int  sendpos;       // Bytes of the current message already sent.
+  int  recvpos;       // Bytes of the current message already received back (echo mode).
+  long sendtime;      // Time (microseconds) the current message started to be sent (echo mode).
+};
+vector<struct st_client> vclient;
+
+vector<int> vlatency;   // Round trip time (microseconds) of every message (echo mode).
+
+// Current time in microseconds.
+long usecnow();
+
+// CPU time (clock ticks) used by process pid, -1 if it cannot be read.
+long proccputicks(const int pid);
+
+int main(int argc, char *argv[])
+{
+  if (argc != 3) { _help(); return -1; }
+
+  // The results are printed to the terminal, so the I/O is not closed.
+  signal(SIGPIPE, SIG_IGN);
+
+  if (logfile.Open(argv[1], "a+") == false)
+  {
+    printf("Failed to open the log file (%s).\n", argv[1]);
+    return -1;
+  }
+
+  if (_xmltoarg(argv[2]) == false) return -1;
+
+  // Thousands of connections need more file descriptors than the default limit.
+  struct rlimit rlim;
+  getrlimit(RLIMIT_NOFILE, &rlim);
+  rlim.rlim_cur = rlim.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rlim);
+
+  // Start the built-in server.
+  if (starg.echoport > 0)
+  {
+    CTcpServer TcpServer;
+    if (TcpServer.InitServer(starg.echoport, 1024) == false)
+    {
+      logfile.Write("TcpServer.InitServer(%d) failed.\n", starg.echoport);
+      return -1;
+    }
+    listensock = TcpServer.m_listenfd;
+    TcpServer.m_listenfd = -1;   // The listening socket is owned by the server thread from now on.
+
+    pthread_t srvpthid;
+    if (pthread_create(&srvpthid, NULL, srvmain, 0) != 0)
+    {
+      logfile.Write("pthread_create() failed.\n");
+      return -1;
+    }
+  }
+
+  char *message = new char[starg.msgsize];
+  memset(message, 'x', starg.msgsize);
+  char *buffer = new char[65536];
+
+  int epollfd = epoll_create(1);
+  struct epoll_event ev;
+
+  struct sockaddr_in servaddr;
+  memset(&servaddr, 0, sizeof(servaddr));
+  servaddr.sin_family = AF_INET;
+  servaddr.sin_port = htons(starg.port);
+  servaddr.sin_addr.s_addr = inet_addr(starg.ip);
+
+  // Open all connections with non-blocking connect(), the connection is established when it becomes writable.
+  long begintime = usecnow();
+  int connected = 0, failed = 0;
+  vclient.resize(starg.conns);
+  for (int ii = 0; ii < starg.conns; ii++)
+  {
+    memset(&vclient[ii], 0, sizeof(struct st_client));
+    vclient[ii].sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (vclient[ii].sock < 0) { failed++; continue; }
+
+    int opt = 1;
+    setsockopt(vclient[ii].sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    fcntl(vclient[ii].sock, F_SETFL, fcntl(vclient[ii].sock, F_GETFL, 0) | O_NONBLOCK);
+    connect(vclient[ii].sock, (struct sockaddr *)&servaddr, sizeof(servaddr));
+
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.u32 = ii;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, vclient[ii].sock, &ev);
+  }
+
+  long connecttime = 0;          // Time used to establish all the connections.
+  long starttime = 0;            // Start time of the measurement, when all the connections have been established.
+  long startticks = -1;          // CPU ticks of the proxy at the start of the measurement.
+  long totalbytes = 0;           // Bytes sent through the proxy during the measurement.
+  long messages = 0;             // Messages completed during the measurement.
+  int  closed = 0;               // Connections closed by the proxy during the measurement.
+
+  struct epoll_event evs[256];
+
+  while (true)
+  {
+    int infds = epoll_wait(epollfd, evs, 256, 100);
+    if (infds < 0) { logfile.Write("epoll() failed.\n"); break; }
+
+    long now = usecnow();
+
+    // All the connections have been established or failed, start the measurement.
+    if ((starttime == 0) && (connected + failed == starg.conns))
+    {
+      connecttime = now - begintime;
+      starttime = now;
+      startticks = proccputicks(starg.pid);
+    }
+
+    // Waiting for the connections for more than the duration, give up the rest.
+    if ((starttime == 0) && (now - begintime > starg.seconds * 1000000L))
+    {
+      failed = starg.conns - connected;
+      connecttime = now - begintime;
+      starttime = now;
+      startticks = proccputicks(starg.pid);
+    }
+
+    if ((starttime > 0) && (now - starttime >= starg.seconds * 1000000L)) break;
+
+    for (int ii = 0; ii < infds; ii++)
+    {
+      struct st_client *client = &vclient[evs[ii].data.u32];
+      if (client->sock < 0) continue;
+
+      // The connection failed or was closed by the proxy.
+      if (evs[ii].events & (EPOLLERR | EPOLLHUP))
+      {
+        if (client->connected == false) failed++; else closed++;
+        close(client->sock); client->sock = -1;
+        continue;
+      }
+
+      if (client->connected == false)
+      {
+        client->connected = true; connected++;
+      }
+
+      // Read the data echoed back by the server.
+      if (evs[ii].events & EPOLLIN)
+      {
+        int buflen = recv(client->sock, buffer, 65536, 0);
+        if (buflen == 0)
+        {
+          closed++; close(client->sock); client->sock = -1;
+          continue;
+        }
+        if (buflen > 0)
+        {
+          client->recvpos += buflen;
+
+          // The whole message has come back, record its round trip and send the next one.
+          if (client->recvpos >= starg.msgsize)
+          {
+            if (starttime > 0) { vlatency.push_back(now - client->sendtime); messages++; totalbytes += starg.msgsize; }
+            client->recvpos = 0; client->sendpos = 0;
+            ev.events = EPOLLIN | EPOLLOUT; ev.data.u32 = evs[ii].data.u32;
+            epoll_ctl(epollfd, EPOLL_CTL_MOD, client->sock, &ev);
+          }
+        }
+      }
+
+      if ((evs[ii].events & EPOLLOUT) == 0) continue;
+
+      // Send the message, in echo mode one message is outstanding per connection, in sink mode data is sent continuously.
+      if (client->sendpos == 0) client->sendtime = now;
+
+      int sendlen = send(client->sock, message + client->sendpos, starg.msgsize - client->sendpos, MSG_NOSIGNAL);
+      if (sendlen <= 0) continue;
+
+      client->sendpos += sendlen;
+      if (client->sendpos < starg.msgsize) continue;
+
+      if (starg.mode == 2)
+      {
+        if (starttime > 0) { messages++; totalbytes += starg.msgsize; }
+        client->sendpos = 0;
+        continue;
+      }
+
+      // Echo mode, wait for the message to come back before sending the next one.
+      ev.events = EPOLLIN; ev.data.u32 = evs[ii].data.u32;
+      epoll_ctl(epollfd, EPOLL_CTL_MOD, client->sock, &ev);
+    }
+  }
+
+  long elapsed = usecnow() - starttime;
+  long endticks = proccputicks(starg.pid);
+
+  // Report the results.
+  char strresult[2001];
+  memset(strresult, 0, sizeof(strresult));
+
+  SNPRINTF(strresult, sizeof(strresult), 2000,
+           "proxy=%s:%d mode=%s conns=%d msgsize=%d seconds=%d\n"
+           "connections: established=%d failed=%d closed=%d time=%.3fs rate=%.0f/s\n"
+           "throughput: messages=%ld (%.0f/s) bytes=%ld (%.2f MB/s)\n",
+           starg.ip, starg.port, starg.mode == 1 ? "echo" : "sink", starg.conns, starg.msgsize, starg.seconds,
+           connected, failed, closed, connecttime / 1000000.0, connecttime > 0 ? connected * 1000000.0 / connecttime : 0,
+           messages, messages * 1000000.0 / elapsed, totalbytes, totalbytes * 1000000.0 / elapsed / 1048576);
+  printf("%s", strresult); logfile.WriteEx("%s", strresult);
+
+  if (vlatency.size() > 0)
+  {
+    sort(vlatency.begin(), vlatency.end());
+    long sum = 0;
+    for (int ii = 0; ii < vlatency.size(); ii++) sum += vlatency[ii];
+
+    SNPRINTF(strresult, sizeof(strresult), 2000, "latency(us): avg=%ld p50=%d p99=%d p999=%d max=%d\n",
+             sum / vlatency.size(), vlatency[vlatency.size() * 50 / 100], vlatency[vlatency.size() * 99 / 100],
+             vlatency[vlatency.size() * 999 / 1000], vlatency[vlatency.size() - 1]);
+    printf("%s", strresult); logfile.WriteEx("%s", strresult);
+  }
+
+  if ((startticks >= 0) && (endticks >= 0))
+  {
+    SNPRINTF(strresult, sizeof(strresult), 2000, "proxy cpu: pid=%d %.1f%%\n", starg.pid,
+             (endticks - startticks) * 100.0 / sysconf(_SC_CLK_TCK) / (elapsed / 1000000.0));
+    printf("%s", strresult); logfile.WriteEx("%s", strresult);
+  }
+
+  logfile.WriteEx("\n");
+
+  for (int ii = 0; ii < vclient.size(); ii++)
+    if (vclient[ii].sock >= 0) close(vclient[ii].sock);
+
+  delete[] message; delete[] buffer;
+
+  return 0;
+}
+
+// Main function of the built-in echo/sink server thread.
+// The server uses epoll in ET mode, every readable socket is drained until EAGAIN.
+void *srvmain(void *arg)
+{
+  int epollfd = epoll_create(1);
+
+  fcntl(listensock, F_SETFL, fcntl(listensock, F_GETFL, 0) | O_NONBLOCK);
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN; ev.data.fd = listensock;
+  epoll_ctl(epollfd, EPOLL_CTL_ADD, listensock, &ev);
+
+  char *buffer = new char[65536];
+
+  map<int, string> mwbuf;   // Data echoed back that could not be sent yet, the key is the socket.
+
+  struct epoll_event evs[256];
+
+  while (true)
+  {
+    int infds = epoll_wait(epollfd, evs, 256, -1);
+    if (infds < 0) break;
+
+    for (int ii = 0; ii < infds; ii++)
+    {
+      int sock = evs[ii].data.fd;
+
+      if (sock == listensock)
+      {
+        while (true)
+        {
+          int connfd = accept(listensock, 0, 0);
+          if (connfd < 0) break;
+
+          int opt = 1;
+          setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+          fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL, 0) | O_NONBLOCK);
+          ev.events = EPOLLIN | EPOLLOUT | EPOLLET; ev.data.fd = connfd;
+          epoll_ctl(epollfd, EPOLL_CTL_ADD, connfd, &ev);
+        }
+        continue;
+      }
+
+      bool bclose = false;
+
+      string &wbuf = mwbuf[sock];
+
+      if (evs[ii].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+      {
+        while (true)
+        {
+          int buflen = recv(sock, buffer, 65536, 0);
+          if (buflen == 0) { bclose = true; break; }
+          if (buflen < 0) { if (errno != EAGAIN) bclose = true; break; }
+
+          if (starg.mode == 2) continue;    // Sink mode, discard the data.
+
+          // Echo mode, send the data back, keep what cannot be sent.
+          if (wbuf.empty() == false) { wbuf.append(buffer, buflen); continue; }
+          int sendlen = send(sock, buffer, buflen, MSG_NOSIGNAL);
+          if (sendlen < 0) sendlen = 0;
+          if (sendlen < buflen) wbuf.assign(buffer + sendlen, buflen - sendlen);
+        }
+      }
+
+      // Send the data waiting for this socket until the send buffer is full, the socket is edge-triggered,
+      // the next EPOLLOUT only comes after send has returned EAGAIN.
+      while ((bclose == false) && (wbuf.empty() == false))
+      {
+        int sendlen = send(sock, wbuf.c_str(), wbuf.size(), MSG_NOSIGNAL);
+        if (sendlen < 0) { if (errno != EAGAIN) bclose = true; break; }
+        wbuf.erase(0, sendlen);
+      }
+
+      if (bclose == true)
+      {
+        close(sock);
+        mwbuf.erase(sock);
+      }
+    }
+  }
+
+  delete[] buffer;
+
+  return 0;
+}
+
+// Current time in microseconds.
+long usecnow()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+// CPU time (clock ticks) used by process pid, -1 if it cannot be read.
+long proccputicks(const int pid)
+{
+  if (pid <= 0) return -1;
+
+  char filename[101];
+  SNPRINTF(filename, sizeof(filename), 100, "/proc/%d/stat", pid);
+
+  CFile File;
+  if (File.Open(filename, "r") == false) return -1;
+
+  char buffer[1024];
+  memset(buffer, 0, sizeof(buffer));
+  if (File.Fgets(buffer, 1000) == false) return -1;
+
+  // The process name (field 2) may contain spaces, the fields are counted after its closing parenthesis.
+  // utime and stime are fields 14 and 15.
+  char *pos = strrchr(buffer, ')');
+  if (pos == 0) return -1;
+
+  CCmdStr CmdStr;
+  CmdStr.SplitToCmd(pos + 2, " ");
+
+  long utime = 0, stime = 0;
+  if ((CmdStr.GetValue(11, &utime) == false) || (CmdStr.GetValue(12, &stime) == false)) return -1;
+
+  return utime + stime;
+}
+
+void _help()
+{
+  printf("\n");
+  printf("Usage: /project/tools1/bin/proxybench logfilename xmlbuffer\n\n");
+
+  printf("Sample: /project/tools1/bin/proxybench /tmp/proxybench.log \"<ip>127.0.0.1</ip><port>5101</port><echoport>5100</echoport><conns>400</conns><msgsize>1024</msgsize><seconds>10</seconds><mode>1</mode><pid>12345</pid>\"\n");
+  printf("        /project/tools1/bin/proxybench /tmp/proxybench.log \"<ip>127.0.0.1</ip><port>5101</port><echoport>5100</echoport><conns>100</conns><msgsize>65536</msgsize><seconds>10</seconds><mode>2</mode>\"\n\n");
+
+  printf("This program is the load generator of the network proxy programs. With the route \"5101 127.0.0.1 5100\" configured\n");
+  printf("in inetd (or rinetd/rinetdin), it starts an echo or sink server on port 5100, opens conns connections through port 5101,\n");
+  printf("and reports the connection rate, throughput, relay latency and the CPU of the proxy, so relay engines can be compared.\n");
+  printf("Running it with port equal to echoport gives the baseline without the proxy.\n");
+  printf("Note: the proxy uses two sockets per connection and handles at most MAXSOCK (1024) sockets.\n\n");
+
+  printf("logfilename The log file for program running, the results are also appended to it.\n");
+  printf("xmlbuffer   The parameters for program running in XML format, as follows:\n");
+  printf("ip          The IP address of the proxy, default is 127.0.0.1.\n");
+  printf("port        The listening port of the proxy route to benchmark.\n");
+  printf("echoport    The port of the built-in server, the destination of the route, 0 means using an external server.\n");
+  printf("conns       The number of concurrent connections, default is 100.\n");
+  printf("msgsize     The size of one message in bytes, default is 1024.\n");
+  printf("seconds     The duration of the benchmark in seconds, default is 10.\n");
+  printf("mode        1-echo, every message is echoed back and the round trip is measured (default); 2-sink, the server discards the data.\n");
+  printf("pid         Optional, the process id of the proxy, its CPU usage during the benchmark is reported.\n\n");
+}
+
+// Parse XML to st_arg structure.
+bool _xmltoarg(char *strxmlbuffer)
+{
+  memset(&starg, 0, sizeof(struct st_arg));
+
+  GetXMLBuffer(strxmlbuffer, "ip", starg.ip, 30);
+  if (strlen(starg.ip) == 0) strcpy(starg.ip, "127.0.0.1");
+
+  GetXMLBuffer(strxmlbuffer, "port", &starg.port);
+  if (starg.port == 0) { logfile.Write("port is null.\n"); return false; }
+
+  GetXMLBuffer(strxmlbuffer, "echoport", &starg.echoport);
+
+  GetXMLBuffer(strxmlbuffer, "conns", &starg.conns);
+  if (starg.conns <= 0) starg.conns = 100;
+
+  GetXMLBuffer(strxmlbuffer, "msgsize", &starg.msgsize);
+  if (starg.msgsize <= 0) starg.msgsize = 1024;
+
+  GetXMLBuffer(strxmlbuffer, "seconds", &starg.seconds);
+  if (starg.seconds <= 0) starg.seconds = 10;
+
+  GetXMLBuffer(strxmlbuffer, "mode", &starg.mode);
+  if ((starg.mode != 1) && (starg.mode != 2)) starg.mode = 1;
+
+  GetXMLBuffer(strxmlbuffer, "pid", &starg.pid);
+
+  return true;
+}
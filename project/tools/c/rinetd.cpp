@@ -12,17 +12,76 @@ struct st_route
   int  listensock;      // Local listening socket.
 } stroute;
 std::vector<struct st_route> vroute;       // Container for proxy routes.
-bool loadroute(const char *inifile);  // Load proxy route parameters into the vroute container.
+bool loadroute(const char *inifile, std::vector<struct st_route> &routes);  // Load proxy route parameters into the routes container.
+
+// Open the listening socket of a proxy route and add it to epoll.
+bool openroute(struct st_route *route);
+
+// Reload the proxy route parameters, open and close listening sockets for the routes that changed.
+// Connections that are already being relayed are not affected.
+void reloadroute(const char *inifile);
 
 // Initialize the server's listening port.
 int initserver(int port);
 
 int epollfd = 0;  // epoll handle.
 int tfd = 0;      // Timer handle.
+int sfd = 0;      // Signal handle, SIGHUP is received through it to reload the proxy routes.
 
 #define MAXSOCK  1024
 int clientsocks[MAXSOCK];       // Stores the value of each socket connection's remote socket.
 int clientatime[MAXSOCK];       // Stores the last time each socket connection sent/received a message.
+std::string clientwbuf[MAXSOCK];  // Data read from the remote socket that could not be sent to this socket yet (send buffer full).
+
+// The client sockets are registered with EPOLLIN|EPOLLOUT|EPOLLET, one event drains the socket until EAGAIN,
+// so bulk transfers need far fewer epoll_wait() calls than one 5000-byte read per level-triggered event.
+#define RELAYBUFSIZE 65536      // Size of one read of the relay.
+
+// Read from sock until EAGAIN and send the data to the remote socket, return false if the connection should be closed.
+bool relay(const int sock);
+
+// Send the data waiting in clientwbuf to sock, return false if the connection should be closed.
+bool flush(const int sock);
+
+// Close both ends of a relayed connection.
+void closeclient(const int sock);
+
+// Upper bounds (milliseconds) of the first-byte latency histogram buckets, the last bucket holds the rest.
+#define LATENCYBUCKETS 11
+const int latencybound[LATENCYBUCKETS - 1] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000};
+
+// Traffic statistics of a proxy route, kept per listening port so that they survive a route reload.
+struct st_routestat
+{
+  int  listenport;      // Local listening communication port.
+  long conns;           // Number of connections accepted.
+  long actives;         // Number of connections being relayed.
+  long inbytes;         // Bytes relayed from the external clients to the internal network.
+  long inpackets;       // Number of reads relayed from the external clients to the internal network.
+  long outbytes;        // Bytes relayed from the internal network to the external clients.
+  long outpackets;      // Number of reads relayed from the internal network to the external clients.
+  long latency[LATENCYBUCKETS];  // First-byte latency histogram, from accepting the client to the first byte of the internal network.
+};
+std::map<int, struct st_routestat> mroutestat;  // Traffic statistics of all routes, the key is the listening port.
+
+// The relay loop is single-threaded, so the counters below are updated without any lock.
+struct st_routestat *clientstat[MAXSOCK];  // Statistics of the route each socket belongs to.
+bool clientissrc[MAXSOCK];      // Whether the socket is the external client end (true) or the internal network end (false).
+long clientbytes[MAXSOCK];      // Bytes received from each socket.
+long clientpackets[MAXSOCK];    // Number of reads with data from each socket.
+long clientctime[MAXSOCK];      // Time (microseconds) the external client was accepted.
+long clientfbtime[MAXSOCK];     // For the internal network end, the accept time until the first byte arrives, then 0.
+
+char statfile[301];             // Statistics file, written every time the timer expires, empty means not written.
+
+// Update the statistics after buflen bytes are read from sock.
+void updatestat(const int sock, const int buflen);
+
+// Write the statistics of the routes and connections to the statistics file.
+void writestat();
+
+// Current time in microseconds.
+long usecnow();
 
 int cmdlistensock = 0;            // Server listens for incoming commands from internal clients.
 int cmdconnsock = 0;              // Control channel between internal clients and the server.
@@ -36,15 +95,19 @@ CPActive PActive;     // Process heartbeat.
 
 int main(int argc, char* argv[])
 {
-  if (argc != 4)
+  if ((argc != 4) && (argc != 5))
   {
     printf("\n");
-    printf("Usage: ./rinetd logfile inifile cmdport\n\n");
+    printf("Usage: ./rinetd logfile inifile cmdport [statfile]\n\n");
     printf("Example: ./rinetd /tmp/rinetd.log /etc/rinetd.conf 4000\n\n");
+    printf("         ./rinetd /tmp/rinetd.log /etc/rinetd.conf 4000 /tmp/rinetd.stat\n\n");
     printf("         /project/tools1/bin/procctl 5 /project/tools1/bin/rinetd /tmp/rinetd.log /etc/rinetd.conf 4000\n\n");
     printf("logfile: The log file name for this program's runtime logs.\n");
     printf("inifile: The configuration file for proxy service parameters.\n");
-    printf("cmdport: The communication port with the internal network proxy program.\n\n");
+    printf("cmdport: The communication port with the internal network proxy program.\n");
+    printf("statfile: Optional, the per-route and per-connection traffic statistics are written to it every 20 seconds.\n\n");
+    printf("After modifying inifile, use \"kill -HUP + process id\" to reload the proxy routes,\n");
+    printf("the connections being relayed will not be disconnected.\n\n");
     return -1;
   }
 
@@ -64,8 +127,11 @@ int main(int argc, char* argv[])
 
   PActive.AddPInfo(30, "inetd"); // Set the process heartbeat timeout to 30 seconds.
 
+  memset(statfile, 0, sizeof(statfile));
+  if (argc == 5) STRCPY(statfile, sizeof(statfile), argv[4]);
+
   // Load proxy route parameters into the vroute container.
-  if (loadroute(argv[2]) == false)
+  if (loadroute(argv[2], vroute) == false)
     return -1;
 
   logfile.Write("Successfully loaded proxy route parameters (%d).\n", vroute.size());
@@ -88,32 +154,31 @@ int main(int argc, char* argv[])
   }
   logfile.Write("Control channel with the internal network has been established (cmdconnsock=%d).\n", cmdconnsock);
 
-  // Initialize the server's listening sockets.
-  for (int ii = 0; ii < vroute.size(); ii++)
-  {
-    if ((vroute[ii].listensock = initserver(vroute[ii].listenport)) < 0)
-    {
-      logfile.Write("initserver(%d) failed.\n", vroute[ii].listenport);
-      EXIT(-1);
-    }
-
-    // Set the listening socket as non-blocking.
-    fcntl(vroute[ii].listensock, F_SETFL, fcntl(vroute[ii].listensock, F_GETFD, 0) | O_NONBLOCK);
-  }
-
   // Create the epoll handle.
   epollfd = epoll_create(1);
 
   struct epoll_event ev; // Declare the event data structure.
 
-  // Prepare readable events for listening to the external network sockets.
+  // Initialize the server's listening sockets and prepare their readable events.
   for (int ii = 0; ii < vroute.size(); ii++)
   {
-    ev.events = EPOLLIN;                // Read event.
-    ev.data.fd = vroute[ii].listensock;
-    epoll_ctl(epollfd, EPOLL_CTL_ADD, vroute[ii].listensock, &ev); // Add the event of listening to the external network socket to epollfd.
+    if (openroute(&vroute[ii]) == false)
+      EXIT(-1);
   }
 
+  // SIGHUP is ignored by CloseIOAndSignal(), restore it and block it, then receive it through signalfd,
+  // so that the routes are reloaded in the epoll loop and not in a signal handler.
+  sigset_t sigmask;
+  sigemptyset(&sigmask);
+  sigaddset(&sigmask, SIGHUP);
+  signal(SIGHUP, SIG_DFL);
+  sigprocmask(SIG_BLOCK, &sigmask, 0);
+  sfd = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+  ev.events = EPOLLIN;
+  ev.data.fd = sfd;
+  epoll_ctl(epollfd, EPOLL_CTL_ADD, sfd, &ev);
+
   // Note: cmdlistensock and cmdconnsock for listening to internal network programs are blocking and do not need to be managed by epoll.
 
   // Create the timer.
@@ -132,12 +197,12 @@ int main(int argc, char* argv[])
 
   PActive.AddPInfo(30, "rinetd"); // Set the process heartbeat timeout to 30 seconds.
 
-  struct epoll_event evs[10]; // Store the events returned by epoll.
+  struct epoll_event evs[64]; // Store the events returned by epoll.
 
   while (true)
   {
     // Wait for events to occur on the monitored sockets.
-    int infds = epoll_wait(epollfd, evs, 10, -1);
+    int infds = epoll_wait(epollfd, evs, 64, -1);
 
     // If epoll_wait returns an error.
     if (infds < 0)
@@ -172,15 +237,25 @@ int main(int argc, char* argv[])
           if ((clientsocks[jj] > 0) && ((time(0) - clientatime[jj]) > 80))
           {
             logfile.Write("Client (%d,%d) timed out.\n", clientsocks[jj], clientsocks[clientsocks[jj]]);
-            close(clientsocks[jj]);
-            close(clientsocks[clientsocks[jj]]);
-            // Set the remote socket value to zero in the array, the order of these two lines of code cannot be changed.
-            clientsocks[clientsocks[jj]] = 0;
-            // Set the local socket value to zero in the array, the order of these two lines of code cannot be changed.
-            clientsocks[jj] = 0;
+            closeclient(jj);
           }
         }
 
+        writestat(); // Write the statistics file.
+
+        continue;
+      }
+      ////////////////////////////////////////////////////////
+
+      ////////////////////////////////////////////////////////
+      // If SIGHUP has been received, reload the proxy routes.
+      if (evs[ii].data.fd == sfd)
+      {
+        struct signalfd_siginfo siginfo;
+        while (read(sfd, &siginfo, sizeof(siginfo)) == sizeof(siginfo)) ;  // Consume all pending signals.
+
+        reloadroute(argv[2]);
+
         continue;
       }
       ////////////////////////////////////////////////////////
@@ -205,6 +280,8 @@ int main(int argc, char* argv[])
             break;
           }
 
+          long ctime = usecnow(); // The first-byte latency includes the round trip on the control channel.
+
           // Send a command through the control channel to the internal network program, passing the routing parameters to it.
           char buffer[256];
           memset(buffer, 0, sizeof(buffer));
@@ -232,12 +309,16 @@ int main(int argc, char* argv[])
 
           // Connect the internal and external network client sockets together.
 
-          // Prepare readable events for the two newly connected sockets and add them to epoll.
+          // The relay reads until EAGAIN, so both sockets must be non-blocking.
+          fcntl(srcsock, F_SETFL, fcntl(srcsock, F_GETFL, 0) | O_NONBLOCK);
+          fcntl(dstsock, F_SETFL, fcntl(dstsock, F_GETFL, 0) | O_NONBLOCK);
+
+          // Prepare readable and writable events for the two newly connected sockets in ET mode and add them to epoll.
           ev.data.fd = srcsock;
-          ev.events = EPOLLIN;
+          ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
           epoll_ctl(epollfd, EPOLL_CTL_ADD, srcsock, &ev);
           ev.data.fd = dstsock;
-          ev.events = EPOLLIN;
+          ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
           epoll_ctl(epollfd, EPOLL_CTL_ADD, dstsock, &ev);
 
           // Update the values and active time of the two sockets in the clientsocks array.
@@ -246,6 +327,20 @@ int main(int argc, char* argv[])
           clientatime[srcsock] = time(0);
           clientatime[dstsock] = time(0);
 
+          // Initialize the statistics of the two sockets.
+          struct st_routestat *stat = &mroutestat[vroute[jj].listenport];
+          stat->listenport = vroute[jj].listenport;
+          stat->conns++;
+          stat->actives++;
+          clientstat[srcsock] = clientstat[dstsock] = stat;
+          clientissrc[srcsock] = true;
+          clientissrc[dstsock] = false;
+          clientbytes[srcsock] = clientbytes[dstsock] = 0;
+          clientpackets[srcsock] = clientpackets[dstsock] = 0;
+          clientctime[srcsock] = clientctime[dstsock] = ctime;
+          clientfbtime[srcsock] = 0;
+          clientfbtime[dstsock] = ctime;
+
           logfile.Write("Accepted port %d client (%d,%d) successfully.\n", vroute[jj].listenport, srcsock, dstsock);
 
           break;
@@ -260,30 +355,26 @@ int main(int argc, char* argv[])
       ////////////////////////////////////////////////////////
       // The following flow handles the events of the internal and external network communication link sockets.
 
-      char buffer[5000]; // Data read from the socket.
-      int buflen = 0;    // Size of the data read from the socket.
+      // The connection may have been closed by an earlier event of the same epoll_wait().
+      if (clientsocks[evs[ii].data.fd] == 0)
+        continue;
+
+      bool bok = true;
+
+      // The socket is writable, send the data waiting for it, this also resumes reading from the remote socket.
+      if (evs[ii].events & EPOLLOUT)
+        bok = flush(evs[ii].data.fd);
+
+      // Read data from this end until EAGAIN and send it directly to the remote end.
+      if ((bok == true) && (evs[ii].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+        bok = relay(evs[ii].data.fd);
 
-      // Read data from one end.
-      memset(buffer, 0, sizeof(buffer));
-      if ((buflen = recv(evs[ii].data.fd, buffer, sizeof(buffer), 0)) <= 0)
+      if (bok == false)
       {
         // If the connection has been disconnected, close both sockets.
         logfile.Write("Client (%d,%d) disconnected.\n", evs[ii].data.fd, clientsocks[evs[ii].data.fd]);
-        close(evs[ii].data.fd);                    // Close the client's connection.
-        close(clientsocks[evs[ii].data.fd]);       // Close the client's remote connection.
-        clientsocks[clientsocks[evs[ii].data.fd]] = 0; // The order of these two lines of code cannot be changed.
-        clientsocks[evs[ii].data.fd] = 0;             // The order of these two lines of code cannot be changed.
-
-        continue;
+        closeclient(evs[ii].data.fd);
       }
-
-      // If data is successfully read, send the received message directly to the remote end.
-      // logfile.Write("From %d to %d, %d bytes.\n", evs[ii].data.fd, clientsocks[evs[ii].data.fd], buflen);
-      send(clientsocks[evs[ii].data.fd], buffer, buflen, 0);
-
-      // Update the active time of both socket connections.
-      clientatime[evs[ii].data.fd] = time(0);
-      clientatime[clientsocks[evs[ii].data.fd]] = time(0);
     }
   }
 
@@ -317,7 +408,7 @@ int initserver(int port)
     return -1;
   }
 
-  if (listen(sock, 5) != 0)
+  if (listen(sock, SOMAXCONN) != 0)
   {
     perror("listen() failed");
     close(sock);
@@ -327,8 +418,8 @@ int initserver(int port)
   return sock;
 }
 
-// Load proxy route parameters into the vroute container.
-bool loadroute(const char* inifile)
+// Load proxy route parameters into the routes container.
+bool loadroute(const char* inifile, std::vector<struct st_route> &routes)
 {
   CFile File;
 
@@ -360,13 +451,100 @@ bool loadroute(const char* inifile)
     CmdStr.GetValue(0, &stroute.listenport);
     CmdStr.GetValue(1, stroute.dstip);
     CmdStr.GetValue(2, &stroute.dstport);
+    stroute.listensock = -1;
+
+    // A port can only be listened on once, the first route wins.
+    int ii = 0;
+    for (ii = 0; ii < routes.size(); ii++)
+      if (routes[ii].listenport == stroute.listenport) break;
+    if (ii < routes.size())
+    {
+      logfile.Write("Route on port %d is duplicated, ignored.\n", stroute.listenport);
+      continue;
+    }
+
+    routes.push_back(stroute);
+  }
+
+  return true;
+}
 
-    vroute.push_back(stroute);
+// Open the listening socket of a proxy route and add it to epoll.
+bool openroute(struct st_route *route)
+{
+  if ((route->listensock = initserver(route->listenport)) < 0)
+  {
+    logfile.Write("initserver(%d) failed.\n", route->listenport);
+    return false;
   }
 
+  // Set the listening socket as non-blocking.
+  fcntl(route->listensock, F_SETFL, fcntl(route->listensock, F_GETFL, 0) | O_NONBLOCK);
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN;                // Read event.
+  ev.data.fd = route->listensock;
+  epoll_ctl(epollfd, EPOLL_CTL_ADD, route->listensock, &ev); // Add the event of listening to the external network socket to epollfd.
+
   return true;
 }
 
+// Reload the proxy route parameters, open and close listening sockets for the routes that changed.
+// Connections that are already being relayed only use clientsocks, so they are not affected.
+void reloadroute(const char *inifile)
+{
+  std::vector<struct st_route> vnewroute;
+
+  if (loadroute(inifile, vnewroute) == false)
+  {
+    logfile.Write("Reload proxy routes failed, the current routes are kept.\n");
+    return;
+  }
+
+  // Close the listening sockets of the routes that have been removed.
+  for (int ii = 0; ii < vroute.size(); ii++)
+  {
+    int jj = 0;
+    for (jj = 0; jj < vnewroute.size(); jj++)
+      if (vnewroute[jj].listenport == vroute[ii].listenport) break;
+
+    if (jj < vnewroute.size()) continue;
+
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, vroute[ii].listensock, 0);
+    close(vroute[ii].listensock);
+    logfile.Write("Route on port %d removed.\n", vroute[ii].listenport);
+  }
+
+  // Keep the listening sockets of the existing ports, open listening sockets for the new ports.
+  std::vector<struct st_route> vroutetmp;
+  for (int jj = 0; jj < vnewroute.size(); jj++)
+  {
+    int ii = 0;
+    for (ii = 0; ii < vroute.size(); ii++)
+      if (vroute[ii].listenport == vnewroute[jj].listenport) break;
+
+    if (ii < vroute.size())
+    {
+      vnewroute[jj].listensock = vroute[ii].listensock;
+
+      // The new destination is passed to the internal network program for the connections accepted from now on.
+      if ((strcmp(vnewroute[jj].dstip, vroute[ii].dstip) != 0) || (vnewroute[jj].dstport != vroute[ii].dstport))
+        logfile.Write("Route on port %d changed to %s:%d.\n", vnewroute[jj].listenport, vnewroute[jj].dstip, vnewroute[jj].dstport);
+    }
+    else
+    {
+      if (openroute(&vnewroute[jj]) == false) continue;   // Skip the route whose port cannot be listened on.
+      logfile.Write("Route on port %d added (%s:%d).\n", vnewroute[jj].listenport, vnewroute[jj].dstip, vnewroute[jj].dstport);
+    }
+
+    vroutetmp.push_back(vnewroute[jj]);
+  }
+
+  vroute.swap(vroutetmp);
+
+  logfile.Write("Reloaded proxy route parameters successfully (%d).\n", vroute.size());
+}
+
 void EXIT(int sig)
 {
   logfile.Write("Program exits, sig=%d.\n\n", sig);
@@ -390,5 +568,193 @@ void EXIT(int sig)
 
   close(tfd); // Close the timer.
 
+  close(sfd); // Close the signal handle.
+
   exit(0);
 }
+
+// Read from sock until EAGAIN and send the data to the remote socket, return false if the connection should be closed.
+// If the remote socket cannot accept all the data, the rest is kept in its clientwbuf and reading from sock stops,
+// it is resumed by flush() when the remote socket becomes writable, so a slow receiver throttles the sender.
+bool relay(const int sock)
+{
+  static char buffer[RELAYBUFSIZE]; // Data read from the socket.
+  int peer = clientsocks[sock];
+
+  // The remote socket still has data waiting, do not read more until it has been sent.
+  if (clientwbuf[peer].empty() == false)
+    return true;
+
+  while (true)
+  {
+    int buflen = recv(sock, buffer, sizeof(buffer), 0);
+
+    if (buflen == 0)
+      return false; // The connection has been disconnected.
+
+    if (buflen < 0)
+    {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return true; // All the data has been read.
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+
+    updatestat(sock, buflen);
+
+    // Update the active time of both socket connections.
+    clientatime[sock] = time(0);
+    clientatime[peer] = time(0);
+
+    // logfile.Write("From %d to %d, %d bytes.\n", sock, peer, buflen);
+    int sendlen = send(peer, buffer, buflen, MSG_NOSIGNAL);
+    if (sendlen < 0)
+    {
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+        return false;
+      sendlen = 0;
+    }
+
+    if (sendlen < buflen)
+    {
+      clientwbuf[peer].assign(buffer + sendlen, buflen - sendlen);
+      return true;
+    }
+  }
+}
+
+// Send the data waiting in clientwbuf to sock, return false if the connection should be closed.
+bool flush(const int sock)
+{
+  if (clientwbuf[sock].empty() == true)
+    return true;
+
+  int sendlen = send(sock, clientwbuf[sock].c_str(), clientwbuf[sock].size(), MSG_NOSIGNAL);
+  if (sendlen < 0)
+  {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      return true;
+    return false;
+  }
+
+  clientwbuf[sock].erase(0, sendlen);
+
+  // All the data has been sent, the remote socket has not been read since its last edge, read it now.
+  if (clientwbuf[sock].empty() == true)
+    return relay(clientsocks[sock]);
+
+  return true;
+}
+
+// Close both ends of a relayed connection.
+void closeclient(const int sock)
+{
+  int peer = clientsocks[sock];
+
+  clientstat[sock]->actives--;
+
+  close(sock);               // Close the client's connection.
+  close(peer);               // Close the client's remote connection.
+  clientwbuf[sock].clear();
+  clientwbuf[peer].clear();
+  clientsocks[peer] = 0;     // The order of these two lines of code cannot be changed.
+  clientsocks[sock] = 0;     // The order of these two lines of code cannot be changed.
+}
+
+// Current time in microseconds.
+long usecnow()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+// Update the statistics after buflen bytes are read from sock.
+void updatestat(const int sock, const int buflen)
+{
+  struct st_routestat *stat = clientstat[sock];
+
+  clientbytes[sock] += buflen;
+  clientpackets[sock]++;
+
+  if (clientissrc[sock] == true)
+  {
+    stat->inbytes += buflen;
+    stat->inpackets++;
+    return;
+  }
+
+  stat->outbytes += buflen;
+  stat->outpackets++;
+
+  // The first byte from the internal network, record the first-byte latency.
+  if (clientfbtime[sock] > 0)
+  {
+    long ms = (usecnow() - clientfbtime[sock]) / 1000;
+    int bucket = 0;
+    for (bucket = 0; bucket < LATENCYBUCKETS - 1; bucket++)
+      if (ms < latencybound[bucket]) break;
+    stat->latency[bucket]++;
+    clientfbtime[sock] = 0;
+  }
+}
+
+// Write the statistics of the routes and connections to the statistics file.
+// The file is written to a temporary file first and then renamed, so readers never see a half-written file.
+void writestat()
+{
+  if (strlen(statfile) == 0) return;
+
+  CFile File;
+  if (File.OpenForRename(statfile, "w") == false)
+  {
+    logfile.Write("File.OpenForRename(%s) failed.\n", statfile);
+    return;
+  }
+
+  char strtime[21];
+  LocalTime(strtime, "yyyy-mm-dd hh24:mi:ss");
+  File.Fprintf("# rinetd statistics at %s.\n", strtime);
+
+  // One line for every route, latency buckets are in milliseconds.
+  File.Fprintf("# route listenport dst conns actives inbytes inpackets outbytes outpackets");
+  for (int ii = 0; ii < LATENCYBUCKETS - 1; ii++) File.Fprintf(" lt%dms", latencybound[ii]);
+  File.Fprintf(" ge%dms\n", latencybound[LATENCYBUCKETS - 2]);
+
+  for (std::map<int, struct st_routestat>::iterator it = mroutestat.begin(); it != mroutestat.end(); it++)
+  {
+    struct st_routestat *stat = &it->second;
+
+    // Routes removed by a reload are reported with "-" as the destination.
+    char dst[51];
+    strcpy(dst, "-");
+    for (int ii = 0; ii < vroute.size(); ii++)
+    {
+      if (vroute[ii].listenport == stat->listenport)
+      {
+        SNPRINTF(dst, sizeof(dst), 50, "%s:%d", vroute[ii].dstip, vroute[ii].dstport);
+        break;
+      }
+    }
+
+    File.Fprintf("route %d %s %ld %ld %ld %ld %ld %ld", stat->listenport, dst, stat->conns, stat->actives,
+                 stat->inbytes, stat->inpackets, stat->outbytes, stat->outpackets);
+    for (int ii = 0; ii < LATENCYBUCKETS; ii++) File.Fprintf(" %ld", stat->latency[ii]);
+    File.Fprintf("\n");
+  }
+
+  // One line for every connection being relayed.
+  File.Fprintf("# conn listenport srcsock dstsock seconds inbytes inpackets outbytes outpackets\n");
+  long now = usecnow();
+  for (int ii = 0; ii < MAXSOCK; ii++)
+  {
+    if ((clientsocks[ii] <= 0) || (clientissrc[ii] == false)) continue;
+
+    int dstsock = clientsocks[ii];
+    File.Fprintf("conn %d %d %d %ld %ld %ld %ld %ld\n", clientstat[ii]->listenport, ii, dstsock, (now - clientctime[ii]) / 1000000,
+                 clientbytes[ii], clientpackets[ii], clientbytes[dstsock], clientpackets[dstsock]);
+  }
+
+  File.CloseAndRename();
+}
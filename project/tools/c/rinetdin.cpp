@@ -11,6 +11,20 @@ int tfd = 0;     // Timer handle.
 #define MAXSOCK 1024
 int clientsocks[MAXSOCK]; // Stores the value of each socket's connected peer socket.
 int clientatime[MAXSOCK]; // Stores the last time each socket sent or received a message.
+string clientwbuf[MAXSOCK]; // Data read from the peer socket that could not be sent to this socket yet (send buffer full).
+
+// The client sockets are registered with EPOLLIN|EPOLLOUT|EPOLLET, one event drains the socket until EAGAIN,
+// so bulk transfers need far fewer epoll_wait() calls than one 5000-byte read per level-triggered event.
+#define RELAYBUFSIZE 65536 // Size of one read of the relay.
+
+// Read from sock until EAGAIN and send the data to the peer socket, return false if the connection should be closed.
+bool relay(const int sock);
+
+// Send the data waiting in clientwbuf to sock, return false if the connection should be closed.
+bool flush(const int sock);
+
+// Close both ends of a relayed channel.
+void closeclient(const int sock);
 
 // Initiate a socket connection to the target IP and port.
 int conntodst(const char* ip, const int port);
@@ -90,12 +104,12 @@ int main(int argc, char* argv[])
 
   PActive.AddPInfo(30, "rinetdin"); // Set the process heartbeat timeout to 30 seconds.
 
-  struct epoll_event evs[10]; // Store the events returned by epoll.
+  struct epoll_event evs[64]; // Store the events returned by epoll.
 
   while (true)
   {
     // Wait for events on the monitored sockets.
-    int infds = epoll_wait(epollfd, evs, 10, -1);
+    int infds = epoll_wait(epollfd, evs, 64, -1);
 
     // Return failed.
     if (infds < 0)
@@ -121,12 +135,7 @@ int main(int argc, char* argv[])
           if ((clientsocks[jj] > 0) && ((time(0) - clientatime[jj]) > 80))
           {
             logfile.Write("client(%d,%d) timeout.\n", clientsocks[jj], clientsocks[clientsocks[jj]]);
-            close(clientsocks[jj]);
-            close(clientsocks[clientsocks[jj]]);
-            // Set the peer socket in the array to empty. The order of the following two lines of code cannot be changed.
-            clientsocks[clientsocks[jj]] = 0;
-            // Set the local socket in the array to empty. The order of the following two lines of code cannot be changed.
-            clientsocks[jj] = 0;
+            closeclient(jj);
           }
         }
 
@@ -187,12 +196,13 @@ int main(int argc, char* argv[])
         // Connect the internal and external network sockets together.
         logfile.Write("New internal and external network channel (%d,%d) established.\n", srcsock, dstsock);
 
-        // Prepare readable events for the two newly connected sockets and add them to epoll.
+        // Prepare readable and writable events for the two newly connected sockets in ET mode and add them to epoll.
+        // The writable event also reports the completion of the non-blocking connect().
         ev.data.fd = srcsock;
-        ev.events = EPOLLIN;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
         epoll_ctl(epollfd, EPOLL_CTL_ADD, srcsock, &ev);
         ev.data.fd = dstsock;
-        ev.events = EPOLLIN;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
         epoll_ctl(epollfd, EPOLL_CTL_ADD, dstsock, &ev);
 
         // Update the values and activity time of the two sockets in the clientsocks array.
@@ -208,36 +218,117 @@ int main(int argc, char* argv[])
       ////////////////////////////////////////////////////////
       // The following process handles events for the internal and external network communication link sockets.
 
-      char buffer[5000]; // Data read from the socket.
-      int buflen = 0;    // Size of data read from the socket.
+      // The channel may have been closed by an earlier event of the same epoll_wait().
+      if (clientsocks[evs[ii].data.fd] == 0)
+        continue;
+
+      bool bok = true;
+
+      // The socket is writable, send the data waiting for it, this also resumes reading from the peer socket.
+      if (evs[ii].events & EPOLLOUT)
+        bok = flush(evs[ii].data.fd);
+
+      // Read data from this end until EAGAIN and send it as it is to the other end.
+      if ((bok == true) && (evs[ii].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+        bok = relay(evs[ii].data.fd);
 
-      // Read data from one end.
-      memset(buffer, 0, sizeof(buffer));
-      if ((buflen = recv(evs[ii].data.fd, buffer, sizeof(buffer), 0)) <= 0)
+      if (bok == false)
       {
         // If the connection is disconnected, close both sockets of the channel.
         logfile.Write("client(%d,%d) disconnected.\n", evs[ii].data.fd, clientsocks[evs[ii].data.fd]);
-        close(evs[ii].data.fd);                           // Close the client's connection.
-        close(clientsocks[evs[ii].data.fd]);              // Close the client's peer connection.
-        clientsocks[clientsocks[evs[ii].data.fd]] = 0;    // The order of the following two lines of code cannot be changed.
-        clientsocks[evs[ii].data.fd] = 0;                 // The order of the following two lines of code cannot be changed.
+        closeclient(evs[ii].data.fd);
+      }
+    }
+  }
+
+  return 0;
+}
+
+
+// Read from sock until EAGAIN and send the data to the peer socket, return false if the connection should be closed.
+// If the peer socket cannot accept all the data, the rest is kept in its clientwbuf and reading from sock stops,
+// it is resumed by flush() when the peer socket becomes writable, so a slow receiver throttles the sender.
+bool relay(const int sock)
+{
+  static char buffer[RELAYBUFSIZE]; // Data read from the socket.
+  int peer = clientsocks[sock];
+
+  // The peer socket still has data waiting, do not read more until it has been sent.
+  if (clientwbuf[peer].empty() == false)
+    return true;
+
+  while (true)
+  {
+    int buflen = recv(sock, buffer, sizeof(buffer), 0);
+
+    if (buflen == 0)
+      return false; // The connection is disconnected.
 
+    if (buflen < 0)
+    {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return true; // All the data has been read.
+      if (errno == EINTR)
         continue;
-      }
+      return false;
+    }
 
-      // Successfully read the data, send the received message content as it is to the other end.
-      // logfile.Write("from %d to %d,%d bytes.\n", evs[ii].data.fd, clientsocks[evs[ii].data.fd], buflen);
-      send(clientsocks[evs[ii].data.fd], buffer, buflen, 0);
+    // Update the activity time of both ends of the socket connection.
+    clientatime[sock] = time(0);
+    clientatime[peer] = time(0);
 
-      // Update the activity time of both ends of the socket connection.
-      clientatime[evs[ii].data.fd] = time(0);
-      clientatime[clientsocks[evs[ii].data.fd]] = time(0);
+    // logfile.Write("from %d to %d,%d bytes.\n", sock, peer, buflen);
+    int sendlen = send(peer, buffer, buflen, MSG_NOSIGNAL);
+    if (sendlen < 0)
+    {
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+        return false;
+      sendlen = 0;
     }
+
+    if (sendlen < buflen)
+    {
+      clientwbuf[peer].assign(buffer + sendlen, buflen - sendlen);
+      return true;
+    }
+  }
+}
+
+// Send the data waiting in clientwbuf to sock, return false if the connection should be closed.
+bool flush(const int sock)
+{
+  if (clientwbuf[sock].empty() == true)
+    return true;
+
+  int sendlen = send(sock, clientwbuf[sock].c_str(), clientwbuf[sock].size(), MSG_NOSIGNAL);
+  if (sendlen < 0)
+  {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      return true;
+    return false;
   }
 
-  return 0;
+  clientwbuf[sock].erase(0, sendlen);
+
+  // All the data has been sent, the peer socket has not been read since its last edge, read it now.
+  if (clientwbuf[sock].empty() == true)
+    return relay(clientsocks[sock]);
+
+  return true;
 }
 
+// Close both ends of a relayed channel.
+void closeclient(const int sock)
+{
+  int peer = clientsocks[sock];
+
+  close(sock);               // Close the client's connection.
+  close(peer);               // Close the client's peer connection.
+  clientwbuf[sock].clear();
+  clientwbuf[peer].clear();
+  clientsocks[peer] = 0;     // The order of the following two lines of code cannot be changed.
+  clientsocks[sock] = 0;     // The order of the following two lines of code cannot be changed.
+}
 
 // Initiate a socket connection to the target IP and port.
 int conntodst(const char* ip, const int port)
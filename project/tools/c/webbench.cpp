@@ -0,0 +1,580 @@
+/*
+ * Program Name: webbench.cpp, Load generator and benchmark for the data service bus (webserver/webserver_).
+ * It keeps conns concurrent HTTP connections to the service, each sending the requests of a weighted interface mix
+ * one after another, and reports the requests/sec, the latency percentiles and the errors, in total and per interface.
+*/
+#include "_public.h"
+
+// Structure for program running parameters.
+struct st_arg
+{
+  char ip[31];          // IP address of the service.
+  int  port;            // Listening port of the service.
+  int  conns;           // Number of concurrent connections.
+  int  seconds;         // Duration of the benchmark in seconds.
+  int  keepalive;       // 1-the requests of a connection are sent on one persistent connection; 0-one connection per request.
+  int  timeout;         // A request without a complete response in this many seconds is counted as a timeout.
+  char username[31];    // Replaces {username} in the requests.
+  char passwd[31];      // Replaces {passwd} in the requests.
+  char obtids[1001];    // Station codes separated by commas, {obtid} in the requests is replaced by one of them at random.
+                        // A numeric range such as 90001-90050 stands for all the codes in it.
+  int  span;            // Minutes between {begintime} and {endtime}, {endtime} is the current time.
+  char encoding[31];    // Accept-Encoding header of the requests, empty means no header.
+  char mixfile[301];    // File of the interface mix, empty means the built-in mix.
+} starg;
+
+CLogFile logfile;
+
+void _help();
+
+// Parse XML to st_arg structure.
+bool _xmltoarg(char *strxmlbuffer);
+
+// One interface of the mix.
+struct st_mix
+{
+  int    weight;        // Share of the requests, relative to the other interfaces.
+  string url;           // Request URL with placeholders.
+  string name;          // Name in the report, the intername of the URL.
+  vector<int> vlatency; // Time (microseconds) of every completed request.
+  long   errors;        // Responses whose status is not 200 or whose retcode is negative.
+  long   bytes;         // Bytes of the responses.
+};
+vector<struct st_mix> vmix;
+int totalweight = 0;
+
+// Load the interface mix from mixfile, or the built-in mix if mixfile is empty.
+bool LoadMix();
+
+// The station codes {obtid} is replaced with.
+vector<string> vobtid;
+
+// State of one client connection.
+struct st_client
+{
+  int    sock;          // Client socket, -1 if closed.
+  bool   connected;     // Whether the connection has been established.
+  int    mix;           // Interface of the current request, an index of vmix.
+  string request;       // The current request.
+  int    sendpos;       // Bytes of the request already sent.
+  long   sendtime;      // Time (microseconds) the current request started, including the connect if there is one.
+  string response;      // Bytes of the response received so far.
+  int    headlen;       // Length of the response header including the blank line, 0 if it is not complete.
+  int    status;        // Status code of the response.
+  long   bodylen;       // Content-Length of the response, -1 if there is none.
+  bool   bchunked;      // Whether the body of the response is chunked.
+  bool   bclose;        // Whether the service closes the connection after the response.
+  size_t chunkpos;      // Position in response of the next chunk header.
+};
+vector<struct st_client> vclient;
+
+int epollfd = -1;
+struct sockaddr_in servaddr;
+
+// Counters of the benchmark.
+long requests = 0;      // Requests completed.
+long totalbytes = 0;    // Bytes of the responses.
+long connects = 0;      // Connections established.
+long connfailed = 0;    // Connections that failed.
+long closed = 0;        // Connections closed by the service before the response was complete.
+long timeouts = 0;      // Requests without a complete response in timeout seconds.
+map<int, long> mstatus; // Number of the responses of each status code.
+
+// Open a new connection for the client with a non-blocking connect(), the request is sent when it becomes writable.
+void Connect(const int ii);
+
+// Close the connection of the client.
+void Close(const int ii);
+
+// Prepare the next request of the client, choosing an interface of the mix by weight.
+void NextRequest(const int ii, const long now);
+
+// Check the received bytes, return true if the response is complete.
+bool ResponseComplete(struct st_client *client);
+
+// Current time in microseconds.
+long usecnow();
+
+int main(int argc, char *argv[])
+{
+  if (argc != 3) { _help(); return -1; }
+
+  // The results are printed to the terminal, so the I/O is not closed.
+  signal(SIGPIPE, SIG_IGN);
+
+  if (logfile.Open(argv[1], "a+") == false)
+  {
+    printf("Failed to open the log file (%s).\n", argv[1]);
+    return -1;
+  }
+
+  if (_xmltoarg(argv[2]) == false) return -1;
+
+  if (LoadMix() == false) return -1;
+
+  // Thousands of connections need more file descriptors than the default limit.
+  struct rlimit rlim;
+  getrlimit(RLIMIT_NOFILE, &rlim);
+  rlim.rlim_cur = rlim.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rlim);
+
+  srand(time(0));
+
+  char *buffer = new char[65536];
+
+  epollfd = epoll_create(1);
+
+  memset(&servaddr, 0, sizeof(servaddr));
+  servaddr.sin_family = AF_INET;
+  servaddr.sin_port = htons(starg.port);
+  servaddr.sin_addr.s_addr = inet_addr(starg.ip);
+
+  long starttime = usecnow();
+
+  vclient.resize(starg.conns);
+  for (int ii = 0; ii < starg.conns; ii++)
+  {
+    vclient[ii].sock = -1;
+    NextRequest(ii, starttime);
+    Connect(ii);
+  }
+
+  struct epoll_event ev;
+  struct epoll_event evs[256];
+  long checktime = starttime;
+
+  while (true)
+  {
+    int infds = epoll_wait(epollfd, evs, 256, 100);
+    if (infds < 0) { logfile.Write("epoll() failed.\n"); break; }
+
+    long now = usecnow();
+    if (now - starttime >= starg.seconds * 1000000L) break;
+
+    // Once a second, give up the requests waiting for longer than timeout and open a new connection for them.
+    if (now - checktime >= 1000000L)
+    {
+      checktime = now;
+      for (int ii = 0; ii < vclient.size(); ii++)
+      {
+        if (now - vclient[ii].sendtime < starg.timeout * 1000000L) continue;
+        timeouts++;
+        Close(ii);
+        NextRequest(ii, now);
+        Connect(ii);
+      }
+    }
+
+    for (int ii = 0; ii < infds; ii++)
+    {
+      int jj = evs[ii].data.u32;
+      struct st_client *client = &vclient[jj];
+      if (client->sock < 0) continue;
+
+      // The connection has been established or has failed.
+      if (client->connected == false)
+      {
+        int err = 0;
+        socklen_t errlen = sizeof(err);
+        getsockopt(client->sock, SOL_SOCKET, SO_ERROR, &err, &errlen);
+        if ((err != 0) || (evs[ii].events & (EPOLLERR | EPOLLHUP)))
+        {
+          connfailed++;
+          Close(jj);
+          Connect(jj);
+          continue;
+        }
+        client->connected = true;
+        connects++;
+      }
+
+      // Send the rest of the request, and wait for the response when it has been sent.
+      if ((evs[ii].events & EPOLLOUT) && (client->sendpos < client->request.size()))
+      {
+        int sendlen = send(client->sock, client->request.c_str() + client->sendpos, client->request.size() - client->sendpos, MSG_NOSIGNAL);
+        if (sendlen > 0) client->sendpos += sendlen;
+        if (client->sendpos == client->request.size())
+        {
+          ev.events = EPOLLIN; ev.data.u32 = jj;
+          epoll_ctl(epollfd, EPOLL_CTL_MOD, client->sock, &ev);
+        }
+        continue;
+      }
+
+      if ((evs[ii].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) == 0) continue;
+
+      int buflen = recv(client->sock, buffer, 65536, 0);
+      if ((buflen < 0) && (errno == EAGAIN)) continue;
+
+      // The service closed the connection, it ends a response without Content-Length and chunks.
+      if (buflen <= 0)
+      {
+        if ((client->headlen > 0) && (client->bodylen < 0) && (client->bchunked == false))
+          client->bclose = true;
+        else
+        {
+          closed++;
+          Close(jj);
+          NextRequest(jj, now);
+          Connect(jj);
+          continue;
+        }
+      }
+      else
+      {
+        client->response.append(buffer, buflen);
+        if (ResponseComplete(client) == false) continue;
+      }
+
+      // The response is complete, record it.
+      struct st_mix *mix = &vmix[client->mix];
+      long bytes = client->response.size() - client->headlen;
+      mix->vlatency.push_back(now - client->sendtime);
+      mix->bytes += bytes;
+      // The service answers 200 with a negative retcode to invalid users, permissions and parameters, and when the
+      // query fails. Compressed responses are not searched, only their status is checked.
+      if ((client->status != 200) || (client->response.find("<retcode>-", client->headlen) != string::npos) ||
+          (client->response.find("\"retcode\":-", client->headlen) != string::npos)) mix->errors++;
+      mstatus[client->status]++;
+      requests++;
+      totalbytes += bytes;
+
+      // Send the next request, on the same connection if it is kept.
+      bool bkeep = (starg.keepalive == 1) && (client->bclose == false);
+      if (bkeep == false) Close(jj);
+      NextRequest(jj, now);
+      if (bkeep == false) { Connect(jj); continue; }
+
+      ev.events = EPOLLOUT; ev.data.u32 = jj;
+      epoll_ctl(epollfd, EPOLL_CTL_MOD, client->sock, &ev);
+    }
+  }
+
+  long elapsed = usecnow() - starttime;
+
+  // Report the results.
+  char strresult[2001];
+  memset(strresult, 0, sizeof(strresult));
+
+  long errors = 0;
+  for (int ii = 0; ii < vmix.size(); ii++) errors += vmix[ii].errors;
+
+  SNPRINTF(strresult, sizeof(strresult), 2000,
+           "service=%s:%d conns=%d seconds=%d keepalive=%d encoding=%s\n"
+           "requests=%ld qps=%.0f bytes=%ld (%.2f MB/s)\n"
+           "errors: failed=%ld (%.2f%%) timeouts=%ld closed=%ld connfailed=%ld connects=%ld\n",
+           starg.ip, starg.port, starg.conns, starg.seconds, starg.keepalive, starg.encoding,
+           requests, requests * 1000000.0 / elapsed, totalbytes, totalbytes * 1000000.0 / elapsed / 1048576,
+           errors, requests > 0 ? errors * 100.0 / requests : 0, timeouts, closed, connfailed, connects);
+  printf("%s", strresult); logfile.WriteEx("%s", strresult);
+
+  for (map<int, long>::iterator it = mstatus.begin(); it != mstatus.end(); it++)
+  {
+    SNPRINTF(strresult, sizeof(strresult), 2000, "status %d: %ld\n", it->first, it->second);
+    printf("%s", strresult); logfile.WriteEx("%s", strresult);
+  }
+
+  // The latency of all the interfaces together, then of each interface.
+  vector<int> vall;
+  for (int ii = 0; ii < vmix.size(); ii++) vall.insert(vall.end(), vmix[ii].vlatency.begin(), vmix[ii].vlatency.end());
+
+  for (int ii = -1; ii < (int)vmix.size(); ii++)
+  {
+    vector<int> &vlatency = (ii < 0) ? vall : vmix[ii].vlatency;
+    if (vlatency.size() == 0) continue;
+
+    sort(vlatency.begin(), vlatency.end());
+    long sum = 0;
+    for (int kk = 0; kk < vlatency.size(); kk++) sum += vlatency[kk];
+
+    if (ii < 0)
+      SNPRINTF(strresult, sizeof(strresult), 2000, "%-16s requests=%ld qps=%.0f", "all", requests, requests * 1000000.0 / elapsed);
+    else
+      SNPRINTF(strresult, sizeof(strresult), 2000, "%-16s requests=%ld qps=%.0f errors=%ld avgbytes=%ld", vmix[ii].name.c_str(),
+               (long)vlatency.size(), vlatency.size() * 1000000.0 / elapsed, vmix[ii].errors, vmix[ii].bytes / (long)vlatency.size());
+    printf("%s", strresult); logfile.WriteEx("%s", strresult);
+
+    SNPRINTF(strresult, sizeof(strresult), 2000, " latency(us): avg=%ld p50=%d p99=%d p999=%d max=%d\n",
+             sum / vlatency.size(), vlatency[vlatency.size() * 50 / 100], vlatency[vlatency.size() * 99 / 100],
+             vlatency[vlatency.size() * 999 / 1000], vlatency[vlatency.size() - 1]);
+    printf("%s", strresult); logfile.WriteEx("%s", strresult);
+  }
+
+  logfile.WriteEx("\n");
+
+  for (int ii = 0; ii < vclient.size(); ii++)
+    if (vclient[ii].sock >= 0) close(vclient[ii].sock);
+
+  delete[] buffer;
+
+  return 0;
+}
+
+// Open a new connection for the client with a non-blocking connect(), the request is sent when it becomes writable.
+void Connect(const int ii)
+{
+  struct st_client *client = &vclient[ii];
+
+  client->connected = false;
+  client->sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (client->sock < 0) { connfailed++; return; }
+
+  int opt = 1;
+  setsockopt(client->sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+  fcntl(client->sock, F_SETFL, fcntl(client->sock, F_GETFL, 0) | O_NONBLOCK);
+  connect(client->sock, (struct sockaddr *)&servaddr, sizeof(servaddr));
+
+  struct epoll_event ev;
+  ev.events = EPOLLOUT; ev.data.u32 = ii;
+  epoll_ctl(epollfd, EPOLL_CTL_ADD, client->sock, &ev);
+}
+
+// Close the connection of the client.
+void Close(const int ii)
+{
+  if (vclient[ii].sock < 0) return;
+
+  close(vclient[ii].sock);
+  vclient[ii].sock = -1;
+}
+
+// Prepare the next request of the client, choosing an interface of the mix by weight.
+void NextRequest(const int ii, const long now)
+{
+  struct st_client *client = &vclient[ii];
+
+  int pick = rand() % totalweight;
+  for (client->mix = 0; client->mix < vmix.size() - 1; client->mix++)
+  {
+    if (pick < vmix[client->mix].weight) break;
+    pick -= vmix[client->mix].weight;
+  }
+
+  char url[2001], value[301];
+  STRCPY(url, sizeof(url), vmix[client->mix].url.c_str());
+  UpdateStr(url, "{username}", starg.username, false);
+  UpdateStr(url, "{passwd}", starg.passwd, false);
+  if (vobtid.size() > 0) UpdateStr(url, "{obtid}", vobtid[rand() % vobtid.size()].c_str(), false);
+  LocalTime(value, "yyyymmddhh24miss", 0 - starg.span * 60);
+  UpdateStr(url, "{begintime}", value, false);
+  LocalTime(value, "yyyymmddhh24miss");
+  UpdateStr(url, "{endtime}", value, false);
+
+  client->request = "GET ";
+  client->request.append(url);
+  client->request.append(" HTTP/1.1\r\nHost: ");
+  client->request.append(starg.ip);
+  client->request.append("\r\n");
+  if (strlen(starg.encoding) > 0)
+    client->request.append("Accept-Encoding: ").append(starg.encoding).append("\r\n");
+  if (starg.keepalive == 0) client->request.append("Connection: close\r\n");
+  client->request.append("\r\n");
+
+  client->sendpos = 0;
+  client->sendtime = now;
+  client->response.clear();
+  client->headlen = 0;
+  client->status = 0;
+  client->bodylen = -1;
+  client->bchunked = false;
+  client->bclose = false;
+  client->chunkpos = 0;
+}
+
+// Check the received bytes, return true if the response is complete.
+bool ResponseComplete(struct st_client *client)
+{
+  // Parse the header once it is complete.
+  if (client->headlen == 0)
+  {
+    size_t pos = client->response.find("\r\n\r\n");
+    if (pos == string::npos) return false;
+
+    client->headlen = pos + 4;
+    client->chunkpos = client->headlen;
+
+    string header = client->response.substr(0, pos + 2);
+    for (int ii = 0; ii < header.size(); ii++) header[ii] = tolower(header[ii]);
+
+    client->status = atoi(header.c_str() + 9);   // "http/1.1 200 ok"
+
+    if ((pos = header.find("\r\ncontent-length:")) != string::npos) client->bodylen = atol(header.c_str() + pos + 17);
+    if (header.find("\r\ntransfer-encoding: chunked") != string::npos) client->bchunked = true;
+    if (header.find("\r\nconnection: close") != string::npos) client->bclose = true;
+  }
+
+  if (client->bodylen >= 0) return (client->response.size() >= client->headlen + client->bodylen);
+
+  // Without Content-Length and chunks, the body ends when the service closes the connection.
+  if (client->bchunked == false) return false;
+
+  // Skip the complete chunks, the response ends with the chunk of size 0 and the blank line after it.
+  while (true)
+  {
+    size_t pos = client->response.find("\r\n", client->chunkpos);
+    if (pos == string::npos) return false;
+
+    long size = strtol(client->response.c_str() + client->chunkpos, 0, 16);
+    if (size == 0) return (client->response.find("\r\n\r\n", client->chunkpos) != string::npos);
+
+    if (client->response.size() < pos + 2 + size + 2) return false;
+    client->chunkpos = pos + 2 + size + 2;
+  }
+}
+
+// Load the interface mix from mixfile, or the built-in mix if mixfile is empty.
+bool LoadMix()
+{
+  CCmdStr CmdStr;
+  CmdStr.SplitToCmd(starg.obtids, ",", true);
+  for (int ii = 0; ii < CmdStr.CmdCount(); ii++)
+  {
+    const char *obtid = CmdStr.m_vCmdStr[ii].c_str();
+    if (strlen(obtid) == 0) continue;
+
+    const char *dash = strchr(obtid, '-');
+    int first = atoi(obtid), last = (dash == 0) ? 0 : atoi(dash + 1);
+    if ((dash == 0) || (first <= 0) || (last < first)) { vobtid.push_back(obtid); continue; }
+
+    for (int jj = first; jj <= last; jj++) vobtid.push_back(to_string(jj));
+  }
+
+  vector<string> vline;
+
+  if (strlen(starg.mixfile) == 0)
+  {
+    // The built-in mix: the station parameters now and then, mostly the minute data of one station,
+    // and some queries of a time period.
+    vline.push_back("5 /api?username={username}&passwd={passwd}&intername=getzhobtcode");
+    vline.push_back("60 /api?username={username}&passwd={passwd}&intername=getzhobtmind1&obtid={obtid}");
+    vline.push_back("10 /api?username={username}&passwd={passwd}&intername=getzhobtmind2&begintime={begintime}&endtime={endtime}");
+    vline.push_back("25 /api?username={username}&passwd={passwd}&intername=getzhobtmind3&obtid={obtid}&begintime={begintime}&endtime={endtime}");
+  }
+  else
+  {
+    CFile File;
+    if (File.Open(starg.mixfile, "r") == false)
+    {
+      logfile.Write("File.Open(%s) failed.\n", starg.mixfile);
+      return false;
+    }
+
+    char strline[2001];
+    while (File.Fgets(strline, 2000, true) == true) vline.push_back(strline);
+  }
+
+  // Each line is "weight url", empty lines and lines beginning with # are skipped.
+  for (int ii = 0; ii < vline.size(); ii++)
+  {
+    char strline[2001];
+    STRCPY(strline, sizeof(strline), vline[ii].c_str());
+    DeleteLRChar(strline, ' ');
+    if ((strlen(strline) == 0) || (strline[0] == '#')) continue;
+
+    char *url = strchr(strline, ' ');
+    if (url == 0) { logfile.Write("Invalid line of the mix: %s\n", strline); return false; }
+    *url = 0; url++;
+    DeleteLRChar(url, ' ');
+
+    struct st_mix mix;
+    mix.weight = atoi(strline);
+    if (mix.weight <= 0) continue;
+    mix.url = url;
+    mix.errors = mix.bytes = 0;
+
+    // The name in the report is the intername of the URL, or the URL itself.
+    char *name = strstr(url, "intername=");
+    mix.name = (name == 0) ? url : string(name + 10, strcspn(name + 10, "&"));
+
+    if ((mix.url.find("{obtid}") != string::npos) && (vobtid.size() == 0))
+    {
+      logfile.Write("obtids is null, it is used by %s.\n", mix.name.c_str());
+      return false;
+    }
+
+    vmix.push_back(mix);
+    totalweight += mix.weight;
+  }
+
+  if (totalweight == 0) { logfile.Write("The mix is empty.\n"); return false; }
+
+  return true;
+}
+
+// Current time in microseconds.
+long usecnow()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+void _help()
+{
+  printf("\n");
+  printf("Usage: /project/tools1/bin/webbench logfilename xmlbuffer\n\n");
+
+  printf("Sample: /project/tools1/bin/webbench /tmp/webbench.log \"<ip>127.0.0.1</ip><port>8080</port><conns>100</conns><seconds>30</seconds><keepalive>1</keepalive><username>bench</username><passwd>benchpwd</passwd><obtids>90001-90050</obtids><span>60</span>\"\n");
+  printf("        /project/tools1/bin/webbench /tmp/webbench.log \"<ip>127.0.0.1</ip><port>8080</port><conns>20</conns><seconds>30</seconds><keepalive>0</keepalive><encoding>gzip</encoding><username>bench</username><passwd>benchpwd</passwd><obtids>90001-90050</obtids><mixfile>/project/idc/ini/webbench.txt</mixfile>\"\n\n");
+
+  printf("This program is the load generator of the data service bus (webserver/webserver_). It keeps conns connections to the\n");
+  printf("service, each sends the requests of the interface mix one after another, and reports the requests/sec, the latency\n");
+  printf("percentiles (p50/p99/p999) and the errors, in total and for each interface, so versions and settings can be compared.\n");
+  printf("Run it against a database filled with /project/idc/sql/webbench.sql, so the results do not depend on the live data.\n\n");
+
+  printf("logfilename The log file for program running, the results are also appended to it.\n");
+  printf("xmlbuffer   The parameters for program running in XML format, as follows:\n");
+  printf("ip          The IP address of the service, default is 127.0.0.1.\n");
+  printf("port        The listening port of the service.\n");
+  printf("conns       The number of concurrent connections, default is 10.\n");
+  printf("seconds     The duration of the benchmark in seconds, default is 10.\n");
+  printf("keepalive   1-the requests of a connection are sent on one persistent connection (default); 0-one connection per request.\n");
+  printf("timeout     A request without a complete response in this many seconds is counted as a timeout, default is 30.\n");
+  printf("username    Replaces {username} in the requests.\n");
+  printf("passwd      Replaces {passwd} in the requests.\n");
+  printf("obtids      Station codes separated by commas, {obtid} in the requests is replaced by one of them at random.\n");
+  printf("            A numeric range such as 90001-90050 stands for all the codes in it.\n");
+  printf("span        Minutes between {begintime} and {endtime} in the requests, {endtime} is the current time, default is 60.\n");
+  printf("encoding    Optional, the Accept-Encoding header of the requests, for example gzip.\n");
+  printf("mixfile     Optional, the file of the interface mix, one \"weight url\" on each line, for example:\n");
+  printf("            60 /api?username={username}&passwd={passwd}&intername=getzhobtmind1&obtid={obtid}\n");
+  printf("            The built-in mix is getzhobtcode 5, getzhobtmind1 60, getzhobtmind2 10 and getzhobtmind3 25.\n\n");
+}
+
+// Parse XML to st_arg structure.
+bool _xmltoarg(char *strxmlbuffer)
+{
+  memset(&starg, 0, sizeof(struct st_arg));
+
+  GetXMLBuffer(strxmlbuffer, "ip", starg.ip, 30);
+  if (strlen(starg.ip) == 0) strcpy(starg.ip, "127.0.0.1");
+
+  GetXMLBuffer(strxmlbuffer, "port", &starg.port);
+  if (starg.port == 0) { logfile.Write("port is null.\n"); return false; }
+
+  GetXMLBuffer(strxmlbuffer, "conns", &starg.conns);
+  if (starg.conns <= 0) starg.conns = 10;
+
+  GetXMLBuffer(strxmlbuffer, "seconds", &starg.seconds);
+  if (starg.seconds <= 0) starg.seconds = 10;
+
+  // keepalive is 1 unless it is 0.
+  char strtemp[11];
+  GetXMLBuffer(strxmlbuffer, "keepalive", strtemp, 10);
+  starg.keepalive = (strcmp(strtemp, "0") == 0) ? 0 : 1;
+
+  GetXMLBuffer(strxmlbuffer, "timeout", &starg.timeout);
+  if (starg.timeout <= 0) starg.timeout = 30;
+
+  GetXMLBuffer(strxmlbuffer, "username", starg.username, 30);
+  GetXMLBuffer(strxmlbuffer, "passwd", starg.passwd, 30);
+  GetXMLBuffer(strxmlbuffer, "obtids", starg.obtids, 1000);
+
+  GetXMLBuffer(strxmlbuffer, "span", &starg.span);
+  if (starg.span <= 0) starg.span = 60;
+
+  GetXMLBuffer(strxmlbuffer, "encoding", starg.encoding, 30);
+  GetXMLBuffer(strxmlbuffer, "mixfile", starg.mixfile, 300);
+
+  return true;
+}
@@ -6,27 +6,147 @@
  */
 #include "_public.h"
 #include "_ooci.h"
+#include <zlib.h>
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
 
-CLogFile logfile;   // Running log of the service program.
+CAsyncLog logfile;  // Running log of the service program, written by the worker threads without locking.
 CTcpServer TcpServer; // Create a server-side object.
 
 void EXIT(int sig); // Process exit function.
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER; // Initialize the mutex.
 pthread_cond_t cond = PTHREAD_COND_INITIALIZER; // Initialize the condition variable.
-vector<int> sockqueue; // Client socket queue.
+// Queue of the client sockets that have a complete request, shared among the users by weighted fair queuing.
+// Each user has its own FIFO, and each request gets a virtual finish time: the later of the current virtual time
+// and the finish time of the previous request of its user, plus 1/weight. The worker threads take the request with
+// the earliest finish time, so a user with many requests waiting gets its share of the threads by its weight,
+// and the requests of the other users do not wait behind them. Protected by mutex.
+class fairqueue
+{
+private:
+  struct st_flow
+  {
+    deque<pair<int, double> > items;   // Sockets waiting and the finish times of their requests.
+    double finish;                     // Finish time of the last request queued.
+    st_flow() { finish = 0; }
+  };
+  unordered_map<int, struct st_flow> m_flows;   // Queue of each user with requests waiting, -1 for the requests without a valid user.
+  set<pair<double, int> > m_heads;              // Finish time of the first request of each queue, and its user.
+  double m_vtime;                               // Virtual time, the finish time of the last request taken.
+  size_t m_size;                                // Number of the requests waiting.
+public:
+  fairqueue() { m_vtime = 0; m_size = 0; }
+
+  // Put the socket of a request of user flow into the queue.
+  void push(const int sockfd, const int flow, const int weight);
+
+  // Take the socket of the request with the earliest finish time, -1 if the queue is empty.
+  int pop();
+
+  // Number of the requests waiting.
+  size_t size() { return m_size; }
+};
 
-// Thread information structure.
+fairqueue sockqueue; // Queue of the client sockets that have a complete request ready for the worker threads.
+
+// The main thread is an epoll front end: it accepts the clients and reads their requests without blocking,
+// only a client with a complete request is put into sockqueue, so an idle client (a keep-alive connection
+// between two requests, or a slow client sending its request) costs no worker thread.
+// After the response, a keep-alive connection is handed back to epoll by the worker thread.
+#define MAXSOCK    10240        // Maximum value of the client socket.
+#define MAXREQSIZE 8192         // Maximum size of a request message header, a larger request is rejected.
+#define IDLETIMEOUT 60          // Idle keep-alive connections are closed after this many seconds.
+#define SENDTIMEOUT 20          // A response is abandoned when the client has not taken any of it for this many seconds.
+int epollfd = 0;                // Epoll handle.
+int tfd = 0;                    // Timer handle.
+string clientrbuf[MAXSOCK];     // Data received from each client socket that has not been processed yet.
+time_t clientatime[MAXSOCK];    // Last active time of each client socket, 0 if the socket is not connected.
+bool clientbusy[MAXSOCK];       // Whether the client socket is owned by a worker thread, epoll does not touch it then.
+bool clientkeepalive[MAXSOCK];  // Whether the connection is kept after the response of the current request.
+long clientsent[MAXSOCK];       // Bytes of the response body sent to the client for the current request.
+char clientip[MAXSOCK][16];     // Address of each client socket.
+class encoder *clientenc[MAXSOCK];  // Compressor of the response body of the current request, 0 if it is not compressed.
+
+// Read the data of a client socket without blocking, return false if the connection should be closed.
+bool RecvRequest(const int sockfd);
+
+// Take the first complete request message from the data received from the client socket, return false if there is none.
+bool GetRequest(const int sockfd, string &request);
+
+// Process one request of the client, return true if the connection can be kept for the next request.
+// sendbuf is the output buffer of the worker thread, reused by all its requests.
+// enc is the compressor of the worker thread, reused by all its requests.
+// stat returns the statistics of the request for the metrics.
+bool DoRequest(const int sockfd, const char *buffer, string &sendbuf, class encoder &enc, struct st_reqstat &stat);
+
+// Send a complete response message with the body to the client.
+bool SendResponse(const int sockfd, const char *body);
+
+// Send a piece of the response body of ExecSQL to the client, compressed if the response is compressed.
+// len=0 ends the response body.
+bool WriteBody(const int sockfd, const char *buffer, const int len);
+
+// Send a piece of the response body as it is, with chunked transfer encoding on a keep-alive connection.
+// len=0 ends the response body.
+bool WriteChunk(const int sockfd, const char *buffer, const int len);
+
+// Hold the partial segments of a response in the kernel (TCP_CORK) until the response is complete.
+void SetCork(const int sockfd, const bool bcork);
+
+// Close a client socket and clear its state.
+void CloseClient(const int sockfd);
+
+// Invalidate the cached results of an interface, requested by the ingestion programs on this host after they load new data.
+bool Invalidate(const int sockfd, const struct st_params &params);
+
+// Whether the client is a program on this host, only they can call the administration URLs.
+bool LocalPeer(const int sockfd);
+
+// The number of worker threads follows the load: a thread is started when a request is queued and no thread
+// is idle, up to maxthreads, and a thread exits when it has been idle for threadidle seconds, down to minthreads.
+// When maxqueue requests are waiting, the new ones are answered with 503 at once instead of queueing without bound.
+// Thread information structure, a thread keeps its slot in vthid while it runs, its number is the slot number.
+// A worker thread can only be cancelled while it waits for a client (deferred cancellation), a request in
+// progress is never interrupted with a database connection, a lock or a half-written response.
 struct st_pthinfo
 {
   pthread_t pthid; // Thread ID.
   time_t atime; // Last activity time.
+  bool brun;    // Whether a thread is running in this slot.
+  bool bbusy;   // Whether the thread is processing a client, the monitor reports a long request.
 };
 
-pthread_spinlock_t spin; // Spin lock for vthid.
-vector<struct st_pthinfo> vthid; // Container for all thread information.
+pthread_spinlock_t spin; // Spin lock for vthid and nthreads.
+vector<struct st_pthinfo> vthid; // Slots of the worker threads, maxthreads slots.
+int nthreads = 0;        // Number of the running worker threads, protected by spin.
+int nidle = 0;           // Number of the worker threads waiting for a client, protected by mutex.
+atomic<long> busyus(0);  // Time spent by the worker threads on the clients since the last report, in microseconds.
+atomic<long> shedcount(0); // Number of the requests answered with 503 since the last report.
+CTimer reporttimer;      // Time since the last report of the worker threads.
 void *thmain(void *arg); // Worker thread main function.
 
+// Start a worker thread in a free slot, return false if maxthreads threads are running or pthread_create() failed.
+bool StartThread();
+
+// Answer a request with 503 and close the connection, when too many requests are waiting for the worker threads.
+void ShedClient(const int sockfd);
+
+// Write the number of the worker threads, their utilization and the shed requests to the log.
+void ReportThreads();
+
+// Find the user of the request for the fair queue and take a token from the bucket of the user.
+// Return false if the user has exceeded its rate. flow returns the number of the user, -1 if the request has
+// no valid user, the worker thread answers it then. The main thread calls it for the first request read from
+// the client, the worker thread for each request the client has pipelined behind it.
+bool Admit(const int sockfd, int &flow, int &weight);
+
+// Answer the first request of the client with 429, its user has exceeded its rate. Return false if the connection
+// has to be closed.
+bool Throttle(const int sockfd);
+atomic<long> throttlecount(0); // Number of the requests answered with 429 since the last report.
+
 pthread_t checkpthid;
 void *checkthmain(void *arg); // Monitor thread main function.
 
@@ -39,8 +159,25 @@ void *checkpool(void *arg); // Database connection pool checking thread function
 struct st_arg
 {
   char connstr[101]; // Database connection parameters.
+  char replicas[1001]; // Connection parameters of the read replicas, separated by commas.
+  char lagsql[301];    // SQL returning one number on the primary and the replicas, the difference is the lag of a replica.
+  int maxlag;          // A replica whose lag is larger than this is not used.
   char charset[51]; // Database character set.
   int port; // Web service listening port.
+  int cachesize; // Size of the result cache in MB.
+  int refreshsecs; // Interval of reloading the parameter tables, in seconds.
+  int minconns; // Number of database connections kept even if they are idle.
+  int maxconns; // Maximum number of database connections.
+  int conntimeout; // Idle database connections above minconns are disconnected after this many seconds.
+  int waittimeout; // Time in milliseconds a request waits for a free database connection.
+  int minthreads; // Minimum number of worker threads.
+  int maxthreads; // Maximum number of worker threads.
+  int threadidle; // A worker thread above minthreads exits after it has been idle for this many seconds.
+  int maxqueue;   // Maximum number of requests waiting for the worker threads.
+  int userlog;    // Whether the calls are written to T_USERLOG, 1-yes, 0-no.
+  int userlogqueue; // Maximum number of the records waiting to be written to T_USERLOG.
+  int streamsecs;   // Interval of polling the new rows for the subscribers, in seconds.
+  int maxstreams;   // Maximum number of the subscribers.
 } starg;
 
 // Display program help.
@@ -49,57 +186,652 @@ void _help(char *argv[]);
 // Parse XML into the parameter starg structure.
 bool _xmltoarg(char *strxmlbuffer);
 
-// Read client messages.
-int ReadT(const int sockfd, char *buffer, const int size, const int itimeout);
+// Parameters of the request, parsed from the request line in one pass by ParseParams(). The names and the values
+// point into the request message, nothing is copied or allocated, getvalue() decodes a value when it copies it.
+#define MAXPARAMS 32      // Parameters after the first MAXPARAMS are ignored.
+struct st_param
+{
+  const char *name;      // Name of the parameter.
+  int namelen;           // Length of the name.
+  const char *value;     // Value of the parameter, percent-encoded as in the URL.
+  int valuelen;          // Length of the value.
+};
+
+struct st_params
+{
+  int count;                          // Number of the parameters.
+  struct st_param params[MAXPARAMS];  // Parameters in the order of the URL.
+};
+
+// Parse the query string of the request line, "GET /api?name1=value1&name2=value2 HTTP/1.1".
+void ParseParams(const char *buffer, struct st_params &params);
+
+// Get the value of a parameter from the GET request, percent-decoded, at most len bytes.
+// Return false if the parameter is not in the request, value is empty then.
+bool getvalue(const struct st_params &params, const char *name, char *value, const int len);
+
+// Snapshot of the parameter tables T_USERINFO, T_INTERCFG and T_USERANDINTER in memory, so authentication,
+// permission check and the interface parameters are hash lookups and a request needs only its own query.
+// The worker threads only read a snapshot. The refresh thread loads a new one every refreshsecs seconds and
+// replaces the pointer atomically, the old one is freed when the last request using it has finished (RCU).
+struct st_intercfg
+{
+  string intername;         // Interface name.
+  string selectsql;         // Interface SQL.
+  vector<string> vcols;     // Output column names (colstr).
+  vector<string> vbindin;   // Interface parameters (bindin).
+  int cachesecs;            // Seconds the result is cached, 0 if it is not cached.
+  int index;                // Number of the interface, it does not change when the snapshot is reloaded.
+  string pagekey;           // Column for keyset pagination (pagekey), empty if the interface cannot be paged.
+  int pagecol;              // Position of pagekey in vcols.
+  string pagesql;           // SQL of a page: the rows of selectsql with pagekey greater than the after parameter,
+                            // ordered by pagekey, at most limit rows.
+  string firstsql;          // SQL of the first page, the same without the after parameter.
+};
+
+#define PAGE_NONE  0   // The whole result of the interface.
+#define PAGE_FIRST 1   // The first page, firstsql.
+#define PAGE_NEXT  2   // A page after the after parameter, pagesql.
+
+struct st_usercfg
+{
+  string username;          // Username.
+  string passwd;            // Password.
+  int index;                // Number of the user, it does not change when the snapshot is reloaded.
+  double ratelimit;         // Requests per second allowed to the user, 0 means no limit.
+  int burst;                // Requests the user can send at once above the rate.
+  int weight;               // Share of the worker threads when the requests of several users are waiting.
+};
+
+struct st_paramcfg
+{
+  unordered_map<string, struct st_usercfg> musers;    // Password and number of each valid user.
+  unordered_map<string, struct st_intercfg> minters;  // Parameters of each valid interface.
+  unordered_set<string> mperms;                       // Interfaces each user can call, username+'\1'+intername.
+};
+
+shared_ptr<const struct st_paramcfg> paramcfg;  // Current snapshot, read with atomic_load(), replaced with atomic_store().
+
+// Load the parameter tables into a new snapshot and replace the current one, return false if failed, the current one is kept.
+bool LoadParamCfg();
 
-// Get parameters from the GET request.
-bool getvalue(const char *buffer, const char *name, char *value, const int len);
+pthread_t refreshid;
+void *refreshmain(void *arg); // Thread function to reload the parameter tables.
 
 // Check username and password in the URL, if incorrect, return authentication failed response message.
-bool Login(connection *conn, const char *buffer, const int sockfd);
+// Return the parameters of the user, 0 if authentication failed.
+const struct st_usercfg *Login(const struct st_paramcfg *cfg, const struct st_params &params, const int sockfd);
 
 // Check if the user has permission to call the interface, if not, return no permission response message.
-bool CheckPerm(connection *conn, const char *buffer, const int sockfd);
+// Return the parameters of the interface, 0 if no permission.
+const struct st_intercfg *CheckPerm(const struct st_paramcfg *cfg, const struct st_params &params, const int sockfd);
+
+// Metrics of the interfaces and the users, served in the Prometheus text format on GET /metrics.
+// Each worker thread adds to the accumulator of its own slot with relaxed loads and stores, there is one writer
+// for each accumulator, so the hot path takes no lock and no locked instruction. /metrics sums the accumulators
+// of all the slots. The counters only grow, a slot keeps its accumulator for the next thread when its thread exits.
+#define MAXINTERS 256     // Interfaces numbered MAXINTERS and above are not measured.
+#define MAXUSERS  1024    // Users numbered MAXUSERS and above are not measured.
+
+// Phases of a request, each interface has a latency histogram for each phase.
+#define PH_AUTH      0    // Authentication and permission check.
+#define PH_DBWAIT    1    // Waiting for a free database connection.
+#define PH_QUERY     2    // Executing the SQL statement and fetching the rows.
+#define PH_SERIALIZE 3    // Formatting the rows and sending them to the client.
+#define PH_TOTAL     4    // The whole request.
+#define PHASES       5
+const char *phasename[PHASES] = { "auth", "dbwait", "query", "serialize", "total" };
+
+// Upper bounds of the histogram buckets in microseconds, the last bucket has no bound (+Inf).
+#define BUCKETS 14
+const long bucketbound[BUCKETS - 1] = { 100, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 5000000 };
+
+struct st_metrics
+{
+  atomic<long> requests[MAXINTERS];    // Requests of each interface.
+  atomic<long> errors[MAXINTERS];      // Requests failed for the database or the network.
+  atomic<long> cachehits[MAXINTERS];   // Requests answered from the result cache.
+  atomic<long> shared[MAXINTERS];      // Requests answered with the result of an identical request in flight.
+  atomic<long> rows[MAXINTERS];        // Rows sent.
+  atomic<long> bytes[MAXINTERS];       // Bytes of the response bodies sent.
+  atomic<long> buckets[MAXINTERS][PHASES][BUCKETS];  // Latency histograms, the buckets are not cumulative here.
+  atomic<long> sumus[MAXINTERS][PHASES];             // Sum of the latencies in microseconds.
+  atomic<long> userrequests[MAXUSERS]; // Requests of each user.
+  atomic<long> userdenied[MAXUSERS];   // Requests of each user denied for permission.
+  atomic<long> userbytes[MAXUSERS];    // Bytes of the response bodies sent to each user.
+  atomic<long> authfailures;           // Requests with an invalid username or password.
+};
+
+// Token bucket of each user, the bucket holds at most burst tokens and gets ratelimit tokens per second,
+// a request takes one token. The buckets are kept when the snapshot is reloaded.
+struct st_bucket
+{
+  double tokens;         // Tokens in the bucket.
+  long lastus;           // Time the tokens were last added (MonoUs()), 0 before the first request of the user.
+};
+struct st_bucket buckets[MAXUSERS];
+pthread_mutex_t bucketmutex = PTHREAD_MUTEX_INITIALIZER; // Mutex of the buckets.
+atomic<long> userthrottled[MAXUSERS];  // Requests of each user answered with 429.
+
+vector<struct st_metrics *> vmetrics;  // Accumulator of each slot of vthid, created when the slot is used for the first time, protected by spin.
+
+// Statistics of a request, filled in by DoRequest() and ExecSQL() and added to the accumulator of the thread.
+struct st_reqstat
+{
+  int userindex;         // Number of the user, -1 if the request has not passed the authentication.
+  int interindex;        // Number of the interface, -1 if the request has not passed the permission check.
+  bool bauthfailed;      // Whether the username or the password is invalid.
+  bool bcached;          // Whether the response was taken from the result cache.
+  bool bshared;          // Whether the response was taken from an identical request in flight.
+  bool berror;           // Whether the request failed.
+  long rows;             // Rows sent.
+  long phaseus[PHASES];  // Time of each phase in microseconds, -1 if the request has not gone through the phase.
+};
+
+// Add the statistics of a request and the bytes sent to the accumulator of the current thread.
+void AddMetrics(struct st_metrics *metrics, const struct st_reqstat &stat, const long bytes);
+
+// Send the metrics in the Prometheus text format to the client, only the programs on this host can get them.
+bool Metrics(const int sockfd, string &sendbuf);
+
+// Microseconds of the monotonic clock, for the time of the phases.
+long MonoUs();
+
+// Formats of the interface data, chosen by the format parameter of the request, XML if it is not specified.
+#define FMT_XML  0
+#define FMT_JSON 1
+#define FMT_CSV  2
+const char *fmtname[] = { "xml", "json", "csv" };
+
+#define FLUSHSIZE 65536   // The output buffer is sent to the client when it has reached this size.
+
+// Content encodings of the response body, chosen from Accept-Encoding of the request. The data of the interfaces
+// is text with many repeated tags and names, it is several times smaller compressed, which matters for the remote clients.
+// zstd is available if the program is built with -DWITH_ZSTD and -lzstd.
+#define ENC_IDENTITY 0
+#define ENC_GZIP     1
+#define ENC_DEFLATE  2
+#define ENC_ZSTD     3
+const char *encname[] = { "identity", "gzip", "deflate", "zstd" };
+
+#define STREAMLEVEL 1     // Compression level of the streamed responses, the fastest.
+#define CACHELEVEL  6     // Compression level of the precompressed copies of the cached results, made once and sent many times.
+
+// Choose the content encoding of the response from Accept-Encoding of the request, ENC_IDENTITY if none is accepted.
+int AcceptEncoding(const char *buffer);
+
+// Streaming compressor of a response body. Each worker thread has one, the compression state is created for the
+// first body in an encoding and reset for the next ones, so a request does not allocate it again.
+class encoder
+{
+private:
+  int m_level;             // Compression level.
+  int m_encoding;          // Encoding of the current body.
+  z_stream m_zs[2];        // zlib streams of gzip and deflate.
+  bool m_zinit[2];         // Whether the zlib streams have been created.
+#ifdef WITH_ZSTD
+  ZSTD_CCtx *m_zcctx;      // zstd context.
+#endif
+public:
+  string m_out;            // Compressed data, WriteBody() sends it and clears it.
+
+  encoder(const int level = STREAMLEVEL);
+  ~encoder();
+
+  // Start a new body in the encoding, return false if the compression state cannot be created.
+  bool start(const int encoding);
+
+  // Encoding of the current body.
+  int encoding() { return m_encoding; }
+
+  // Compress a piece of the body and append the output to m_out, bfinish=true for the last piece.
+  // The output of a piece may be empty, the compressor keeps the data until it has enough.
+  bool compress(const char *data, const size_t len, const bool bfinish);
+};
+
+// Compress a whole body in the encoding at CACHELEVEL, for the precompressed copies of the cached results.
+bool CompressAll(const int encoding, const string &data, string &out);
+
+// Streaming serializer of the result set of an interface. The data is appended to the output buffer of the
+// worker thread without intermediate copies, ExecSQL() sends the buffer when it has reached FLUSHSIZE.
+class serializer
+{
+private:
+  string &m_buf;               // Output buffer.
+  int m_format;                // FMT_XML, FMT_JSON or FMT_CSV.
+  const vector<string> &m_cols; // Column names of the result set.
+  long m_rows;                 // Number of rows appended.
+
+  // Append a value, escaped as the format requires.
+  void value(const char *str);
+public:
+  serializer(string &buf, const int format, const vector<string> &cols);
 
-// Execute the SQL statement of the interface and return data to the client.
-bool ExecSQL(connection *conn, const char *buffer, const int sockfd);
+  void head();                      // Append the return code and the beginning of the data.
+  void row(const char *colvalue);   // Append a row, the values of the columns are 2001 bytes apart in colvalue.
+  void tail(const char *next = 0);  // Append the end of the data, and the after parameter of the next page if it is not 0.
+  void error(const int rc, const char *message);  // Append the return code and the message of an error instead of the data.
+};
+
+// Send the response message header of the interface data in the format to the client.
+bool SendHeader(const int sockfd, const int format);
+
+// Execute the SQL statement of the interface and return data in the format to the client.
+// result returns a copy of the response body for the cache and the identical requests waiting for this one,
+// bresult returns false if the body is larger than MAXFLIGHTSIZE and has not been kept.
+// stat returns the number of rows sent and the time of the query and serialize phases.
+// pool is the pool of conn, it keeps the prepared statements of the connection.
+bool ExecSQL(class connpool *pool, connection *conn, const struct st_intercfg *inter, const struct st_params &params, const int sockfd,
+             const int format, string &sendbuf, string &result, bool &bresult, struct st_reqstat &stat);
+
+// Send a complete response body of the interface data to the client, taken from the cache or from another request.
+// bencoded: the body is compressed in the encoding of the response already.
+bool SendResult(const int sockfd, const int format, const string &data, const bool bencoded);
 
 // Database connection pool class.
+// The free connections are kept in a lock-free stack: the slots are linked by their numbers, and the head of the
+// stack carries a counter that is changed by every push and pop against the ABA problem. A semaphore counts the
+// free connections, so get() waits for one with a timeout instead of failing when all of them are in use.
+// The stack is LIFO, the recently used connections are reused first, the others stay idle and are disconnected.
 class connpool
 {
+public:
+  // Prepared statement of an interface, kept by a connection and reused by the later requests of the interface,
+  // so its SQL is parsed and its variables are bound only once on each connection.
+  struct st_stmt
+  {
+    string selectsql;       // SQL of the interface when the statement was prepared.
+    sqlstatement stmt;      // Prepared statement.
+    vector<char> invalue;   // Buffers bound to the input parameters, 101 bytes each.
+    vector<char> colvalue;  // Buffers bound to the result columns, 2001 bytes each.
+  };
 private:
   struct st_conn
   {
     connection conn; // Database connection.
-    pthread_mutex_t mutex; // Mutex for the database connection.
     time_t atime; // Last time the database connection was used, 0 if not connected to the database.
+    atomic<int> next; // Number of the next slot in the free stack, -1 if it is the last one.
+    unordered_map<string, struct st_stmt *> mstmts; // Prepared statements on the connection, keyed by intername.
   } *m_conns; // Database connection pool.
 
+  atomic<unsigned long> m_head; // Top of the free stack, the slot number+1 in the low 32 bits (0 if empty), the counter in the high 32 bits.
+  sem_t m_sem;                  // Number of the connections in the free stack.
+
+  // Push a slot to the free stack.
+  void push(const int pos);
+  // Pop a slot from the free stack, it must be called after the semaphore has been decremented.
+  int pop();
+  // Number of the slot of a connection.
+  int slot(connection *conn);
+
+  atomic<int> m_connected;      // Number of the connections connected to the database.
+  atomic<int> m_inuse;          // Number of the connections used by the requests.
+  atomic<int> m_waiting;        // Number of the requests waiting for a free connection.
+  atomic<int> m_peak;           // Maximum of m_inuse since the last report.
+  atomic<long> m_gets;          // Number of get() since the last report.
+  atomic<long> m_waits;         // Number of get() that had to wait for a free connection.
+  atomic<long> m_waitus;        // Total time waited, in microseconds.
+  atomic<long> m_maxwaitus;     // Longest time waited.
+  atomic<long> m_timeouts;      // Number of get() that timed out.
+
+  pthread_mutex_t m_statmutex; // Mutex for the counters of prepared statements.
+  long m_prepares;             // Number of statements prepared.
+  long m_reuses;               // Number of statements reused without preparing.
+  long m_lastcalls;            // m_prepares+m_reuses at the last report.
+
+  // Release the prepared statements of a connection, it must be done before the connection is disconnected.
+  void clearstmt(struct st_conn &conn);
+
+  // Connect a slot to the database, or disconnect it.
+  bool connect(const int pos);
+  void disconnect(const int pos);
+
+  int m_minconns; // Number of database connections kept even if they are idle.
   int m_maxconns; // Maximum number of database connections in the pool.
-  int m_timeout; // Database connection timeout time in seconds.
+  int m_timeout; // Idle connections above m_minconns are disconnected after this many seconds.
+  int m_waitms;  // Time in milliseconds get() waits for a free connection.
   char m_connstr[101]; // Database connection parameters: username/password@connection_name
   char m_charset[101]; // Database character set.
 public:
+  char m_name[101];    // Name of the pool in the log, the connection_name of m_connstr.
+
   connpool(); // Constructor.
   ~connpool(); // Destructor.
 
-  // Initialize the database connection pool, initialize locks, and return false if there are issues with the database connection parameters.
-  bool init(const char *connstr, const char *charset, int maxconns, int timeout);
-  // Disconnect the database connection, destroy locks, and release the memory space of the database connection pool.
+  // Initialize the database connection pool, and return false if there are issues with the database connection parameters.
+  // The connections are made by checkpool() and get(), not here.
+  // bcheck: whether to try a connection first, false for a replica, which may be down now and be used when it is up.
+  bool init(const char *connstr, const char *charset, const int minconns, const int maxconns, const int timeout, const int waitms,
+            const bool bcheck = true);
+  // Disconnect the database connections, and release the memory space of the database connection pool.
   void destroy();
 
-  // Get a free connection from the database connection pool, return the address of the database connection if successful.
-  // If the connection pool is full or fails to connect to the database, return NULL.
+  // Get a free connection from the database connection pool, wait up to waitms milliseconds if all are in use,
+  // return the address of the database connection if successful.
+  // If no connection is free in time or fails to connect to the database, return NULL.
   connection *get();
   // Return the database connection.
   bool free(connection *conn);
 
-  // Check the database connection pool and disconnect idle connections. In the service program, this function is called by a dedicated sub-thread.
+  // Check the free connections of the pool: connect up to minconns connections (warm-up), disconnect the idle
+  // connections above minconns and the faulty ones. In the service program, this function is called by a dedicated sub-thread.
   void checkpool();
+
+  // Get the prepared statement of the interface on a connection obtained with get(). The statement is prepared and its
+  // buffers are bound when the interface is called on the connection for the first time, or when its SQL has been changed.
+  // page: PAGE_NONE for selectsql, PAGE_FIRST for firstsql, its last input parameter is limit,
+  // PAGE_NEXT for pagesql, its last two input parameters are after and limit.
+  struct st_stmt *getstmt(connection *conn, const struct st_intercfg *inter, const int page);
+
+  // Write the usage, the waits and the prepare and reuse counters to the log if there have been calls since the last report.
+  void report();
+
+  // Number of the requests using or waiting for a connection of the pool.
+  int outstanding() { return m_inuse + m_waiting; }
+
+  // Number of the connections connected to the database.
+  int connected() { return m_connected; }
 };
 
 connpool oraconnpool; // Declare a database connection pool object.
 
+// Read replicas of the database, for example the sub-databases kept by syncincrement_oracle. The queries of the
+// interfaces go to the replicas, so they do not contend with the ingestion programs writing to the primary (connstr),
+// which keeps the parameter tables and serves the queries only when no replica is available.
+// Each query takes the available replica with the fewest requests in progress. Every 30 seconds CheckReplicas()
+// runs lagsql on the primary and on each replica, a replica that lags more than maxlag or cannot be connected is
+// not used until it has caught up.
+struct st_replica
+{
+  connpool pool;              // Connection pool of the replica.
+  atomic<bool> bavailable;    // Whether the replica is used.
+  bool bchecked;              // Whether the replica has been checked, the result of the first check is always logged.
+  double lag;                 // Lag measured at the last check, primary value minus replica value.
+};
+
+vector<struct st_replica *> vreplicas;  // Read replicas, created at startup.
+
+// Get a connection for the query of an interface from the available replica with the fewest requests in progress,
+// or from the primary if there is none. pool returns the pool of the connection, it must be returned there.
+connection *GetReadConn(connpool *&pool);
+
+// Measure the lag of the replicas and take them out of use or put them back. Called by the pool checking thread.
+void CheckReplicas();
+
+// Run lagsql on a connection, return false if failed.
+bool QueryLag(connection *conn, double &value);
+
+// Result cache of the interfaces, keyed by the interface name and the values of its parameters.
+// Many users call the same interface with the same parameters within a short time, the result of the first call
+// is kept for the cachesecs seconds configured in T_INTERCFG, the others are answered without the database.
+// When the total size exceeds the limit, the least recently used results are evicted.
+class rescache
+{
+private:
+  struct st_item
+  {
+    string key;       // Interface name and the values of its parameters.
+    string data;      // Response body of the interface.
+    time_t expire;    // Time when the result expires.
+  };
+  list<struct st_item> m_lru;                                     // Cached results, the most recently used first.
+  unordered_map<string, list<struct st_item>::iterator> m_index;  // Index of the cached results by key.
+
+  size_t m_bytes;          // Total size of the cached results.
+  size_t m_maxbytes;       // Maximum total size of the cached results.
+  pthread_mutex_t m_mutex; // Mutex of the cache.
+
+  long m_hits;             // Number of results taken from the cache.
+  long m_misses;           // Number of results not in the cache or expired.
+  long m_evicts;           // Number of results evicted for space.
+  long m_lastcalls;        // m_hits+m_misses at the last report.
+public:
+  rescache();
+  ~rescache();
+
+  // Set the maximum total size of the cached results in bytes.
+  void init(const size_t maxbytes);
+
+  // Maximum size of one result, a larger result is not cached.
+  size_t maxitem() { return m_maxbytes / 8; }
+
+  // Get the result of key, return false if it is not cached or has expired.
+  // expire returns the time when the result expires if it is not 0.
+  bool get(const string &key, string &data, time_t *expire = 0);
+
+  // Cache the result of key for ttl seconds.
+  void put(const string &key, const string &data, const int ttl);
+
+  // Remove the cached results of an interface, all results if intername is empty, return the number removed.
+  int invalidate(const char *intername);
+
+  // Write the hit and miss counters to the log if there have been calls since the last report.
+  void report();
+};
+
+rescache resultcache; // Result cache of the interfaces.
+
+// Record of a call in T_USERLOG.
+struct st_userlog
+{
+  char username[31];    // Username.
+  char intername[31];   // Interface name.
+  char ip[16];          // Address of the client.
+  time_t atime;         // Time of the call.
+  char upttime[15];     // Time of the call in yyyymmddhh24miss, formatted by the writer thread.
+  long rows;            // Rows sent.
+  long bytes;           // Bytes of the response body sent.
+  long elapsed;         // Time of the call in milliseconds.
+};
+
+// The calls are written to T_USERLOG by a background thread on its own database connection, so a request
+// neither waits for an insert nor holds a connection of the pool for it. The worker threads put the records
+// into a bounded lock-free queue, the writer inserts them in batches of many rows with one statement.
+// When the queue is full, the record is dropped and counted instead of blocking the request.
+#define USERLOGBATCH 64   // Maximum number of rows inserted with one statement, a power of 2.
+
+// Bounded queue of the records, many producers and one consumer. Each cell has a sequence number that tells
+// whether it is free for the producer of a position or filled for the consumer, a producer takes a position
+// with compare-and-swap and publishes the cell by storing its sequence number.
+class userlogqueue
+{
+private:
+  struct st_cell
+  {
+    atomic<size_t> seq;          // Sequence number of the cell.
+    struct st_userlog data;      // Record.
+  } *m_cells;
+  size_t m_mask;                 // Number of cells-1, the number of cells is a power of 2.
+  atomic<size_t> m_enqpos;       // Next position of the producers.
+  char m_pad[64];                // The consumer position is on another cache line than the producer position.
+  size_t m_deqpos;               // Next position of the consumer.
+public:
+  atomic<long> m_queued;         // Number of records put into the queue.
+  atomic<long> m_dropped;        // Number of records dropped because the queue was full.
+  atomic<long> m_written;        // Number of records written to T_USERLOG.
+  atomic<long> m_failed;         // Number of records lost because the insert failed.
+  long m_lastqueued;             // m_queued at the last report.
+
+  userlogqueue();
+  ~userlogqueue();
+
+  // Create the queue with at least size cells.
+  void init(const size_t size);
+
+  // Put a record into the queue, return false if the queue is full.
+  bool push(const struct st_userlog &record);
+
+  // Take a record from the queue, return false if it is empty. Only the writer thread calls it.
+  bool pop(struct st_userlog &record);
+
+  // Write the counters to the log if there have been calls since the last report.
+  void report();
+};
+
+userlogqueue userlogq; // Queue of the records of T_USERLOG.
+
+// Identical requests in flight share one query (single-flight). The first request of a key is the leader, it runs
+// the query and streams the result to its client as usual, and keeps a copy of the response body. The identical
+// requests that arrive meanwhile wait for the leader instead of taking a database connection each, then send
+// the copy to their clients. If the leader fails or its result is too large to keep, they run the query themselves.
+#define MAXFLIGHTSIZE (16 * 1024 * 1024)  // Largest response body kept for the waiting requests.
+#define FLIGHTTIMEOUT 20                  // A request waits for its leader at most this many seconds, less than
+                                          // the 25 seconds after which the monitor reports a busy thread.
+
+struct st_flight
+{
+  bool bdone;       // Whether the leader has finished.
+  bool bok;         // Whether data is the complete response body.
+  string data;      // Response body of the leader, it does not change after bdone.
+  long rows;        // Rows of the result.
+};
+
+class singleflight
+{
+private:
+  unordered_map<string, shared_ptr<struct st_flight> > m_flights;  // Queries in flight, keyed by the request.
+  pthread_mutex_t m_mutex;    // Mutex of m_flights and the flights.
+  pthread_cond_t m_cond;      // Broadcast when a leader has finished.
+  long m_leaders;             // Number of queries run since the last report.
+  long m_joins;               // Number of requests that shared the query of a leader since the last report.
+public:
+  singleflight();
+  ~singleflight();
+
+  // Join the query of key in flight, or start a new one. bleader returns true if the caller is the leader,
+  // it runs the query and must call done() whatever happens, class flightleader below makes sure of it.
+  shared_ptr<struct st_flight> join(const string &key, bool &bleader);
+
+  // Wait for the leader of the flight, return true if its response body can be sent,
+  // false if the caller has to run the query itself.
+  bool wait(const string &key, const shared_ptr<struct st_flight> &flight);
+
+  // The leader has finished, bok: whether data is the complete response body, data is moved into the flight.
+  void done(const string &key, const shared_ptr<struct st_flight> &flight, const bool bok, string &data, const long rows);
+
+  // Write the counters to the log if there have been queries since the last report.
+  void report();
+};
+
+singleflight flights; // Queries in flight.
+
+// The leader of a flight in DoRequest(). If the leader leaves without calling done(), also when its thread is
+// cancelled and its stack is unwound, the flight is finished with bok false, so the waiting requests run
+// the query themselves instead of waiting for a dead leader.
+class flightleader
+{
+private:
+  const string &m_key;
+  shared_ptr<struct st_flight> m_flight;   // 0 if the request is not the leader, or after done().
+public:
+  flightleader(const string &key, const shared_ptr<struct st_flight> &flight, const bool bleader) : m_key(key)
+  {
+    if (bleader == true) m_flight = flight;
+  }
+
+  // The leader has finished, see singleflight::done(). It does nothing if the request is not the leader.
+  void done(const bool bok, string &data, const long rows)
+  {
+    if (m_flight == 0) return;
+    flights.done(m_key, m_flight, bok, data, rows);
+    m_flight.reset();
+  }
+
+  ~flightleader()
+  {
+    string data;
+    done(false, data, 0);
+  }
+};
+
+// Push of the new rows of T_ZHOBTMIND to the clients, GET /subscribe?username=xx&passwd=xx&obtid=51076,51133 returns
+// a stream of server-sent events (text/event-stream), one event for each new row of the stations, its id is the keyid
+// of the row and its data is the row in JSON. Without obtid the rows of all the stations are sent.
+// The clients no longer poll getzhobtmind1 for the new rows: one thread polls T_ZHOBTMIND by keyid every streamsecs
+// seconds for all of them and sends each row to the clients subscribed to its station. The sockets of the subscribers
+// are owned by that thread and written without blocking, they take no worker thread. A client reconnecting with
+// Last-Event-ID gets the rows it has missed if they are still among the recent rows kept by the thread.
+#define STREAMINTER   "getzhobtmind1"   // A user needs the permission of this interface to subscribe.
+#define STREAMCOLS    "obtid,ddatetime,t,p,u,wd,wf,r,vis,keyid"
+#define STREAMSQL     "select obtid, to_char(ddatetime, 'yyyymmddhh24miss'), t, p, u, wd, wf, r, vis, keyid "\
+                      "from T_ZHOBTMIND where keyid>:1 order by keyid"
+#define STREAMBACKLOG 10000             // Number of the recent rows kept for the reconnecting clients.
+#define STREAMPENDING (1024 * 1024)     // A client with more unsent bytes than this is too slow, it is disconnected.
+#define STREAMPING    15                // A comment is sent to a client without rows for this many seconds,
+                                        // so the proxies keep the connection and a closed one is detected.
+#define STREAMKEEP    60                // The position and the recent rows are kept this many seconds after the last
+                                        // subscriber has gone, so the clients reconnecting after retry miss no row.
+
+struct st_streamrow
+{
+  long keyid;       // keyid of the row.
+  string obtid;     // Station of the row.
+  string event;     // The event of the row, "id: keyid\ndata: {...}\n\n".
+};
+
+struct st_subscriber
+{
+  int sockfd;                     // Socket of the client.
+  unordered_set<string> obtids;   // Stations subscribed, empty means all the stations.
+  long lastid;                    // Last-Event-ID of the request, the rows after it are sent first.
+  string pending;                 // Data not sent yet.
+  time_t atime;                   // Time data was last sent.
+};
+
+class streamer
+{
+private:
+  pthread_mutex_t m_mutex;                  // Mutex of m_subs and m_backlog.
+  vector<struct st_subscriber *> m_subs;    // Subscribers.
+  deque<struct st_streamrow> m_backlog;     // The recent rows, at most STREAMBACKLOG.
+  vector<string> m_cols;                    // Column names of the rows.
+  long m_lastid;                            // keyid of the last row polled, 0 if the table is empty.
+  bool m_binit;                             // Whether m_lastid has been taken from the table.
+  time_t m_idletime;                        // Time the last subscriber has gone, 0 while there are subscribers.
+  long m_lastrows;                          // m_rows at the last report.
+
+  // Send the data of the subscriber without blocking, return false if the client has closed the connection or failed.
+  bool flush(struct st_subscriber *sub);
+
+  // Close the connection of a subscriber and free it, the caller holds m_mutex.
+  void drop(const int pos, const char *reason);
+public:
+  atomic<int> m_count;        // Number of the subscribers.
+  atomic<long> m_rows;        // Number of the rows polled.
+  atomic<long> m_events;      // Number of the events sent to the subscribers.
+  atomic<long> m_dropped;     // Number of the subscribers disconnected because they were too slow or failed.
+
+  streamer();
+  ~streamer();
+
+  // Take over the socket of a new subscriber, the recent rows after its lastid are sent first.
+  void add(struct st_subscriber *sub);
+
+  // Query the rows added since the last poll and send them to the subscribers. Called by the streaming thread.
+  void poll();
+
+  // Write the counters to the log if there are subscribers.
+  void report();
+};
+
+streamer streams; // Subscribers of the new rows.
+
+pthread_t streamid;
+void *streammain(void *arg); // Thread function to poll the new rows for the subscribers.
+
+struct st_subscriber *clientsub[MAXSOCK];  // Subscription made by the current request of each client socket,
+                                           // the streamer takes over the socket after the request.
+
+// Check the subscription request, send the response header and make the subscription in clientsub.
+// Return whether the connection can be kept for the next request, false after a subscription.
+bool Subscribe(const int sockfd, const char *buffer, const struct st_params &params);
+
+pthread_t userlogid;
+void *userlogmain(void *arg); // Thread function to write the records to T_USERLOG.
+
+// Put the record of a successful call into the queue of T_USERLOG.
+void WriteUserLog(const int sockfd, const struct st_usercfg *user, const struct st_intercfg *inter, const long rows, const double elapsed);
+
 int main(int argc, char *argv[])
 {
   if (argc != 3)
@@ -126,40 +858,85 @@ int main(int argc, char *argv[])
     return -1;
 
   // Server initialization.
-  if (TcpServer.InitServer(starg.port) == false)
+  if (TcpServer.InitServer(starg.port, SOMAXCONN) == false)
   {
     logfile.Write("TcpServer.InitServer(%d) failed.\n", starg.port);
     return -1;
   }
 
+  // Accept until EAGAIN for each event, the listening socket must be non-blocking.
+  fcntl(TcpServer.m_listenfd, F_SETFL, fcntl(TcpServer.m_listenfd, F_GETFL, 0) | O_NONBLOCK);
+
+  resultcache.init((size_t)starg.cachesize * 1024 * 1024);
+
   // Initialize the database connection pool.
-  if (oraconnpool.init(starg.connstr, starg.charset, 10, 50) == false)
+  if (oraconnpool.init(starg.connstr, starg.charset, starg.minconns, starg.maxconns, starg.conntimeout, starg.waittimeout) == false)
   {
     logfile.Write("oraconnpool.init() failed.\n");
     return -1;
   }
-  else
+
+  // The pools of the read replicas, each has as many connections as the primary. They are used after their first check.
+  CCmdStr CmdStr;
+  CmdStr.SplitToCmd(starg.replicas, ",", true);
+  for (int ii = 0; ii < CmdStr.CmdCount(); ii++)
   {
-    // Create a thread to check the database connection pool.
-    if (pthread_create(&checkpoolid, NULL, checkpool, 0) != 0)
-    {
-      logfile.Write("pthread_create() failed.\n");
-      return -1;
-    }
+    if (CmdStr.m_vCmdStr[ii].empty() == true) continue;
+
+    struct st_replica *replica = new struct st_replica;
+    replica->bavailable = false;
+    replica->bchecked = false;
+    replica->lag = 0;
+    replica->pool.init(CmdStr.m_vCmdStr[ii].c_str(), starg.charset, starg.minconns, starg.maxconns, starg.conntimeout, starg.waittimeout, false);
+    vreplicas.push_back(replica);
+  }
+
+  // Create a thread to check the database connection pool.
+  if (pthread_create(&checkpoolid, NULL, checkpool, 0) != 0)
+  {
+    logfile.Write("pthread_create() failed.\n");
+    return -1;
+  }
+
+  // Load the parameter tables, the requests cannot be served without them.
+  if (LoadParamCfg() == false) return -1;
+
+  // Create the thread to reload the parameter tables.
+  if (pthread_create(&refreshid, NULL, refreshmain, 0) != 0)
+  {
+    logfile.Write("pthread_create() failed.\n");
+    return -1;
   }
 
-  // Start 10 worker threads, the number of threads is slightly more than the number of CPU cores.
-  for (int ii = 0; ii < 10; ii++)
+  // Create the thread to write the calls to T_USERLOG.
+  if (starg.userlog == 1)
   {
-    struct st_pthinfo stpthinfo;
-    if (pthread_create(&stpthinfo.pthid, NULL, thmain, (void *)(long)ii) != 0)
+    userlogq.init(starg.userlogqueue);
+    if (pthread_create(&userlogid, NULL, userlogmain, 0) != 0)
     {
       logfile.Write("pthread_create() failed.\n");
       return -1;
     }
+  }
+
+  // Create the thread to poll the new rows for the subscribers, it queries the database only when there are subscribers.
+  if (pthread_create(&streamid, NULL, streammain, 0) != 0)
+  {
+    logfile.Write("pthread_create() failed.\n");
+    return -1;
+  }
+
+  pthread_spin_init(&spin, 0); // Initialize the spin lock for vthid.
 
-    stpthinfo.atime = time(0); // Set the activity time of the thread to the current time.
-    vthid.push_back(stpthinfo); // Save the thread structure to the vthid container.
+  // Start minthreads worker threads, the others are started when the requests are waiting.
+  struct st_pthinfo stpthinfo;
+  memset(&stpthinfo, 0, sizeof(stpthinfo));
+  vthid.resize(starg.maxthreads, stpthinfo);
+  vmetrics.resize(starg.maxthreads, 0);
+
+  for (int ii = 0; ii < starg.minthreads; ii++)
+  {
+    if (StartThread() == false) return -1;
   }
 
   // Create the monitoring thread.
@@ -169,24 +946,156 @@ int main(int argc, char *argv[])
     return -1;
   }
 
-  pthread_spin_init(&spin, 0); // Initialize the spin lock for vthid.
+  // Create the epoll handle and add the listening socket to it.
+  epollfd = epoll_create(1);
+
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = TcpServer.m_listenfd;
+  epoll_ctl(epollfd, EPOLL_CTL_ADD, TcpServer.m_listenfd, &ev);
+
+  // Create the timer to close the idle connections.
+  tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+  struct itimerspec timeout;
+  memset(&timeout, 0, sizeof(struct itimerspec));
+  timeout.it_value.tv_sec = 20;   // Set the timeout to 20 seconds.
+  timeout.it_value.tv_nsec = 0;
+  timerfd_settime(tfd, 0, &timeout, NULL);
+
+  ev.events = EPOLLIN | EPOLLET;  // Read event, note that it must be in ET mode.
+  ev.data.fd = tfd;
+  epoll_ctl(epollfd, EPOLL_CTL_ADD, tfd, &ev);
+
+  struct epoll_event evs[64];     // Store the events returned by epoll.
 
   while (true)
   {
-    // Wait for client connection requests.
-    if (TcpServer.Accept() == false)
+    // Wait for events on the monitored sockets.
+    int infds = epoll_wait(epollfd, evs, 64, -1);
+
+    if (infds < 0)
     {
-      logfile.Write("TcpServer.Accept() failed.\n");
-      return -1;
+      if (errno == EINTR) continue;
+      logfile.Write("epoll() failed.\n");
+      EXIT(-1);
     }
 
-    logfile.Write("Client (%s) connected.\n", TcpServer.GetIP());
+    for (int ii = 0; ii < infds; ii++)
+    {
+      // If the timer has expired, close the connections that have been idle too long.
+      if (evs[ii].data.fd == tfd)
+      {
+        timerfd_settime(tfd, 0, &timeout, NULL);  // Reset the timer.
+
+        for (int jj = 0; jj < MAXSOCK; jj++)
+        {
+          if ((clientatime[jj] > 0) && (clientbusy[jj] == false) && ((time(0) - clientatime[jj]) > IDLETIMEOUT))
+          {
+            logfile.Write("Client(%d) timeout.\n", jj);
+            CloseClient(jj);
+          }
+        }
+
+        resultcache.report();
+        flights.report();
+        userlogq.report();
+        streams.report();
+        oraconnpool.report();
+        for (int jj = 0; jj < vreplicas.size(); jj++) vreplicas[jj]->pool.report();
+        ReportThreads();
+
+        continue;
+      }
+
+      // If the event is on the listening socket, accept all the clients that are waiting.
+      if (evs[ii].data.fd == TcpServer.m_listenfd)
+      {
+        while (true)
+        {
+          struct sockaddr_in client;
+          socklen_t len = sizeof(client);
+          int connfd = accept(TcpServer.m_listenfd, (struct sockaddr *)&client, &len);
+          if (connfd < 0) break;
+
+          if (connfd >= MAXSOCK)
+          {
+            logfile.Write("The number of connections has exceeded the maximum value %d.\n", MAXSOCK);
+            close(connfd); continue;
+          }
+
+          logfile.Write("Client (%s) connected.\n", inet_ntoa(client.sin_addr));
+          inet_ntop(AF_INET, &client.sin_addr, clientip[connfd], sizeof(clientip[connfd]));
+
+          // The responses are written in large pieces and the last segment of a response is pushed by
+          // uncorking, so Nagle's algorithm would only delay the small responses.
+          int opt = 1;
+          setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+          // A client that stops reading its response would hold the worker thread, send() fails after SENDTIMEOUT.
+          struct timeval sndtimeo;
+          sndtimeo.tv_sec = SENDTIMEOUT; sndtimeo.tv_usec = 0;
+          setsockopt(connfd, SOL_SOCKET, SO_SNDTIMEO, &sndtimeo, sizeof(sndtimeo));
+
+          // The client socket stays blocking for the worker threads, epoll reads it with MSG_DONTWAIT.
+          // EPOLLONESHOT: the socket reports one event, then epoll leaves it alone until it is re-armed.
+          clientrbuf[connfd].clear();
+          clientatime[connfd] = time(0);
+          clientbusy[connfd] = false;
+          ev.events = EPOLLIN | EPOLLONESHOT;
+          ev.data.fd = connfd;
+          epoll_ctl(epollfd, EPOLL_CTL_ADD, connfd, &ev);
+        }
+
+        continue;
+      }
+
+      // Data from a client, read it, and if a complete request has arrived, hand it to the worker threads.
+      int connfd = evs[ii].data.fd;
+
+      if (RecvRequest(connfd) == false)
+      {
+        CloseClient(connfd); continue;
+      }
+
+      // The requests of a user over its rate are answered with 429 here, they take no worker thread.
+      int flow = -1, weight = 1;
+      bool bclose = false;
+      while ((clientrbuf[connfd].find("\r\n\r\n") != string::npos) && (Admit(connfd, flow, weight) == false))
+      {
+        if (Throttle(connfd) == false) { bclose = true; break; }
+      }
+      if (bclose == true)
+      {
+        CloseClient(connfd); continue;
+      }
+
+      if (clientrbuf[connfd].find("\r\n\r\n") == string::npos)
+      {
+        ev.events = EPOLLIN | EPOLLONESHOT;   // The request is not complete yet, wait for the rest.
+        ev.data.fd = connfd;
+        epoll_ctl(epollfd, EPOLL_CTL_MOD, connfd, &ev);
+        continue;
+      }
+
+      clientbusy[connfd] = true;
+
+      pthread_mutex_lock(&mutex); // Lock.
 
-    // Add the client socket to the queue and signal the condition.
-    pthread_mutex_lock(&mutex); // Lock.
-    sockqueue.push_back(TcpServer.m_connfd); // Enqueue.
-    pthread_mutex_unlock(&mutex); // Unlock.
-    pthread_cond_signal(&cond); // Trigger the condition and activate a thread.
+      // Too many requests are waiting, the client would wait too long, tell it to come back later.
+      if (sockqueue.size() >= starg.maxqueue)
+      {
+        pthread_mutex_unlock(&mutex);
+        ShedClient(connfd); continue;
+      }
+
+      sockqueue.push(connfd, flow, weight); // Enqueue, in the queue of the user.
+      bool bgrow = (sockqueue.size() > nidle);   // The idle threads are not enough for the waiting requests.
+      pthread_mutex_unlock(&mutex); // Unlock.
+      pthread_cond_signal(&cond); // Trigger the condition and activate a thread.
+
+      if (bgrow == true) StartThread();
+    }
   }
 }
 
@@ -197,106 +1106,589 @@ void *thmain(void *arg)
 
   pthread_cleanup_push(thcleanup, arg); // Thread cleanup function.
 
-  pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL); // Thread cancellation type is immediate cancellation.
+  // The thread is cancelled only in pthread_cond_timedwait() below, holding the mutex that thcleanup() unlocks.
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+  pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
 
   pthread_detach(pthread_self()); // Detach the thread.
 
   int connfd; // Client socket.
-  char strrecvbuf[1024]; // Buffer to receive client request message.
-  char strsendbuf[1024]; // Buffer to send response message to the client.
+  string strrecvbuf; // Request message of the client.
+  string strsendbuf; // Output buffer of the responses, its memory is kept for the next requests.
+  strsendbuf.reserve(FLUSHSIZE * 2);
+
+  // Accumulator of the metrics of this slot, it has been created by StartThread() before this thread.
+  struct st_metrics *metrics = vmetrics[pthnum];
+  struct st_reqstat stat;
+
+  encoder enc;   // Compressor of the responses.
 
   while (true)
   {
     pthread_mutex_lock(&mutex); // Lock the cache queue.
 
     // If the cache queue is empty, wait. Use while to prevent condition variable spurious wakeup.
+    time_t idlesince = time(0);
     while (sockqueue.size() == 0)
     {
-      struct timeval now;
-      gettimeofday(&now, NULL); // Get the current time.
-      now.tv_sec = now.tv_sec + 20; // Get the time 20 seconds later.
-      pthread_cond_timedwait(&cond, &mutex, (struct timespec *)&now); // Wait for the condition to be triggered.
+      struct timespec abstime;
+      clock_gettime(CLOCK_REALTIME, &abstime); // Get the current time.
+      abstime.tv_sec = abstime.tv_sec + 20; // Get the time 20 seconds later.
+      nidle++;
+      pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+      pthread_cond_timedwait(&cond, &mutex, &abstime); // Wait for the condition to be triggered.
+      pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+      nidle--;
       vthid[pthnum].atime = time(0); // Update the activity time of the current thread.
+
+      // The thread has been idle too long, it exits if there are more than minthreads threads.
+      if ((sockqueue.size() == 0) && ((time(0) - idlesince) >= starg.threadidle))
+      {
+        bool bexit = false;
+        pthread_spin_lock(&spin);
+        if (nthreads > starg.minthreads)
+        {
+          vthid[pthnum].brun = false; nthreads--; bexit = true;
+        }
+        pthread_spin_unlock(&spin);
+
+        if (bexit == true) pthread_exit(0);   // thcleanup() unlocks the mutex.
+
+        idlesince = time(0);
+      }
     }
 
-    // Get the first record from the cache queue and then delete it.
-    connfd = sockqueue[0];
-    sockqueue.erase(sockqueue.begin());
+    // Take the request that is due first among the users.
+    connfd = sockqueue.pop();
 
     pthread_mutex_unlock(&mutex); // Unlock the cache queue.
 
+    vthid[pthnum].atime = time(0); // Update the activity time of the current thread.
+    vthid[pthnum].bbusy = true;
+    CTimer timer;
+
     // The following code is to process the business logic.
     logfile.Write("Thread ID=%lu(Number=%d), connfd=%d\n", pthread_self(), pthnum, connfd);
 
-    // Read client message, close the client socket and continue to the loop if timeout or failed.
-    memset(strrecvbuf, 0, sizeof(strrecvbuf));
-    if (ReadT(connfd, strrecvbuf, sizeof(strrecvbuf), 3) <= 0)
+    // Process one request of the client. A request the client has pipelined behind it takes a token of its user
+    // and waits in the fair queue again, like a request read by the main thread.
+    bool bkeep = false;
+    if (GetRequest(connfd, strrecvbuf) == true)
     {
-      close(connfd);
-      continue;
+      bkeep = DoRequest(connfd, strrecvbuf.c_str(), strsendbuf, enc, stat);
+      AddMetrics(metrics, stat, clientsent[connfd]);
     }
 
-    // If it's not a GET request message, don't process it, close the client socket, and continue to the loop.
-    if (strncmp(strrecvbuf, "GET", 3) != 0)
+    busyus += (long)(timer.Elapsed() * 1000000);
+
+    vthid[pthnum].atime = time(0);
+    vthid[pthnum].bbusy = false;
+
+    // The socket of a subscriber is taken over by the streamer, it is neither closed nor handed back to epoll.
+    if (clientsub[connfd] != 0)
     {
-      close(connfd);
+      streams.add(clientsub[connfd]);
+      clientsub[connfd] = 0;
       continue;
     }
 
-    logfile.Write("%s\n", strrecvbuf);
-
-    connection *conn = oraconnpool.get(); // Get a database connection.
-
-    // If the database connection is empty, return internal error to the client, close the client socket, and continue to the loop.
-    if (conn == 0)
+    // The pipelined requests of a user over its rate are answered with 429.
+    int flow = -1, weight = 1;
+    while ((bkeep == true) && (clientrbuf[connfd].find("\r\n\r\n") != string::npos) && (Admit(connfd, flow, weight) == false))
     {
-      memset(strsendbuf, 0, sizeof(strsendbuf));
-      sprintf(strsendbuf, \
-              "HTTP/1.1 200 OK\r\n"\
-              "Server: webserver\r\n"\
-              "Content-Type: text/html;charset=utf-8\r\n\r\n"\
-              "<retcode>-1</retcode><message>Internal error.</message>");
-      Writen(connfd, strsendbuf, strlen(strsendbuf));
-      close(connfd);
-      continue;
+      bkeep = Throttle(connfd);
     }
 
-    // Check username and password in the URL, if incorrect, return authentication failed response message to the client, close the client socket, and continue to the loop.
-    if (Login(conn, strrecvbuf, connfd) == false)
+    if (bkeep == false)
     {
-      oraconnpool.free(conn);
-      close(connfd);
-      continue;
+      CloseClient(connfd); continue;
     }
 
-    // Check if the user has permission to call the interface, if not, return no permission response message to the client, close the client socket, and continue to the loop.
-    if (CheckPerm(conn, strrecvbuf, connfd) == false)
+    // The next pipelined request is put into the queue of its user.
+    if (clientrbuf[connfd].find("\r\n\r\n") != string::npos)
     {
-      oraconnpool.free(conn);
-      close(connfd);
+      pthread_mutex_lock(&mutex);
+      sockqueue.push(connfd, flow, weight);
+      pthread_mutex_unlock(&mutex);
+      pthread_cond_signal(&cond);
       continue;
     }
 
-    // First send the response message header to the client.
-    memset(strsendbuf, 0, sizeof(strsendbuf));
-    sprintf(strsendbuf, \
-            "HTTP/1.1 200 OK\r\n"\
-            "Server: webserver\r\n"\
-            "Content-Type: text/html;charset=utf-8\r\n\r\n");
-    Writen(connfd, strsendbuf, strlen(strsendbuf));
+    // Hand the keep-alive connection back to epoll, it costs no thread while it waits for the next request.
+    clientatime[connfd] = time(0);
+    clientbusy[connfd] = false;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.fd = connfd;
+    epoll_ctl(epollfd, EPOLL_CTL_MOD, connfd, &ev);
+  }
+
+  pthread_cleanup_pop(1); // Pop the thread cleanup function.
+}
+
+// Process one request of the client, return true if the connection can be kept for the next request.
+bool DoRequest(const int sockfd, const char *buffer, string &sendbuf, class encoder &enc, struct st_reqstat &stat)
+{
+  CTimer timer;   // Elapsed time of the request.
+  clientsent[sockfd] = 0;
+  clientenc[sockfd] = 0;
+
+  long starttime = MonoUs();
+  memset(&stat, 0, sizeof(stat));
+  stat.userindex = stat.interindex = -1;
+  for (int ii = 0; ii < PHASES; ii++) stat.phaseus[ii] = -1;
+
+  // If it's not a GET request message, don't process it, and close the client socket.
+  if (strncmp(buffer, "GET", 3) != 0) return false;
+
+  logfile.Write("%s\n", buffer);
+
+  // The parameters of the request line, the lookups below do not scan the request again.
+  struct st_params params;
+  ParseParams(buffer, params);
+
+  if (strncmp(buffer, "GET /cache/invalidate?", 22) == 0) return Invalidate(sockfd, params);
+
+  if ((strncmp(buffer, "GET /metrics ", 13) == 0) || (strncmp(buffer, "GET /metrics?", 13) == 0)) return Metrics(sockfd, sendbuf);
+
+  if (strncmp(buffer, "GET /subscribe?", 15) == 0) return Subscribe(sockfd, buffer, params);
+
+  // The snapshot of the parameter tables is kept by this request until it has finished, even if it is reloaded meanwhile.
+  shared_ptr<const struct st_paramcfg> cfg = atomic_load(&paramcfg);
+
+  // Check username and password in the URL, if incorrect, return authentication failed response message to the client.
+  const struct st_usercfg *user = Login(cfg.get(), params, sockfd);
+  if (user == 0) { stat.bauthfailed = true; return clientkeepalive[sockfd]; }
+  stat.userindex = user->index;
+
+  // Check if the user has permission to call the interface, if not, return no permission response message to the client.
+  const struct st_intercfg *inter = CheckPerm(cfg.get(), params, sockfd);
+  if (inter == 0) return clientkeepalive[sockfd];
+  stat.interindex = inter->index;
+  stat.phaseus[PH_AUTH] = MonoUs() - starttime;
 
-    // Execute the interface's SQL statement and return the data to the client.
-    if (ExecSQL(conn, strrecvbuf, connfd) == false)
+  // Format of the data, xml, json or csv.
+  char strformat[11];
+  int format = FMT_XML;
+  getvalue(params, "format", strformat, 10);
+  if (strcmp(strformat, "json") == 0) format = FMT_JSON;
+  else if (strcmp(strformat, "csv") == 0) format = FMT_CSV;
+  else if ((strlen(strformat) > 0) && (strcmp(strformat, "xml") != 0))
+  {
+    SendResponse(sockfd, "<retcode>-1</retcode><message>Format is invalid, it should be xml, json or csv.</message>");
+    return clientkeepalive[sockfd];
+  }
+
+  // The key of the request is the interface and the values of its parameters, it is the key of the cache
+  // and of the queries in flight.
+  char invalue[101];
+  string reqkey = inter->intername;
+  for (int ii = 0; ii < inter->vbindin.size(); ii++)
+  {
+    getvalue(params, inter->vbindin[ii].c_str(), invalue, 100);
+    reqkey.append(1, '\1'); reqkey.append(invalue);
+  }
+  reqkey.append(1, '\1'); reqkey.append(1, '0' + format);  // Each format is kept separately.
+
+  // Each page is kept separately.
+  if (inter->pagekey.empty() == false)
+  {
+    getvalue(params, "limit", invalue, 10);
+    reqkey.append(1, '\1'); reqkey.append(invalue);
+    getvalue(params, "after", invalue, 100);
+    reqkey.append(1, '\1'); reqkey.append(invalue);
+  }
+
+  // The response body is compressed if the client accepts it.
+  int encoding = AcceptEncoding(buffer);
+  if ((encoding != ENC_IDENTITY) && (enc.start(encoding) == false)) encoding = ENC_IDENTITY;
+  if (encoding != ENC_IDENTITY) clientenc[sockfd] = &enc;
+
+  // If the result of the interface with these parameter values is cached, send it without the database.
+  // A compressed response is sent from the precompressed copy of the result, which is made at its first compressed hit
+  // and cached with the result, so a cached result is compressed only once.
+  string cachedata;
+  bool bhit = false, bencoded = false;
+  if (inter->cachesecs > 0)
+  {
+    string enckey = reqkey + '\1' + encname[encoding];
+    time_t expire = 0;
+    string encdata;
+
+    if ((encoding != ENC_IDENTITY) && (resultcache.get(enckey, cachedata) == true))
     {
-      oraconnpool.free(conn);
-      close(connfd);
-      continue;
+      bhit = bencoded = true;
+    }
+    else if (resultcache.get(reqkey, cachedata, &expire) == true)
+    {
+      bhit = true;
+      if ((encoding != ENC_IDENTITY) && (CompressAll(encoding, cachedata, encdata) == true))
+      {
+        if (expire > time(0)) resultcache.put(enckey, encdata, expire - time(0));   // It expires with the result.
+        cachedata.swap(encdata);
+        bencoded = true;
+      }
     }
+  }
 
-    oraconnpool.free(conn);
+  if (bhit == true)
+  {
+    stat.bcached = true;
+    stat.berror = true;   // Until the response has been sent.
+    if (SendResult(sockfd, format, cachedata, bencoded) == false) return false;
+    stat.berror = false;
+    stat.phaseus[PH_TOTAL] = MonoUs() - starttime;
+    logfile.Write("intername=%s,format=%s,rows=cached,bytes=%ld,elapsed=%.6f\n",
+                  inter->intername.c_str(), fmtname[format], clientsent[sockfd], timer.Elapsed());
+    if (starg.userlog == 1) WriteUserLog(sockfd, user, inter, 0, timer.Elapsed());
+    return clientkeepalive[sockfd];
   }
 
-  pthread_cleanup_pop(1); // Pop the thread cleanup function.
+  stat.berror = true;   // Until the response has been sent.
+
+  // If an identical request is running the query, wait for it and send its result.
+  bool bleader = false;
+  shared_ptr<struct st_flight> flight = flights.join(reqkey, bleader);
+  if ((bleader == false) && (flights.wait(reqkey, flight) == true))
+  {
+    stat.bshared = true;
+    stat.rows = flight->rows;
+    if (SendResult(sockfd, format, flight->data, false) == false) return false;
+    stat.berror = false;
+    stat.phaseus[PH_TOTAL] = MonoUs() - starttime;
+    logfile.Write("intername=%s,format=%s,rows=%ld(shared),bytes=%ld,elapsed=%.6f\n",
+                  inter->intername.c_str(), fmtname[format], stat.rows, clientsent[sockfd], timer.Elapsed());
+    if (starg.userlog == 1) WriteUserLog(sockfd, user, inter, stat.rows, timer.Elapsed());
+    return clientkeepalive[sockfd];
+  }
+
+  // From here on, the leader hands its result to the waiting requests with leader.done(), the others run the query alone.
+  flightleader leader(reqkey, flight, bleader);
+  string result;          // Copy of the response body for the cache and the waiting requests.
+  bool bresult = false;   // Whether result is the complete response body.
+
+  long waitstart = MonoUs();
+  connpool *pool = 0;
+  connection *conn = GetReadConn(pool); // Get a database connection, from a replica if there is one.
+  stat.phaseus[PH_DBWAIT] = MonoUs() - waitstart;
+
+  // If no database connection is free in time, or connecting fails, return internal error to the client.
+  if (conn == 0)
+  {
+    leader.done(false, result, 0);
+    SendResponse(sockfd, "<retcode>-1</retcode><message>Internal error.</message>");
+    return clientkeepalive[sockfd];
+  }
+
+  // First send the response message header to the client, then execute the interface's SQL statement
+  // and return the data to the client.
+  if ((SendHeader(sockfd, format) == false) ||
+      (ExecSQL(pool, conn, inter, params, sockfd, format, sendbuf, result, bresult, stat) == false))
+  {
+    pool->free(conn);
+    leader.done(false, result, 0);
+    return false;
+  }
+
+  pool->free(conn);
+
+  // Cache the result if the interface is cached and the result is not too large, then hand it to the waiting requests.
+  if ((inter->cachesecs > 0) && (bresult == true) && (result.size() <= resultcache.maxitem()))
+    resultcache.put(reqkey, result, inter->cachesecs);
+  leader.done(bresult, result, stat.rows);
+
+  // End the response body.
+  if (WriteBody(sockfd, 0, 0) == false) return false;
+
+  stat.berror = false;
+  stat.phaseus[PH_TOTAL] = MonoUs() - starttime;
+
+  logfile.Write("intername=%s,format=%s,rows=%ld,bytes=%ld,elapsed=%.6f\n",
+                inter->intername.c_str(), fmtname[format], stat.rows, clientsent[sockfd], timer.Elapsed());
+
+  // Write to interface invocation log table T_USERLOG, by the background thread.
+  if (starg.userlog == 1) WriteUserLog(sockfd, user, inter, stat.rows, timer.Elapsed());
+
+  return clientkeepalive[sockfd];
+}
+
+// Send the response message header of the interface data to the client. The length of the data is unknown,
+// so the body is sent in chunks on a keep-alive connection, otherwise the end of the body is the close of the connection.
+bool SendHeader(const int sockfd, const int format)
+{
+  const char *contenttype = "text/html";
+  if (format == FMT_JSON) contenttype = "application/json";
+  if (format == FMT_CSV)  contenttype = "text/csv";
+
+  // The encoding of a compressed response.
+  char strencoding[64];
+  memset(strencoding, 0, sizeof(strencoding));
+  if (clientenc[sockfd] != 0) snprintf(strencoding, sizeof(strencoding), "Content-Encoding: %s\r\n", encname[clientenc[sockfd]->encoding()]);
+
+  char strsendbuf[320];
+  memset(strsendbuf, 0, sizeof(strsendbuf));
+  sprintf(strsendbuf, \
+          "HTTP/1.1 200 OK\r\n"\
+          "Server: webserver\r\n"\
+          "Content-Type: %s;charset=utf-8\r\n"\
+          "%s"\
+          "Vary: Accept-Encoding\r\n"\
+          "%s\r\n", contenttype, strencoding, clientkeepalive[sockfd] == true ? "Transfer-Encoding: chunked\r\nConnection: keep-alive\r\n" : "Connection: close\r\n");
+
+  // The header goes out with the first piece of the body, WriteBody() uncorks at the end of the body.
+  SetCork(sockfd, true);
+
+  return Writen(sockfd, strsendbuf, strlen(strsendbuf));
+}
+
+// Send a complete response body of the interface data to the client, taken from the cache or from another request.
+bool SendResult(const int sockfd, const int format, const string &data, const bool bencoded)
+{
+  if (SendHeader(sockfd, format) == false) return false;
+
+  // A precompressed body is sent as it is.
+  if (bencoded == true)
+  {
+    if (WriteChunk(sockfd, data.data(), data.size()) == false) return false;
+    return WriteChunk(sockfd, 0, 0);
+  }
+
+  if (WriteBody(sockfd, data.data(), data.size()) == false) return false;
+
+  return WriteBody(sockfd, 0, 0);
+}
+
+// Read the data of a client socket without blocking, return false if the connection should be closed.
+bool RecvRequest(const int sockfd)
+{
+  char buffer[4096];
+
+  while (true)
+  {
+    int buflen = recv(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT);
+
+    if (buflen == 0) return false;      // The client has closed the connection.
+
+    if (buflen < 0)
+    {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;  // All the data has been read.
+      if (errno == EINTR) continue;
+      return false;
+    }
+
+    clientrbuf[sockfd].append(buffer, buflen);
+    clientatime[sockfd] = time(0);
+  }
+
+  // The request message header is too large, it is not a request of the data service bus.
+  if ((clientrbuf[sockfd].size() > MAXREQSIZE) && (clientrbuf[sockfd].find("\r\n\r\n") == string::npos))
+  {
+    logfile.Write("Client(%d) request is too large.\n", sockfd);
+    return false;
+  }
+
+  return true;
+}
+
+// Take the first complete request message from the data received from the client socket, return false if there is none.
+bool GetRequest(const int sockfd, string &request)
+{
+  size_t pos = clientrbuf[sockfd].find("\r\n\r\n");
+  if (pos == string::npos) return false;
+
+  request.assign(clientrbuf[sockfd], 0, pos + 4);
+  clientrbuf[sockfd].erase(0, pos + 4);
+
+  // HTTP/1.1 keeps the connection unless the client asks to close it, HTTP/1.0 always closes it.
+  size_t eol = request.find("\r\n");
+  clientkeepalive[sockfd] = (request.rfind("HTTP/1.1", eol) != string::npos) &&
+                            (strcasestr(request.c_str(), "Connection: close") == 0);
+
+  return true;
+}
+
+// Send a complete response message with the body to the client.
+bool SendResponse(const int sockfd, const char *body)
+{
+  char strbuffer[1024];
+  memset(strbuffer, 0, sizeof(strbuffer));
+
+  snprintf(strbuffer, sizeof(strbuffer), \
+           "HTTP/1.1 200 OK\r\n"\
+           "Server: webserver\r\n"\
+           "Content-Type: text/html;charset=utf-8\r\n"\
+           "Content-Length: %d\r\n"\
+           "Connection: %s\r\n\r\n"\
+           "%s", (int)strlen(body), clientkeepalive[sockfd] == true ? "keep-alive" : "close", body);
+
+  return Writen(sockfd, strbuffer, strlen(strbuffer));
+}
+
+// Send a piece of the response body of ExecSQL to the client, compressed if the response is compressed.
+// len=0 ends the response body.
+bool WriteBody(const int sockfd, const char *buffer, const int len)
+{
+  encoder *enc = clientenc[sockfd];
+  if (enc == 0) return WriteChunk(sockfd, buffer, len);
+
+  // Note that an empty piece would end the chunked body, the compressor may have no output for a piece.
+  if (enc->compress(buffer, len, len == 0) == false) return false;
+  if ((enc->m_out.size() > 0) && (WriteChunk(sockfd, enc->m_out.data(), enc->m_out.size()) == false)) return false;
+  enc->m_out.clear();
+
+  if (len == 0) return WriteChunk(sockfd, 0, 0);
+
+  return true;
+}
+
+// Send a piece of the response body as it is, with chunked transfer encoding on a keep-alive connection.
+// len=0 ends the response body.
+bool WriteChunk(const int sockfd, const char *buffer, const int len)
+{
+  clientsent[sockfd] = clientsent[sockfd] + len;
+
+  if (clientkeepalive[sockfd] == false)
+  {
+    if (len == 0) { SetCork(sockfd, false); return true; }
+    time_t start = time(0);
+    if (Writen(sockfd, buffer, len) == false) return false;
+    return ((time(0) - start) < SENDTIMEOUT);
+  }
+
+  if (len == 0)   // The last chunk.
+  {
+    bool bret = Writen(sockfd, "0\r\n\r\n", 5);
+    SetCork(sockfd, false);
+    return bret;
+  }
+
+  // The size line, the data and the end of the chunk are sent with one system call.
+  char strsize[21];
+  int sizelen = snprintf(strsize, sizeof(strsize), "%x\r\n", len);
+
+  struct iovec iov[3];
+  iov[0].iov_base = strsize;         iov[0].iov_len = sizelen;
+  iov[1].iov_base = (char *)buffer;  iov[1].iov_len = len;
+  iov[2].iov_base = (char *)"\r\n"; iov[2].iov_len = 2;
+
+  // SO_SNDTIMEO ends a send() that has waited SENDTIMEOUT, but it returns the bytes the kernel has taken meanwhile,
+  // and the next send() waits again. A piece that has taken SENDTIMEOUT means the client has stopped reading.
+  time_t start = time(0);
+  if (Writev(sockfd, iov, 3) == false) return false;
+  return ((time(0) - start) < SENDTIMEOUT);
+}
+
+// Hold the partial segments of a response in the kernel (TCP_CORK) until the response is complete.
+void SetCork(const int sockfd, const bool bcork)
+{
+  int opt = (bcork == true) ? 1 : 0;
+  setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, &opt, sizeof(opt));
+}
+
+// Invalidate the cached results of an interface, requested by the ingestion programs on this host after they load new data.
+// GET /cache/invalidate?intername=getzhobtmind1, without intername all the cached results are removed.
+bool Invalidate(const int sockfd, const struct st_params &params)
+{
+  // Only the programs on this host can invalidate the cache.
+  if (LocalPeer(sockfd) == false)
+  {
+    SendResponse(sockfd, "<retcode>-1</retcode><message>Permission denied</message>");
+    return clientkeepalive[sockfd];
+  }
+
+  char intername[30];
+  getvalue(params, "intername", intername, 29);
+
+  int count = resultcache.invalidate(intername);
+
+  logfile.Write("Cache of %s invalidated, %d results removed.\n", strlen(intername) == 0 ? "all interfaces" : intername, count);
+
+  char strbody[256];
+  snprintf(strbody, sizeof(strbody), "<retcode>0</retcode><message>ok</message><count>%d</count>", count);
+  SendResponse(sockfd, strbody);
+
+  return clientkeepalive[sockfd];
+}
+
+// Check the subscription request, send the response header and make the subscription in clientsub.
+// GET /subscribe?username=xx&passwd=xx&obtid=51076,51133, the header Last-Event-ID or the parameter lastid
+// asks for the rows after it.
+bool Subscribe(const int sockfd, const char *buffer, const struct st_params &params)
+{
+  shared_ptr<const struct st_paramcfg> cfg = atomic_load(&paramcfg);
+
+  const struct st_usercfg *user = Login(cfg.get(), params, sockfd);
+  if (user == 0) return clientkeepalive[sockfd];
+
+  if (cfg->mperms.count(user->username + '\1' + STREAMINTER) == 0)
+  {
+    SendResponse(sockfd, "<retcode>-1</retcode><message>Permission denied</message>");
+    return clientkeepalive[sockfd];
+  }
+
+  if (streams.m_count >= starg.maxstreams)
+  {
+    SendResponse(sockfd, "<retcode>-1</retcode><message>Too many subscribers.</message>");
+    return clientkeepalive[sockfd];
+  }
+
+  struct st_subscriber *sub = new struct st_subscriber;
+  sub->sockfd = sockfd;
+  sub->atime = time(0);
+  sub->lastid = 0;
+
+  char strvalue[2001];
+  getvalue(params, "obtid", strvalue, 2000);
+  CCmdStr CmdStr;
+  CmdStr.SplitToCmd(strvalue, ",", true);
+  for (int ii = 0; ii < CmdStr.CmdCount(); ii++)
+    if (CmdStr.m_vCmdStr[ii].empty() == false) sub->obtids.insert(CmdStr.m_vCmdStr[ii]);
+
+  // The browsers send Last-Event-ID when they reconnect, the other clients can pass lastid.
+  const char *lastid = strcasestr(buffer, "\r\nLast-Event-ID:");
+  if (lastid != 0)
+  {
+    lastid = lastid + 16;
+    while ((*lastid == ' ') || (*lastid == '\t')) lastid++;
+    sub->lastid = atol(lastid);
+  }
+  else if (getvalue(params, "lastid", strvalue, 20) == true) sub->lastid = atol(strvalue);
+
+  // The stream ends when the connection is closed, the client reconnects after retry milliseconds.
+  const char *header = "HTTP/1.1 200 OK\r\n"\
+                       "Server: webserver\r\n"\
+                       "Content-Type: text/event-stream;charset=utf-8\r\n"\
+                       "Cache-Control: no-cache\r\n"\
+                       "Connection: close\r\n\r\n"\
+                       "retry: 5000\n\n";
+  if (Writen(sockfd, header, strlen(header)) == false) { delete sub; return false; }
+
+  logfile.Write("Client(%d) subscribed, user=%s,obtids=%d,lastid=%ld.\n", sockfd, user->username.c_str(), (int)sub->obtids.size(), sub->lastid);
+
+  clientsub[sockfd] = sub;
+
+  return false;
+}
+
+// Whether the client is a program on this host, only they can call the administration URLs.
+bool LocalPeer(const int sockfd)
+{
+  struct sockaddr_in peer;
+  socklen_t len = sizeof(peer);
+  if (getpeername(sockfd, (struct sockaddr *)&peer, &len) != 0) return false;
+
+  return (ntohl(peer.sin_addr.s_addr) >> 24) == 127;
+}
+
+// Close a client socket and clear its state.
+void CloseClient(const int sockfd)
+{
+  // Clear the state before close(), the socket number can be reused by the next accept() at once.
+  clientrbuf[sockfd].clear();
+  clientatime[sockfd] = 0;
+  clientbusy[sockfd] = false;
+
+  close(sockfd);   // close() also removes the socket from epoll.
 }
 
 // Process exit function.
@@ -310,23 +1702,32 @@ void EXIT(int sig)
 
   TcpServer.CloseListen(); // Close the listening socket.
 
+  // Stop the monitoring thread first, or it would start new worker threads in place of the cancelled ones,
+  // and pthread_cond_destroy() below would wait for them for ever.
+  pthread_cancel(checkpthid);
+  pthread_join(checkpthid, NULL);
+
   // Cancel all threads.
   pthread_spin_lock(&spin);
   for (int ii = 0; ii < vthid.size(); ii++)
   {
-    pthread_cancel(vthid[ii].pthid);
+    if (vthid[ii].brun == true) pthread_cancel(vthid[ii].pthid);
   }
   pthread_spin_unlock(&spin);
 
   sleep(1); // Give enough time for sub-threads to exit.
 
-  pthread_cancel(checkpthid); // Cancel the monitoring thread.
   pthread_cancel(checkpoolid); // Cancel the database connection pool checking thread.
+  pthread_cancel(refreshid);   // Cancel the thread reloading the parameter tables.
+  pthread_cancel(streamid);    // Cancel the thread polling the new rows for the subscribers.
+  if (starg.userlog == 1) pthread_cancel(userlogid);   // The records of the last calls have been written in the second above.
 
   pthread_spin_destroy(&spin);
   pthread_mutex_destroy(&mutex);
   pthread_cond_destroy(&cond);
 
+  logfile.Close();   // Write the lines still in the buffers of the log.
+
   exit(0);
 }
 
@@ -335,15 +1736,13 @@ void thcleanup(void *arg) // Thread cleanup function.
 {
   pthread_mutex_unlock(&mutex);
 
-  // Remove the thread's structure from the container storing thread structures.
+  // Free the slot of the thread, unless it has been freed already (the thread is exiting because it is idle)
+  // and maybe used by a new thread. The slot numbers of the other threads do not change.
+  int pthnum = (int)(long)arg;
   pthread_spin_lock(&spin);
-  for (int ii = 0; ii < vthid.size(); ii++)
+  if ((vthid[pthnum].brun == true) && (pthread_equal(pthread_self(), vthid[pthnum].pthid)))
   {
-    if (pthread_equal(pthread_self(), vthid[ii].pthid))
-    {
-      vthid.erase(vthid.begin() + ii);
-      break;
-    }
+    vthid[pthnum].brun = false; nthreads--;
   }
   pthread_spin_unlock(&spin);
 
@@ -362,8 +1761,39 @@ void _help(char *argv[])
   printf("xmlbuffer: The program's parameters represented in XML, as follows:\n\n");
 
   printf("connstr: Database connection parameters in the format username/password@tnsname.\n");
+  printf("replicas: Optional, connection parameters of the read replicas separated by commas, for example the sub-databases\n"\
+         "          kept by syncincrement_oracle. The queries of the interfaces go to the replica with the fewest requests\n"\
+         "          in progress, the primary (connstr) is used when no replica is available.\n");
+  printf("lagsql: Optional, SQL returning one number, run on the primary and the replicas every 30 seconds, the difference\n"\
+         "        is the lag of a replica, for example select max(keyid) from T_ZHOBTMIND.\n");
+  printf("maxlag: Optional, a replica whose lag is larger than this is not used until it has caught up, default 300.\n");
   printf("charset: Database character set. This parameter should be consistent with the data source database, or there might be Chinese garbled characters.\n");
-  printf("port: The port on which the web service listens.\n\n");
+  printf("port: The port on which the web service listens.\n");
+  printf("cachesize: Optional, the size of the result cache in MB, default 64. The results of an interface are cached for\n"\
+         "           the cachesecs seconds configured in T_INTERCFG, 0 means no cache.\n"\
+         "           Ingestion programs on this host can call /cache/invalidate?intername=xxx after loading new data.\n");
+  printf("The responses are compressed with gzip or deflate if the client accepts it (Accept-Encoding), and with zstd\n"\
+         "if the program is built with -DWITH_ZSTD. A cached result keeps its compressed copy.\n");
+  printf("refreshsecs: Optional, the interval in seconds of reloading T_USERINFO, T_INTERCFG and T_USERANDINTER, default 60.\n");
+  printf("minconns: Optional, the number of database connections made at startup and kept even if they are idle, default 2.\n");
+  printf("maxconns: Optional, the maximum number of database connections, default 10.\n");
+  printf("conntimeout: Optional, idle database connections above minconns are disconnected after this many seconds, default 50.\n");
+  printf("waittimeout: Optional, the time in milliseconds a request waits for a free database connection, default 3000.\n");
+  printf("minthreads: Optional, the minimum number of worker threads, default 10.\n");
+  printf("maxthreads: Optional, the maximum number of worker threads, default 100.\n");
+  printf("threadidle: Optional, a worker thread above minthreads exits after it has been idle for this many seconds, default 60.\n");
+  printf("maxqueue: Optional, the maximum number of requests waiting for the worker threads, the others are answered with 503, default 1000.\n");
+  printf("The waiting requests are shared among the users by the weight in T_USERINFO, and the requests of a user over\n"\
+         "the ratelimit (per second) and burst in T_USERINFO are answered with 429, see /project/idc/sql/T_USERINFO.sql.\n");
+  printf("userlog: Optional, whether the calls are written to T_USERLOG, 1-yes, 0-no, default 1.\n");
+  printf("userlogqueue: Optional, the maximum number of calls waiting to be written to T_USERLOG, the others are not written, default 65536.\n");
+  printf("streamsecs: Optional, the interval in seconds of polling the new rows of T_ZHOBTMIND for the subscribers, default 5.\n");
+  printf("maxstreams: Optional, the maximum number of the subscribers, default 1000.\n\n");
+
+  printf("The users with the permission of getzhobtmind1 can subscribe to the new minute data with\n"\
+         "/subscribe?username=xx&passwd=xx&obtid=51076,51133, the rows are pushed as server-sent events.\n");
+
+  printf("The metrics of the interfaces and the users are served in the Prometheus text format on /metrics to the programs on this host.\n\n");
 }
 
 // Parse XML into the parameter starg structure.
@@ -378,6 +1808,11 @@ bool _xmltoarg(char *strxmlbuffer)
     return false;
   }
 
+  GetXMLBuffer(strxmlbuffer, "replicas", starg.replicas, 1000);
+  GetXMLBuffer(strxmlbuffer, "lagsql", starg.lagsql, 300);
+  GetXMLBuffer(strxmlbuffer, "maxlag", &starg.maxlag);
+  if (starg.maxlag == 0) starg.maxlag = 300;
+
   GetXMLBuffer(strxmlbuffer, "charset", starg.charset, 50);
   if (strlen(starg.charset) == 0)
   {
@@ -392,86 +1827,153 @@ bool _xmltoarg(char *strxmlbuffer)
     return false;
   }
 
-  return true;
-}
+  GetXMLBuffer(strxmlbuffer, "cachesize", &starg.cachesize);
+  if (starg.cachesize == 0) starg.cachesize = 64;
 
-// Read client messages.
-int ReadT(const int sockfd, char *buffer, const int size, const int itimeout)
-{
-  if (itimeout > 0)
-  {
-    struct pollfd fds;
-    fds.fd = sockfd;
-    fds.events = POLLIN;
-    int iret;
-    if ((iret = poll(&fds, 1, itimeout * 1000)) <= 0)
-      return iret;
-  }
+  GetXMLBuffer(strxmlbuffer, "refreshsecs", &starg.refreshsecs);
+  if (starg.refreshsecs == 0) starg.refreshsecs = 60;
+
+  GetXMLBuffer(strxmlbuffer, "minconns", &starg.minconns);
+  if (starg.minconns == 0) starg.minconns = 2;
+
+  GetXMLBuffer(strxmlbuffer, "maxconns", &starg.maxconns);
+  if (starg.maxconns == 0) starg.maxconns = 10;
+
+  GetXMLBuffer(strxmlbuffer, "conntimeout", &starg.conntimeout);
+  if (starg.conntimeout == 0) starg.conntimeout = 50;
+
+  GetXMLBuffer(strxmlbuffer, "waittimeout", &starg.waittimeout);
+  if (starg.waittimeout == 0) starg.waittimeout = 3000;
+
+  GetXMLBuffer(strxmlbuffer, "minthreads", &starg.minthreads);
+  if (starg.minthreads == 0) starg.minthreads = 10;
+
+  GetXMLBuffer(strxmlbuffer, "maxthreads", &starg.maxthreads);
+  if (starg.maxthreads < starg.minthreads) starg.maxthreads = (starg.minthreads > 100) ? starg.minthreads : 100;
 
-  return recv(sockfd, buffer, size, 0);
+  GetXMLBuffer(strxmlbuffer, "threadidle", &starg.threadidle);
+  if (starg.threadidle == 0) starg.threadidle = 60;
+
+  GetXMLBuffer(strxmlbuffer, "maxqueue", &starg.maxqueue);
+  if (starg.maxqueue == 0) starg.maxqueue = 1000;
+
+  // The calls are written to T_USERLOG unless it is disabled with <userlog>0</userlog>.
+  char struserlog[11];
+  memset(struserlog, 0, sizeof(struserlog));
+  GetXMLBuffer(strxmlbuffer, "userlog", struserlog, 10);
+  starg.userlog = (strcmp(struserlog, "0") == 0) ? 0 : 1;
+
+  GetXMLBuffer(strxmlbuffer, "userlogqueue", &starg.userlogqueue);
+  if (starg.userlogqueue == 0) starg.userlogqueue = 65536;
+
+  GetXMLBuffer(strxmlbuffer, "streamsecs", &starg.streamsecs);
+  if (starg.streamsecs == 0) starg.streamsecs = 5;
+
+  GetXMLBuffer(strxmlbuffer, "maxstreams", &starg.maxstreams);
+  if (starg.maxstreams == 0) starg.maxstreams = 1000;
+
+  return true;
 }
 
 // Check username and password in the URL, if incorrect, return authentication failed response message.
-bool Login(connection *conn, const char *buffer, const int sockfd)
+const struct st_usercfg *Login(const struct st_paramcfg *cfg, const struct st_params &params, const int sockfd)
 {
   char username[31], passwd[31];
 
-  getvalue(buffer, "username", username, 30); // Get the username.
-  getvalue(buffer, "passwd", passwd, 30);     // Get the password.
+  getvalue(params, "username", username, 30); // Get the username.
+  getvalue(params, "passwd", passwd, 30);     // Get the password.
 
-  // Query the T_USERINFO table to check if the username and password exist.
-  sqlstatement stmt;
-  stmt.connect(conn);
-  stmt.prepare("select count(*) from T_USERINFO where username=:1 and passwd=:2 and rsts=1");
-  stmt.bindin(1, username, 30);
-  stmt.bindin(2, passwd, 30);
-  int icount = 0;
-  stmt.bindout(1, &icount);
-  stmt.execute();
-  stmt.next();
-
-  if (icount == 0) // Authentication failed, return authentication failed response message.
-  {
-    char strbuffer[256];
-    memset(strbuffer, 0, sizeof(strbuffer));
-
-    sprintf(strbuffer, \
-            "HTTP/1.1 200 OK\r\n"\
-            "Server: webserver\r\n"\
-            "Content-Type: text/html;charset=utf-8\r\n\r\n"\
-            "<retcode>-1</retcode><message>Username or password is invalid</message>");
-    Writen(sockfd, strbuffer, strlen(strbuffer));
+  // Check if the username and password exist in T_USERINFO.
+  unordered_map<string, struct st_usercfg>::const_iterator it = cfg->musers.find(username);
 
-    return false;
+  if ((it == cfg->musers.end()) || (it->second.passwd != passwd)) // Authentication failed, return authentication failed response message.
+  {
+    SendResponse(sockfd, "<retcode>-1</retcode><message>Username or password is invalid</message>");
+
+    return 0;
   }
 
-  return true;
+  return &it->second;
 }
 
-// Get parameters from the GET request.
-bool getvalue(const char *buffer, const char *name, char *value, const int len)
+// Parse the query string of the request line, "GET /api?name1=value1&name2=value2 HTTP/1.1".
+void ParseParams(const char *buffer, struct st_params &params)
 {
-  value[0] = 0;
+  params.count = 0;
 
-  char *start, *end;
-  start = end = 0;
+  // The query string is between the '?' of the URL and the end of the URL.
+  const char *pos = buffer;
+  while ((*pos != ' ') && (*pos != 0)) pos++;     // Skip the method.
+  while (*pos == ' ') pos++;
+  while ((*pos != '?') && (*pos != ' ') && (*pos != '\r') && (*pos != '\n') && (*pos != 0)) pos++;
+  if (*pos != '?') return;   // No parameters.
+  pos++;
 
-  start = strstr((char *)buffer, (char *)name);
-  if (start == 0)
-    return false;
+  while (params.count < MAXPARAMS)
+  {
+    struct st_param &param = params.params[params.count];
 
-  end = strstr(start, "&");
-  if (end == 0)
-    end = strstr(start, " ");
+    // name=value, up to the next '&' or the end of the URL.
+    param.name = pos;
+    while ((*pos != '=') && (*pos != '&') && (*pos != ' ') && (*pos != '\r') && (*pos != '\n') && (*pos != 0)) pos++;
+    param.namelen = pos - param.name;
 
-  if (end == 0)
-    return false;
+    param.value = pos;
+    if (*pos == '=')
+    {
+      param.value = ++pos;
+      while ((*pos != '&') && (*pos != ' ') && (*pos != '\r') && (*pos != '\n') && (*pos != 0)) pos++;
+    }
+    param.valuelen = pos - param.value;
+
+    if (param.namelen > 0) params.count++;   // "&&" or "&=x" is not a parameter.
+
+    if (*pos != '&') break;
+    pos++;
+  }
+}
+
+// Value of a hexadecimal digit, -1 if it is not one.
+static inline int hexvalue(const char ch)
+{
+  if ((ch >= '0') && (ch <= '9')) return ch - '0';
+  if ((ch >= 'a') && (ch <= 'f')) return ch - 'a' + 10;
+  if ((ch >= 'A') && (ch <= 'F')) return ch - 'A' + 10;
+  return -1;
+}
+
+// Get the value of a parameter from the GET request, percent-decoded, at most len bytes.
+// Return false if the parameter is not in the request, value is empty then.
+bool getvalue(const struct st_params &params, const char *name, char *value, const int len)
+{
+  value[0] = 0;
 
-  int ilen = end - (start + strlen(name) + 1);
-  if (ilen > len)
-    ilen = len;
+  // The whole name must match, "passwd" does not match "oldpasswd". The first one is taken if the name is repeated.
+  int namelen = strlen(name);
+  int ii = 0;
+  for (; ii < params.count; ii++)
+  {
+    if ((params.params[ii].namelen == namelen) && (memcmp(params.params[ii].name, name, namelen) == 0)) break;
+  }
+  if (ii == params.count) return false;
 
-  strncpy(value, start + strlen(name) + 1, ilen);
+  // Copy the value, "%xx" is the byte of the hexadecimal xx and '+' is a space.
+  const char *src = params.params[ii].value;
+  const char *end = src + params.params[ii].valuelen;
+  int ilen = 0;
+  while ((src < end) && (ilen < len))
+  {
+    if ((*src == '%') && (end - src >= 3) && (hexvalue(src[1]) >= 0) && (hexvalue(src[2]) >= 0))
+    {
+      value[ilen++] = (char)(hexvalue(src[1]) * 16 + hexvalue(src[2]));
+      src = src + 3;
+    }
+    else
+    {
+      value[ilen++] = (*src == '+') ? ' ' : *src;
+      src++;
+    }
+  }
 
   value[ilen] = 0;
 
@@ -480,363 +1982,2239 @@ bool getvalue(const char *buffer, const char *name, char *value, const int len)
 
 
 // Check if the user has permission to call the interface. If not, return a response message indicating no permission.
-bool CheckPerm(connection *conn, const char *buffer, const int sockfd)
+const struct st_intercfg *CheckPerm(const struct st_paramcfg *cfg, const struct st_params &params, const int sockfd)
 {
   char username[31], intername[30];
 
-  getvalue(buffer, "username", username, 30);     // Get the username.
-  getvalue(buffer, "intername", intername, 30);   // Get the interface name.
+  getvalue(params, "username", username, 30);     // Get the username.
+  getvalue(params, "intername", intername, 29);   // Get the interface name.
 
-  sqlstatement stmt;
-  stmt.connect(conn);
-  stmt.prepare("select count(*) from T_USERANDINTER where username=:1 and intername=:2 and intername in (select intername from T_INTERCFG where rsts=1)");
-  stmt.bindin(1, username, 30);
-  stmt.bindin(2, intername, 30);
-  int icount = 0;
-  stmt.bindout(1, &icount);
-  stmt.execute();
-  stmt.next();
+  // The interface must be valid in T_INTERCFG and granted to the user in T_USERANDINTER.
+  unordered_map<string, struct st_intercfg>::const_iterator it = cfg->minters.find(intername);
 
-  if (icount != 1)
+  if ((it == cfg->minters.end()) || (cfg->mperms.count(string(username) + '\1' + intername) == 0))
   {
-    char strbuffer[256];
-    memset(strbuffer, 0, sizeof(strbuffer));
-
-    sprintf(strbuffer, \
-            "HTTP/1.1 200 OK\r\n"\
-            "Server: webserver\r\n"\
-            "Content-Type: text/html;charset=utf-8\r\n\r\n"\
-            "<retcode>-1</retcode><message>Permission denied</message>");
+    SendResponse(sockfd, "<retcode>-1</retcode><message>Permission denied</message>");
 
-    Writen(sockfd, strbuffer, strlen(strbuffer));
-
-    return false;
+    return 0;
   }
 
-  return true;
+  return &it->second;
 }
 
 
 // Execute the interface's SQL statement and return the data to the client.
-bool ExecSQL(connection *conn, const char *buffer, const int sockfd)
+bool ExecSQL(class connpool *pool, connection *conn, const struct st_intercfg *inter, const struct st_params &params, const int sockfd,
+             const int format, string &sendbuf, string &result, bool &bresult, struct st_reqstat &stat)
 {
-  // Parse the interface name from the request message.
-  char intername[30];
-  memset(intername, 0, sizeof(intername));
-  getvalue(buffer, "intername", intername, 30);  // Get the interface name.
-
-  // Load interface parameters from the T_INTERCFG table.
-  char selectsql[1001], colstr[301], bindin[301];
-  memset(selectsql, 0, sizeof(selectsql)); // Interface SQL.
-  memset(colstr, 0, sizeof(colstr));       // Output column names.
-  memset(bindin, 0, sizeof(bindin));       // Interface parameters.
-  sqlstatement stmt;
-  stmt.connect(conn);
-  stmt.prepare("select selectsql, colstr, bindin from T_INTERCFG where intername=:1");
-  stmt.bindin(1, intername, 30);    // Interface name.
-  stmt.bindout(1, selectsql, 1000); // Interface SQL.
-  stmt.bindout(2, colstr, 300);     // Output column names.
-  stmt.bindout(3, bindin, 300);     // Interface parameters.
-  stmt.execute();  // There's almost no need to check the return value here; errors are very unlikely.
-  stmt.next();
-
-
-  // Prepare the SQL statement for querying data.
-  stmt.prepare(selectsql);
-
-  // Split the input parameters bindin.
-  CCmdStr CmdStr;
-  CmdStr.SplitToCmd(bindin, ",");
-
-  // Declare an array to hold input parameter values. Input parameter values are not too long, 100 is sufficient.
-  char invalue[CmdStr.CmdCount()][101];
-  memset(invalue, 0, sizeof(invalue));
-
-  // Parse the input parameters from the HTTP GET request message and bind them to the SQL.
-  for (int ii = 0; ii < CmdStr.CmdCount(); ii++)
+  long starttime = MonoUs();
+  long queryus = 0;   // Time in execute() and next(), the rest of this function is the serialize phase.
+
+  // A page of the result is requested with the limit parameter, and the after parameter from the previous page.
+  char strlimit[11];
+  getvalue(params, "limit", strlimit, 10);
+  int limit = atoi(strlimit);
+  bool bpage = ((limit > 0) && (inter->pagekey.empty() == false));
+
+  // The first page has no after parameter, so the pagekey can be of any type.
+  char strafter[101];
+  getvalue(params, "after", strafter, 100);
+  int page = PAGE_NONE;
+  if (bpage == true) page = (strlen(strafter) == 0) ? PAGE_FIRST : PAGE_NEXT;
+
+  // Get the prepared statement of the interface, its input parameters and result columns are bound already.
+  connpool::st_stmt *pstmt = pool->getstmt(conn, inter, page);
+  sqlstatement &stmt = pstmt->stmt;
+  char *invalue = &pstmt->invalue[0];    // Input parameter values are not too long, 100 is sufficient.
+  char *colvalue = &pstmt->colvalue[0];  // Values of the result columns.
+
+  memset(invalue, 0, pstmt->invalue.size());
+
+  // Parse the input parameters from the HTTP GET request message into the bound buffers.
+  for (int ii = 0; ii < inter->vbindin.size(); ii++)
   {
-    getvalue(buffer, CmdStr.m_vCmdStr[ii].c_str(), invalue[ii], 100);
-    stmt.bindin(ii + 1, invalue[ii], 100);
+    getvalue(params, inter->vbindin[ii].c_str(), invalue + ii * 101, 100);
   }
 
-  //////////////////////////////////////////////////
+  // The last input parameters of the page: after (not on the first page) and limit.
+  if (bpage == true)
+  {
+    char *pos = invalue + inter->vbindin.size() * 101;
+    if (page == PAGE_NEXT) { strcpy(pos, strafter); pos = pos + 101; }
+    snprintf(pos, 100, "%d", limit);
+  }
 
-  // Bind the output variables of the SQL statement for querying data.
-  // Based on the column names in the interface configuration (colstr field), bind the result set.
-  //////////////////////////////////////////////////
-  // Split colstr to obtain the number of fields in the result set.
-  CmdStr.SplitToCmd(colstr, ",");
+  char lastkey[2001];   // pagekey of the last row of the page.
+  memset(lastkey, 0, sizeof(lastkey));
 
-  // Array to hold the result set.
-  char colvalue[CmdStr.CmdCount()][2001];
+  // A copy of the response body is kept for the cache and the waiting requests, unless it is too large.
+  result.clear();
+  bresult = true;
 
-  // Bind the result set to the colvalue array.
-  for (int ii = 0; ii < CmdStr.CmdCount(); ii++)
-  {
-    stmt.bindout(ii + 1, colvalue[ii], 2000);
-  }
-  //////////////////////////////////////////////////
+  sendbuf.clear();
+  serializer out(sendbuf, format, inter->vcols);
 
   // Execute the SQL statement.
-  char strsendbuffer[4001]; // XML to be sent to the client.
-  memset(strsendbuffer, 0, sizeof(strsendbuffer));
-
-  if (stmt.execute() != 0)
+  long calltime = MonoUs();
+  int rc = stmt.execute();
+  queryus = MonoUs() - calltime;
+  if (rc != 0)
   {
-    sprintf(strsendbuffer, "<retcode>%d</retcode><message>%s</message>\n", stmt.m_cda.rc, stmt.m_cda.message);
-    Writen(sockfd, strsendbuffer, strlen(strsendbuffer));
+    out.error(stmt.m_cda.rc, stmt.m_cda.message);
+    WriteBody(sockfd, sendbuf.data(), sendbuf.size());
+    WriteBody(sockfd, 0, 0);
     logfile.Write("stmt.execute() failed.\n%s\n%s\n", stmt.m_sql, stmt.m_cda.message);
     return false;
   }
-  strcpy(strsendbuffer, "<retcode>0</retcode><message>ok</message>\n");
-  Writen(sockfd, strsendbuffer, strlen(strsendbuffer));
 
-  // Send the header tag <data> to the client for XML content.
-  Writen(sockfd, "<data>\n", strlen("<data>\n"));
+  out.head();
 
-  // Fetch the result set, for each record fetched, concatenate XML message, and send it to the client.
-  //////////////////////////////////////////////////
-  char strtemp[2001]; // Temporary variable for concatenating XML.
+  // Fetch the result set row by row into the output buffer, and send the buffer to the client when it is large enough.
+  while (true)
+  {
+    memset(colvalue, 0, pstmt->colvalue.size());
 
+    calltime = MonoUs();
+    rc = stmt.next();
+    queryus = queryus + MonoUs() - calltime;
+    if (rc != 0) break; // Fetch one record from the result set.
 
+    out.row(colvalue);
 
-  // Fetch the result set row by row and send it to the client.
-  while (true)
-  {
-    memset(strsendbuffer, 0, sizeof(strsendbuffer));
-    memset(colvalue, 0, sizeof(colvalue));
+    if (bpage == true) strcpy(lastkey, colvalue + inter->pagecol * 2001);
+
+    if (sendbuf.size() < FLUSHSIZE) continue;
 
-    if (stmt.next() != 0) break; // Fetch one record from the result set.
+    if (WriteBody(sockfd, sendbuf.data(), sendbuf.size()) == false) return false;
 
-    // Concatenate XML for each field.
-    for (int ii = 0; ii < CmdStr.CmdCount(); ii++)
+    if (bresult == true)
     {
-      memset(strtemp, 0, sizeof(strtemp));
-      snprintf(strtemp, 2000, "<%s>%s</%s>", CmdStr.m_vCmdStr[ii].c_str(), colvalue[ii], CmdStr.m_vCmdStr[ii].c_str());
-      strcat(strsendbuffer, strtemp);
+      result.append(sendbuf);
+      if (result.size() > MAXFLIGHTSIZE) { bresult = false; string().swap(result); }
     }
 
-    strcat(strsendbuffer, "<endl/>\n"); // XML end-of-line flag.
-
-    Writen(sockfd, strsendbuffer, strlen(strsendbuffer)); // Send this row of data to the client.
+    sendbuf.clear();   // The memory of the buffer is kept.
   }
-  //////////////////////////////////////////////////
 
-  // Send the footer tag </data> of XML content to the client.
-  Writen(sockfd, "</data>\n", strlen("</data>\n"));
+  // A full page is followed by the after parameter of the next page, a shorter one is the last page.
+  out.tail(((bpage == true) && (stmt.m_cda.rpc == limit)) ? lastkey : 0);
+
+  // Note that an empty piece would end the chunked body.
+  if ((sendbuf.size() > 0) && (WriteBody(sockfd, sendbuf.data(), sendbuf.size()) == false)) return false;
 
-  logfile.Write("intername=%s,count=%d\n", intername, stmt.m_cda.rpc);
+  if (bresult == true)
+  {
+    result.append(sendbuf);
+    if (result.size() > MAXFLIGHTSIZE) { bresult = false; string().swap(result); }
+  }
 
-  // Write to interface invocation log table T_USERLOG.
+  // A very large result would keep its memory in the buffer of the thread.
+  if (sendbuf.capacity() > FLUSHSIZE * 4) { string().swap(sendbuf); sendbuf.reserve(FLUSHSIZE * 2); }
+
+  stat.rows = stmt.m_cda.rpc;
+  stat.phaseus[PH_QUERY] = queryus;
+  stat.phaseus[PH_SERIALIZE] = MonoUs() - starttime - queryus;
 
   return true;
 }
 
-
-connpool::connpool()
+serializer::serializer(string &buf, const int format, const vector<string> &cols) : m_buf(buf), m_cols(cols)
 {
-  m_maxconns=0;
-  m_timeout=0;
-  memset(m_connstr,0,sizeof(m_connstr));
-  memset(m_charset,0,sizeof(m_charset));
-  m_conns=0;
+  m_format = format;
+  m_rows = 0;
 }
 
-// Initialize the database connection pool, initialize locks, and return false if there is an issue with the database connection parameters.
-bool connpool::init(const char *connstr, const char *charset, const int maxconns, int timeout)     
+// Append the return code and the beginning of the data.
+void serializer::head()
 {
-  // Try connecting to the database to validate the database connection parameters.
-  connection conn;
-  if (conn.connecttodb(connstr, charset) != 0)
+  if (m_format == FMT_XML)
   {
-    printf("Failed to connect to the database.\n%s\n", conn.m_cda.message);
-    return false;
+    m_buf.append("<retcode>0</retcode><message>ok</message>\n<data>\n");
   }
-  conn.disconnect();
-
-  strncpy(m_connstr, connstr, 100);
+  else if (m_format == FMT_JSON)
+  {
+    m_buf.append("{\"retcode\":0,\"message\":\"ok\",\"data\":[");
+  }
+  else
+  {
+    // The first line of CSV is the column names.
+    for (int ii = 0; ii < m_cols.size(); ii++)
+    {
+      if (ii > 0) m_buf.append(1, ',');
+      value(m_cols[ii].c_str());
+    }
+    m_buf.append("\r\n");
+  }
+}
+
+// Append a row, the values of the columns are 2001 bytes apart in colvalue.
+void serializer::row(const char *colvalue)
+{
+  if (m_format == FMT_XML)
+  {
+    for (int ii = 0; ii < m_cols.size(); ii++)
+    {
+      m_buf.append(1, '<'); m_buf.append(m_cols[ii]); m_buf.append(1, '>');
+      value(colvalue + ii * 2001);
+      m_buf.append("</", 2); m_buf.append(m_cols[ii]); m_buf.append(1, '>');
+    }
+    m_buf.append("<endl/>\n");   // XML end-of-line flag.
+  }
+  else if (m_format == FMT_JSON)
+  {
+    m_buf.append((m_rows == 0) ? "\n{" : ",\n{");
+    for (int ii = 0; ii < m_cols.size(); ii++)
+    {
+      if (ii > 0) m_buf.append(1, ',');
+      m_buf.append(1, '"'); m_buf.append(m_cols[ii]); m_buf.append("\":", 2);
+      value(colvalue + ii * 2001);
+    }
+    m_buf.append(1, '}');
+  }
+  else
+  {
+    for (int ii = 0; ii < m_cols.size(); ii++)
+    {
+      if (ii > 0) m_buf.append(1, ',');
+      value(colvalue + ii * 2001);
+    }
+    m_buf.append("\r\n");
+  }
+
+  m_rows++;
+}
+
+// Append the end of the data, and the after parameter of the next page if it is not 0.
+// The CSV client takes the pagekey of the last row.
+void serializer::tail(const char *next)
+{
+  if (m_format == FMT_XML)
+  {
+    m_buf.append("</data>\n");
+    if (next != 0) { m_buf.append("<next>"); value(next); m_buf.append("</next>\n"); }
+  }
+
+  if (m_format == FMT_JSON)
+  {
+    m_buf.append("\n]");
+    if (next != 0) { m_buf.append(",\"next\":"); value(next); }
+    m_buf.append("}\n");
+  }
+}
+
+// Append the return code and the message of an error instead of the data.
+void serializer::error(const int rc, const char *message)
+{
+  char strrc[21];
+  snprintf(strrc, sizeof(strrc), "%d", rc);
+
+  if (m_format == FMT_XML)
+  {
+    m_buf.append("<retcode>"); m_buf.append(strrc); m_buf.append("</retcode><message>");
+    value(message);
+    m_buf.append("</message>\n");
+  }
+  else if (m_format == FMT_JSON)
+  {
+    m_buf.append("{\"retcode\":"); m_buf.append(strrc); m_buf.append(",\"message\":");
+    value(message);
+    m_buf.append("}\n");
+  }
+  else
+  {
+    m_buf.append("retcode,message\r\n"); m_buf.append(strrc); m_buf.append(1, ',');
+    value(message);
+    m_buf.append("\r\n");
+  }
+}
+
+// Append a value, escaped as the format requires. The characters that need no escaping are appended in runs.
+void serializer::value(const char *str)
+{
+  // XML values are sent as they are in the database, as they always have been.
+  if (m_format == FMT_XML) { m_buf.append(str); return; }
+
+  if (m_format == FMT_JSON)
+  {
+    m_buf.append(1, '"');
+
+    const char *run = str;
+    for (const char *pos = str; *pos != 0; pos++)
+    {
+      unsigned char ch = (unsigned char)*pos;
+      if ((ch >= 0x20) && (ch != '"') && (ch != '\\')) continue;
+
+      m_buf.append(run, pos - run);
+      run = pos + 1;
+
+      if (ch == '"')       m_buf.append("\\\"", 2);
+      else if (ch == '\\') m_buf.append("\\\\", 2);
+      else if (ch == '\n') m_buf.append("\\n", 2);
+      else if (ch == '\r') m_buf.append("\\r", 2);
+      else if (ch == '\t') m_buf.append("\\t", 2);
+      else
+      {
+        char strtemp[7];
+        snprintf(strtemp, sizeof(strtemp), "\\u%04x", ch);
+        m_buf.append(strtemp, 6);
+      }
+    }
+    m_buf.append(run);
+
+    m_buf.append(1, '"');
+    return;
+  }
+
+  // CSV (RFC 4180): a value containing a comma, a quote or a line break is quoted, and its quotes are doubled.
+  if (strpbrk(str, ",\"\r\n") == 0) { m_buf.append(str); return; }
+
+  m_buf.append(1, '"');
+  for (const char *pos = str; *pos != 0; pos++)
+  {
+    if (*pos == '"') m_buf.append(1, '"');
+    m_buf.append(1, *pos);
+  }
+  m_buf.append(1, '"');
+}
+
+
+rescache::rescache()
+{
+  m_bytes = m_maxbytes = 0;
+  m_hits = m_misses = m_evicts = m_lastcalls = 0;
+  pthread_mutex_init(&m_mutex, 0);
+}
+
+rescache::~rescache()
+{
+  pthread_mutex_destroy(&m_mutex);
+}
+
+// Set the maximum total size of the cached results in bytes.
+void rescache::init(const size_t maxbytes)
+{
+  m_maxbytes = maxbytes;
+}
+
+// Get the result of key, return false if it is not cached or has expired.
+bool rescache::get(const string &key, string &data, time_t *expire)
+{
+  pthread_mutex_lock(&m_mutex);
+
+  unordered_map<string, list<struct st_item>::iterator>::iterator it = m_index.find(key);
+
+  if ((it == m_index.end()) || (it->second->expire < time(0)))
+  {
+    m_misses++;
+    pthread_mutex_unlock(&m_mutex);
+    return false;
+  }
+
+  m_lru.splice(m_lru.begin(), m_lru, it->second);   // Move it to the front, it is the most recently used.
+  data = it->second->data;
+  if (expire != 0) *expire = it->second->expire;
+  m_hits++;
+
+  pthread_mutex_unlock(&m_mutex);
+
+  return true;
+}
+
+// Cache the result of key for ttl seconds.
+void rescache::put(const string &key, const string &data, const int ttl)
+{
+  if (data.size() > maxitem()) return;
+
+  pthread_mutex_lock(&m_mutex);
+
+  // Replace the expired result of the same key.
+  unordered_map<string, list<struct st_item>::iterator>::iterator it = m_index.find(key);
+  if (it != m_index.end())
+  {
+    m_bytes = m_bytes - it->second->data.size();
+    m_lru.erase(it->second);
+    m_index.erase(it);
+  }
+
+  struct st_item stitem;
+  stitem.key = key;
+  stitem.data = data;
+  stitem.expire = time(0) + ttl;
+  m_lru.push_front(stitem);
+  m_index[key] = m_lru.begin();
+  m_bytes = m_bytes + data.size();
+
+  // Evict the least recently used results until the total size is within the limit.
+  while (m_bytes > m_maxbytes)
+  {
+    m_bytes = m_bytes - m_lru.back().data.size();
+    m_index.erase(m_lru.back().key);
+    m_lru.pop_back();
+    m_evicts++;
+  }
+
+  pthread_mutex_unlock(&m_mutex);
+}
+
+// Remove the cached results of an interface, all results if intername is empty, return the number removed.
+int rescache::invalidate(const char *intername)
+{
+  int count = 0;
+  size_t len = strlen(intername);
+
+  pthread_mutex_lock(&m_mutex);
+
+  for (list<struct st_item>::iterator it = m_lru.begin(); it != m_lru.end(); )
+  {
+    // The key is the interface name followed by '\1' and the parameter values.
+    if ( (len == 0) ||
+         ((it->key.compare(0, len, intername) == 0) && ((it->key.size() == len) || (it->key[len] == '\1'))) )
+    {
+      m_bytes = m_bytes - it->data.size();
+      m_index.erase(it->key);
+      it = m_lru.erase(it);
+      count++;
+    }
+    else
+      it++;
+  }
+
+  pthread_mutex_unlock(&m_mutex);
+
+  return count;
+}
+
+// Write the hit and miss counters to the log if there have been calls since the last report.
+void rescache::report()
+{
+  pthread_mutex_lock(&m_mutex);
+
+  if (m_hits + m_misses != m_lastcalls)
+  {
+    m_lastcalls = m_hits + m_misses;
+    logfile.Write("Result cache: items=%d,bytes=%ld,hits=%ld,misses=%ld,hitratio=%.1f%%,evicts=%ld\n",
+                  (int)m_lru.size(), (long)m_bytes, m_hits, m_misses, 100.0 * m_hits / m_lastcalls, m_evicts);
+  }
+
+  pthread_mutex_unlock(&m_mutex);
+}
+
+singleflight::singleflight()
+{
+  pthread_mutex_init(&m_mutex, 0);
+  pthread_cond_init(&m_cond, 0);
+  m_leaders = m_joins = 0;
+}
+
+singleflight::~singleflight()
+{
+  pthread_mutex_destroy(&m_mutex);
+  pthread_cond_destroy(&m_cond);
+}
+
+// Join the query of key in flight, or start a new one. bleader returns true if the caller is the leader.
+shared_ptr<struct st_flight> singleflight::join(const string &key, bool &bleader)
+{
+  pthread_mutex_lock(&m_mutex);
+
+  shared_ptr<struct st_flight> &flight = m_flights[key];
+  if (flight == 0)
+  {
+    flight = make_shared<struct st_flight>();
+    flight->bdone = flight->bok = false;
+    flight->rows = 0;
+    bleader = true; m_leaders++;
+  }
+  else
+  {
+    bleader = false; m_joins++;
+  }
+
+  shared_ptr<struct st_flight> ret = flight;
+
+  pthread_mutex_unlock(&m_mutex);
+
+  return ret;
+}
+
+// Wait for the leader of the flight, return true if its response body can be sent.
+bool singleflight::wait(const string &key, const shared_ptr<struct st_flight> &flight)
+{
+  struct timespec abstime;
+  clock_gettime(CLOCK_REALTIME, &abstime);
+  abstime.tv_sec = abstime.tv_sec + FLIGHTTIMEOUT;
+
+  // A thread cancelled in pthread_cond_timedwait() would leave m_mutex locked for ever.
+  int oldstate;
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+
+  pthread_mutex_lock(&m_mutex);
+
+  while (flight->bdone == false)
+  {
+    if (pthread_cond_timedwait(&m_cond, &m_mutex, &abstime) == ETIMEDOUT) break;
+  }
+
+  // The leader is hung or has been cancelled, the next requests of the key must not wait for it.
+  if (flight->bdone == false)
+  {
+    unordered_map<string, shared_ptr<struct st_flight> >::iterator it = m_flights.find(key);
+    if ((it != m_flights.end()) && (it->second == flight)) m_flights.erase(it);
+    logfile.Write("The query of %s in flight timed out.\n", key.substr(0, key.find('\1')).c_str());
+  }
+
+  bool bok = flight->bok;
+
+  pthread_mutex_unlock(&m_mutex);
+
+  pthread_setcancelstate(oldstate, NULL);
+
+  return bok;
+}
+
+// The leader has finished, data is moved into the flight.
+void singleflight::done(const string &key, const shared_ptr<struct st_flight> &flight, const bool bok, string &data, const long rows)
+{
+  pthread_mutex_lock(&m_mutex);
+
+  flight->bdone = true;
+  flight->bok = bok;
+  if (bok == true) { flight->data.swap(data); flight->rows = rows; }
+
+  // The later requests of the key start a new query.
+  unordered_map<string, shared_ptr<struct st_flight> >::iterator it = m_flights.find(key);
+  if ((it != m_flights.end()) && (it->second == flight)) m_flights.erase(it);
+
+  pthread_mutex_unlock(&m_mutex);
+
+  pthread_cond_broadcast(&m_cond);
+}
+
+// Write the counters to the log if there have been queries since the last report.
+void singleflight::report()
+{
+  pthread_mutex_lock(&m_mutex);
+
+  if (m_joins > 0)
+    logfile.Write("Single-flight: queries=%ld,shared=%ld,inflight=%d\n", m_leaders, m_joins, (int)m_flights.size());
+
+  m_leaders = m_joins = 0;
+
+  pthread_mutex_unlock(&m_mutex);
+}
+
+// Choose the content encoding of the response from Accept-Encoding of the request, ENC_IDENTITY if none is accepted.
+// "Accept-Encoding: gzip, deflate, br" or with weights, "Accept-Encoding: gzip;q=0, deflate;q=0.5", q=0 refuses an encoding.
+int AcceptEncoding(const char *buffer)
+{
+  const char *pos = strcasestr(buffer, "\r\nAccept-Encoding:");
+  if (pos == 0) return ENC_IDENTITY;
+  pos = pos + 18;
+
+  const char *end = strstr(pos, "\r\n");   // The request message ends with an empty line, there is always one.
+  if (end == 0) return ENC_IDENTITY;
+
+  bool bgzip = false, bdeflate = false;
+#ifdef WITH_ZSTD
+  bool bzstd = false;
+#endif
+
+  while (pos < end)
+  {
+    while ((pos < end) && ((*pos == ' ') || (*pos == ','))) pos++;
+
+    // The name of the encoding.
+    const char *name = pos;
+    while ((pos < end) && (*pos != ',') && (*pos != ';') && (*pos != ' ')) pos++;
+    int namelen = pos - name;
+
+    // The weight of the encoding, 1 if it is not given.
+    double q = 1;
+    while ((pos < end) && (*pos != ','))
+    {
+      if ((strncmp(pos, "q=", 2) == 0) && (pos + 2 < end)) q = atof(pos + 2);
+      pos++;
+    }
+    if (q <= 0) continue;
+
+    if ((namelen == 4) && (strncasecmp(name, "gzip", 4) == 0)) bgzip = true;
+    if ((namelen == 7) && (strncasecmp(name, "deflate", 7) == 0)) bdeflate = true;
+#ifdef WITH_ZSTD
+    if ((namelen == 4) && (strncasecmp(name, "zstd", 4) == 0)) bzstd = true;
+#endif
+    if ((namelen == 1) && (*name == '*')) bgzip = true;
+  }
+
+#ifdef WITH_ZSTD
+  if (bzstd == true) return ENC_ZSTD;    // Faster than gzip at a better ratio.
+#endif
+  if (bgzip == true) return ENC_GZIP;
+  if (bdeflate == true) return ENC_DEFLATE;
+
+  return ENC_IDENTITY;
+}
+
+encoder::encoder(const int level)
+{
+  m_level = level;
+  m_encoding = ENC_IDENTITY;
+  memset(m_zs, 0, sizeof(m_zs));
+  m_zinit[0] = m_zinit[1] = false;
+#ifdef WITH_ZSTD
+  m_zcctx = 0;
+#endif
+}
+
+encoder::~encoder()
+{
+  for (int ii = 0; ii < 2; ii++)
+  {
+    if (m_zinit[ii] == true) deflateEnd(&m_zs[ii]);
+  }
+#ifdef WITH_ZSTD
+  if (m_zcctx != 0) ZSTD_freeCCtx(m_zcctx);
+#endif
+}
+
+// Start a new body in the encoding, return false if the compression state cannot be created.
+bool encoder::start(const int encoding)
+{
+  m_encoding = encoding;
+  m_out.clear();
+
+  if ((encoding == ENC_GZIP) || (encoding == ENC_DEFLATE))
+  {
+    // The window bits of gzip are 15+16, those of deflate (the zlib format in HTTP) are 15.
+    int ii = (encoding == ENC_GZIP) ? 0 : 1;
+    if (m_zinit[ii] == true) return deflateReset(&m_zs[ii]) == Z_OK;
+
+    if (deflateInit2(&m_zs[ii], m_level, Z_DEFLATED, (encoding == ENC_GZIP) ? 31 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+    m_zinit[ii] = true;
+    return true;
+  }
+
+#ifdef WITH_ZSTD
+  if (encoding == ENC_ZSTD)
+  {
+    if (m_zcctx != 0) return ZSTD_isError(ZSTD_CCtx_reset(m_zcctx, ZSTD_reset_session_only)) == 0;
+
+    if ((m_zcctx = ZSTD_createCCtx()) == 0) return false;
+    ZSTD_CCtx_setParameter(m_zcctx, ZSTD_c_compressionLevel, m_level);
+    return true;
+  }
+#endif
+
+  return false;
+}
+
+// Compress a piece of the body and append the output to m_out, bfinish=true for the last piece.
+bool encoder::compress(const char *data, const size_t len, const bool bfinish)
+{
+  if ((m_encoding == ENC_GZIP) || (m_encoding == ENC_DEFLATE))
+  {
+    z_stream &zs = m_zs[(m_encoding == ENC_GZIP) ? 0 : 1];
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = len;
+
+    // Until the compressor has taken all the input, and has written all its output if it is the last piece.
+    do
+    {
+      size_t pos = m_out.size();
+      m_out.resize(pos + 16384);
+      zs.next_out = (Bytef *)&m_out[pos];
+      zs.avail_out = 16384;
+
+      if (deflate(&zs, (bfinish == true) ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR) return false;
+
+      m_out.resize(pos + 16384 - zs.avail_out);
+    } while (zs.avail_out == 0);
+
+    return true;
+  }
+
+#ifdef WITH_ZSTD
+  if (m_encoding == ENC_ZSTD)
+  {
+    ZSTD_inBuffer in = { data, len, 0 };
+
+    while (true)
+    {
+      size_t pos = m_out.size();
+      m_out.resize(pos + 16384);
+      ZSTD_outBuffer out = { &m_out[pos], 16384, 0 };
+
+      size_t remaining = ZSTD_compressStream2(m_zcctx, &out, &in, (bfinish == true) ? ZSTD_e_end : ZSTD_e_continue);
+      if (ZSTD_isError(remaining)) return false;
+
+      m_out.resize(pos + out.pos);
+
+      if ((bfinish == true) && (remaining == 0)) break;   // The frame is complete.
+      if ((bfinish == false) && (in.pos == in.size)) break;
+    }
+
+    return true;
+  }
+#endif
+
+  return false;
+}
+
+// Compress a whole body in the encoding at CACHELEVEL, for the precompressed copies of the cached results.
+bool CompressAll(const int encoding, const string &data, string &out)
+{
+  encoder enc(CACHELEVEL);
+
+  if (enc.start(encoding) == false) return false;
+  if (enc.compress(data.data(), data.size(), true) == false) return false;
+
+  out.swap(enc.m_out);
+
+  return true;
+}
+
+connpool::connpool()
+{
+  m_minconns = m_maxconns = 0;
+  m_timeout = m_waitms = 0;
+  memset(m_connstr,0,sizeof(m_connstr));
+  memset(m_charset,0,sizeof(m_charset));
+  m_conns=0;
+  m_head = 0;
+  m_connected = m_inuse = m_peak = 0;
+  m_waiting = 0;
+  memset(m_name,0,sizeof(m_name));
+  m_gets = m_waits = m_waitus = m_maxwaitus = m_timeouts = 0;
+  m_prepares = m_reuses = m_lastcalls = 0;
+  pthread_mutex_init(&m_statmutex, 0);
+}
+
+// Initialize the database connection pool, and return false if there is an issue with the database connection parameters.
+bool connpool::init(const char *connstr, const char *charset, const int minconns, const int maxconns, const int timeout, const int waitms,
+                    const bool bcheck)
+{
+  // Try connecting to the database to validate the database connection parameters.
+  if (bcheck == true)
+  {
+    connection conn;
+    if (conn.connecttodb(connstr, charset) != 0)
+    {
+      printf("Failed to connect to the database.\n%s\n", conn.m_cda.message);
+      return false;
+    }
+    conn.disconnect();
+  }
+
+  // The name in the log is the part after '@', the password is not written to the log.
+  const char *at = strchr(connstr, '@');
+  strncpy(m_name, (at == 0) ? connstr : at + 1, 100);
+
+  strncpy(m_connstr, connstr, 100);
   strncpy(m_charset, charset, 100);
   m_maxconns = maxconns;
+  m_minconns = (minconns < maxconns) ? minconns : maxconns;
   m_timeout = timeout;
+  m_waitms = waitms;
+
+  // Allocate memory space for the database connection pool.
+  m_conns = new struct st_conn[m_maxconns];
+
+  sem_init(&m_sem, 0, 0);
+
+  // All the slots are free and not connected, slot 0 is at the top of the stack.
+  for (int ii = m_maxconns - 1; ii >= 0; ii--)
+  {
+    m_conns[ii].atime = 0;
+    push(ii);
+  }
+
+  return true;
+}
+
+
+connpool::~connpool()
+{
+  destroy();
+}
+
+// Disconnect the database connections, and release the connection pool.
+void connpool::destroy()
+{
+  if (m_conns == 0) return;
+
+  for (int ii = 0; ii < m_maxconns; ii++)
+  {
+    if (m_conns[ii].atime > 0) disconnect(ii);
+  }
+
+  delete[] m_conns;         // Release the memory space of the database connection pool.
+  m_conns = 0;
+  sem_destroy(&m_sem);
+
+  memset(m_connstr, 0, sizeof(m_connstr));
+  memset(m_charset, 0, sizeof(m_charset));
+  m_minconns = m_maxconns = 0;
+  m_timeout = m_waitms = 0;
+}
+
+// Push a slot to the free stack.
+void connpool::push(const int pos)
+{
+  unsigned long oldhead = m_head.load();
+  unsigned long newhead;
+
+  do
+  {
+    m_conns[pos].next.store((int)(oldhead & 0xFFFFFFFF) - 1, memory_order_relaxed);
+    newhead = (((oldhead >> 32) + 1) << 32) | (unsigned long)(pos + 1);
+  } while (m_head.compare_exchange_weak(oldhead, newhead) == false);
+
+  sem_post(&m_sem);   // The slot is counted after it is in the stack, so pop() always finds one.
+}
+
+// Pop a slot from the free stack, it must be called after the semaphore has been decremented.
+int connpool::pop()
+{
+  unsigned long oldhead = m_head.load();
+  unsigned long newhead;
+  int pos;
+
+  do
+  {
+    pos = (int)(oldhead & 0xFFFFFFFF) - 1;
+    newhead = (((oldhead >> 32) + 1) << 32) | (unsigned long)(m_conns[pos].next.load(memory_order_relaxed) + 1);
+  } while (m_head.compare_exchange_weak(oldhead, newhead) == false);
+
+  return pos;
+}
+
+// Number of the slot of a connection.
+int connpool::slot(connection *conn)
+{
+  for (int ii = 0; ii < m_maxconns; ii++)
+  {
+    if (&m_conns[ii].conn == conn) return ii;
+  }
+
+  return -1;
+}
+
+// Connect a slot to the database.
+bool connpool::connect(const int pos)
+{
+  if (m_conns[pos].conn.connecttodb(m_connstr, m_charset) != 0)
+  {
+    logfile.Write("Failed to connect to the database.\n%s\n", m_conns[pos].conn.m_cda.message);
+    return false;
+  }
+
+  m_conns[pos].atime = time(0);
+  m_connected++;
+
+  return true;
+}
+
+// Disconnect a slot from the database.
+void connpool::disconnect(const int pos)
+{
+  clearstmt(m_conns[pos]);            // Release the prepared statements.
+  m_conns[pos].conn.disconnect();     // Disconnect the database connection.
+  m_conns[pos].atime = 0;             // Reset the database connection's usage time.
+  m_connected--;
+}
+
+// 1) Take a free slot from the stack, if there is none, wait until one is returned or waitms milliseconds have passed.
+// 2) If the slot is connected, return its connection. The slots at the top of the stack are the connected ones.
+// 3) Otherwise connect it to the database, if it fails, put the slot back and return NULL.
+connection *connpool::get()
+{
+  m_gets++;
+
+  if (sem_trywait(&m_sem) != 0)
+  {
+    // All the connections are in use, wait for one.
+    CTimer timer;
+
+    struct timespec abstime;
+    clock_gettime(CLOCK_REALTIME, &abstime);
+    abstime.tv_sec = abstime.tv_sec + m_waitms / 1000;
+    abstime.tv_nsec = abstime.tv_nsec + (long)(m_waitms % 1000) * 1000000;
+    if (abstime.tv_nsec >= 1000000000) { abstime.tv_sec++; abstime.tv_nsec = abstime.tv_nsec - 1000000000; }
+
+    int iret;
+    m_waiting++;
+    while (((iret = sem_timedwait(&m_sem, &abstime)) != 0) && (errno == EINTR));
+    m_waiting--;
+
+    long waitus = (long)(timer.Elapsed() * 1000000);
+    m_waits++;
+    m_waitus += waitus;
+    long maxwaitus = m_maxwaitus.load();
+    while ((waitus > maxwaitus) && (m_maxwaitus.compare_exchange_weak(maxwaitus, waitus) == false));
+
+    if (iret != 0)
+    {
+      m_timeouts++;
+      logfile.Write("No free database connection of %s in %d milliseconds.\n", m_name, m_waitms);
+      return NULL;
+    }
+  }
+
+  int pos = pop();
+
+  int inuse = ++m_inuse;
+  int peak = m_peak.load();
+  while ((inuse > peak) && (m_peak.compare_exchange_weak(peak, inuse) == false));
+
+  // The slot belongs to this thread now, it is connected without any lock.
+  if ((m_conns[pos].atime == 0) && (connect(pos) == false))
+  {
+    m_inuse--;
+    push(pos);
+    return NULL;
+  }
+
+  m_conns[pos].atime = time(0);    // Set the database connection's usage time to the current time.
+
+  return &m_conns[pos].conn;
+}
+
+
+// Return the database connection to the pool.
+bool connpool::free(connection *conn)
+{
+  int pos = slot(conn);
+  if (pos < 0) return false;
+
+  m_conns[pos].atime = time(0);      // Set the database connection's usage time to the current time.
+  m_inuse--;
+  push(pos);
+
+  return true;
+}
+
+// Check the free connections of the pool: connect up to minconns connections, disconnect the idle ones above minconns and the faulty ones.
+// The connections in use are not touched, they are checked when they are free at the next time.
+void connpool::checkpool()
+{
+  // Take all the free slots out of the stack, from the top to the bottom.
+  vector<int> vpos;
+  while (sem_trywait(&m_sem) == 0) vpos.push_back(pop());
+
+  // Put back the slots that are not connected and not needed for minconns first, so they stay below the connected ones.
+  // The slots are put back from the bottom to the top, to keep their order.
+  vector<int> vwarm, vcheck;
+  int towarm = m_minconns - m_connected;
+  for (int ii = vpos.size() - 1; ii >= 0; ii--)
+  {
+    if (m_conns[vpos[ii]].atime > 0) { vcheck.push_back(vpos[ii]); continue; }
+    if (towarm > 0) { vwarm.push_back(vpos[ii]); towarm--; continue; }
+    push(vpos[ii]);
+  }
+
+  // Warm-up: connect the pool up to minconns connections, so the requests do not wait for connecting.
+  for (int ii = 0; ii < vwarm.size(); ii++)
+  {
+    connect(vwarm[ii]);
+    push(vwarm[ii]);
+  }
+
+  // Check the connected slots, each one is put back as soon as it has been checked.
+  for (int ii = 0; ii < vcheck.size(); ii++)
+  {
+    int pos = vcheck[ii];
+
+    if ( ((time(0) - m_conns[pos].atime) > m_timeout) && (m_connected > m_minconns) )
+    {
+      logfile.Write("Connection %d has been idle for %d seconds, disconnected.\n", pos, (int)(time(0) - m_conns[pos].atime));
+      disconnect(pos);
+    }
+    else
+    {
+      // Execute a test SQL to verify if the connection is valid. If it's invalid, disconnect it.
+      // If the network is disconnected or the database is restarted, we just need to disconnect the connection,
+      // the reconnection is handled by the next checkpool() or get().
+      if (m_conns[pos].conn.execute("select * from dual") != 0)
+      {
+        logfile.Write("Connection %d is faulty, disconnected.\n", pos);
+        disconnect(pos);
+      }
+    }
+
+    push(pos);
+  }
+}
+
+
+// Get the prepared statement of the interface on a connection obtained with get(), prepare it if needed.
+struct connpool::st_stmt *connpool::getstmt(connection *conn, const struct st_intercfg *inter, const int page)
+{
+  int pos = slot(conn);
+
+  const string &selectsql = (page == PAGE_NEXT) ? inter->pagesql : (page == PAGE_FIRST) ? inter->firstsql : inter->selectsql;
+  int nbindin = inter->vbindin.size() + ((page == PAGE_NEXT) ? 2 : (page == PAGE_FIRST) ? 1 : 0);
+
+  // The connection belongs to the caller until free(), so its statements need no other lock.
+  // The statements of the pages are kept apart from the statement of the whole result.
+  const char *suffix[] = { "", "\1first", "\1page" };
+  struct st_stmt *&pstmt = m_conns[pos].mstmts[inter->intername + suffix[page]];
+
+  // The statement is reused if the SQL and the columns of the interface are the same as when it was prepared.
+  if ((pstmt != 0) && (pstmt->selectsql == selectsql) &&
+      (pstmt->invalue.size() == nbindin * 101) && (pstmt->colvalue.size() == inter->vcols.size() * 2001))
+  {
+    pthread_mutex_lock(&m_statmutex); m_reuses++; pthread_mutex_unlock(&m_statmutex);
+    return pstmt;
+  }
+
+  // Prepare the statement for the first time, or again because the interface has been changed.
+  delete pstmt;
+  pstmt = new struct st_stmt;
+
+  pstmt->stmt.connect(conn);
+  pstmt->invalue.resize(nbindin * 101);
+  pstmt->colvalue.resize(inter->vcols.size() * 2001);
+
+  // If it fails, the error is returned by execute(), and the statement will be prepared again by the next request.
+  if (pstmt->stmt.prepare(selectsql.c_str()) == 0) pstmt->selectsql = selectsql;
+
+  // Bind the input parameters of the SQL statement.
+  for (int ii = 0; ii < nbindin; ii++)
+  {
+    pstmt->stmt.bindin(ii + 1, &pstmt->invalue[ii * 101], 100);
+  }
+
+  // Based on the column names in the interface configuration (colstr field), bind the result set.
+  for (int ii = 0; ii < inter->vcols.size(); ii++)
+  {
+    pstmt->stmt.bindout(ii + 1, &pstmt->colvalue[ii * 2001], 2000);
+  }
+
+  pthread_mutex_lock(&m_statmutex); m_prepares++; pthread_mutex_unlock(&m_statmutex);
+
+  return pstmt;
+}
+
+// Release the prepared statements of a connection, it must be done before the connection is disconnected.
+void connpool::clearstmt(struct st_conn &conn)
+{
+  for (unordered_map<string, struct st_stmt *>::iterator it = conn.mstmts.begin(); it != conn.mstmts.end(); ++it)
+  {
+    delete it->second;
+  }
+
+  conn.mstmts.clear();
+}
+
+// Write the usage, the waits and the prepare and reuse counters to the log if there have been calls since the last report.
+void connpool::report()
+{
+  // The counters of the pool are for the interval since the last report.
+  long gets = m_gets.exchange(0);
+  if (gets > 0)
+  {
+    long waits = m_waits.exchange(0);
+    long waitus = m_waitus.exchange(0);
+    long maxwaitus = m_maxwaitus.exchange(0);
+    long timeouts = m_timeouts.exchange(0);
+    int inuse = m_inuse.load();
+    int peak = m_peak.exchange(inuse);
+
+    logfile.Write("Connection pool %s: connected=%d,inuse=%d,peak=%d,max=%d,utilization=%.1f%%,"\
+                  "gets=%ld,waits=%ld,avgwait=%.3fms,maxwait=%.3fms,timeouts=%ld\n",
+                  m_name, m_connected.load(), inuse, peak, m_maxconns, 100.0 * peak / m_maxconns,
+                  gets, waits, (waits == 0) ? 0 : waitus / 1000.0 / waits, maxwaitus / 1000.0, timeouts);
+  }
+
+  pthread_mutex_lock(&m_statmutex);
+
+  if (m_prepares + m_reuses != m_lastcalls)
+  {
+    m_lastcalls = m_prepares + m_reuses;
+    logfile.Write("Prepared statements: prepares=%ld,reuses=%ld,hitratio=%.1f%%\n",
+                  m_prepares, m_reuses, 100.0 * m_reuses / m_lastcalls);
+  }
+
+  pthread_mutex_unlock(&m_statmutex);
+}
+
+// Load the parameter tables into a new snapshot and replace the current one, return false if failed, the current one is kept.
+bool LoadParamCfg()
+{
+  static int maxindex = 0;   // Number for the next new interface, only this function uses it, from one thread at a time.
+  static int maxuserindex = 0;   // Number for the next new user.
+
+  connection *conn = oraconnpool.get();
+  if (conn == 0)
+  {
+    logfile.Write("LoadParamCfg() failed, no database connection.\n");
+    return false;
+  }
+
+  shared_ptr<const struct st_paramcfg> oldcfg = atomic_load(&paramcfg);
+  shared_ptr<struct st_paramcfg> cfg = make_shared<struct st_paramcfg>();
+
+  char str1[1001], str2[301], str3[301], str4[31];
+  int cachesecs;
+
+  // Valid users.
+  sqlstatement stmt;
+  stmt.connect(conn);
+  double ratelimit;
+  int burst, weight;
+  stmt.prepare("select username, passwd, nvl(ratelimit, 0), nvl(burst, 0), nvl(weight, 1) from T_USERINFO where rsts=1");
+  stmt.bindout(1, str1, 30);
+  stmt.bindout(2, str2, 30);
+  stmt.bindout(3, &ratelimit);
+  stmt.bindout(4, &burst);
+  stmt.bindout(5, &weight);
+  if (stmt.execute() != 0)
+  {
+    logfile.Write("LoadParamCfg() failed.\n%s\n%s\n", stmt.m_sql, stmt.m_cda.message);
+    oraconnpool.free(conn);
+    return false;
+  }
+  while (true)
+  {
+    memset(str1, 0, sizeof(str1)); memset(str2, 0, sizeof(str2));
+    ratelimit = 0; burst = 0; weight = 1;
+    if (stmt.next() != 0) break;
+    struct st_usercfg &user = cfg->musers[str1];
+    user.username = str1;
+    user.passwd = str2;
+
+    // Without burst, the user can send the requests of one second at once.
+    user.ratelimit = (ratelimit > 0) ? ratelimit : 0;
+    user.burst = (burst > 0) ? burst : (int)ceil(user.ratelimit);
+    if (user.burst < 1) user.burst = 1;
+    user.weight = (weight > 0) ? weight : 1;
+
+    // A user keeps its number across reloads, a new user gets a new number.
+    unordered_map<string, struct st_usercfg>::const_iterator it;
+    if ((oldcfg != 0) && ((it = oldcfg->musers.find(str1)) != oldcfg->musers.end()))
+      user.index = it->second.index;
+    else
+      user.index = maxuserindex++;
+  }
+
+  // Valid interfaces.
+  char pagekey[31];
+  stmt.prepare("select intername, selectsql, colstr, bindin, cachesecs, pagekey from T_INTERCFG where rsts=1");
+  stmt.bindout(1, str4, 30);
+  stmt.bindout(2, str1, 1000);
+  stmt.bindout(3, str2, 300);
+  stmt.bindout(4, str3, 300);
+  stmt.bindout(5, &cachesecs);
+  stmt.bindout(6, pagekey, 30);
+  if (stmt.execute() != 0)
+  {
+    logfile.Write("LoadParamCfg() failed.\n%s\n%s\n", stmt.m_sql, stmt.m_cda.message);
+    oraconnpool.free(conn);
+    return false;
+  }
+  CCmdStr CmdStr;
+  while (true)
+  {
+    memset(str1, 0, sizeof(str1)); memset(str2, 0, sizeof(str2));
+    memset(str3, 0, sizeof(str3)); memset(str4, 0, sizeof(str4));
+    memset(pagekey, 0, sizeof(pagekey));
+    cachesecs = 0;
+    if (stmt.next() != 0) break;
+
+    struct st_intercfg &inter = cfg->minters[str4];
+    inter.intername = str4;
+    inter.selectsql = str1;
+    CmdStr.SplitToCmd(str2, ",", true);     // The names may be separated by ", ".
+    inter.vcols = CmdStr.m_vCmdStr;
+    if (strlen(str3) > 0)
+    {
+      CmdStr.SplitToCmd(str3, ",", true);
+      inter.vbindin = CmdStr.m_vCmdStr;
+    }
+    inter.cachesecs = cachesecs;
+
+    // Keyset pagination: the next page starts after the pagekey of the last row of this page, so a page
+    // costs the same however deep it is, unlike offset. pagekey must be one of the columns, unique and increasing.
+    DeleteLRChar(pagekey, ' ');
+    if (strlen(pagekey) > 0)
+    {
+      inter.pagecol = -1;
+      for (int ii = 0; ii < inter.vcols.size(); ii++)
+      {
+        if (strcasecmp(inter.vcols[ii].c_str(), pagekey) == 0) inter.pagecol = ii;
+      }
+
+      if (inter.pagecol == -1)
+        logfile.Write("The pagekey %s of %s is not in colstr, the interface cannot be paged.\n", pagekey, str4);
+      else
+      {
+        char strpagesql[2001];
+        snprintf(strpagesql, sizeof(strpagesql),
+                 "select * from (select * from (%s) where %s>:%d order by %s) where rownum<=:%d",
+                 str1, pagekey, (int)inter.vbindin.size() + 1, pagekey, (int)inter.vbindin.size() + 2);
+        inter.pagekey = pagekey;
+        inter.pagesql = strpagesql;
+
+        snprintf(strpagesql, sizeof(strpagesql),
+                 "select * from (select * from (%s) order by %s) where rownum<=:%d",
+                 str1, pagekey, (int)inter.vbindin.size() + 1);
+        inter.firstsql = strpagesql;
+      }
+    }
+
+    // An interface keeps its number across reloads, a new interface gets a new number.
+    unordered_map<string, struct st_intercfg>::const_iterator it;
+    if ((oldcfg != 0) && ((it = oldcfg->minters.find(str4)) != oldcfg->minters.end()))
+      inter.index = it->second.index;
+    else
+      inter.index = maxindex++;
+  }
+
+  // Permissions of the users.
+  stmt.prepare("select username, intername from T_USERANDINTER");
+  stmt.bindout(1, str1, 30);
+  stmt.bindout(2, str2, 30);
+  if (stmt.execute() != 0)
+  {
+    logfile.Write("LoadParamCfg() failed.\n%s\n%s\n", stmt.m_sql, stmt.m_cda.message);
+    oraconnpool.free(conn);
+    return false;
+  }
+  while (true)
+  {
+    memset(str1, 0, sizeof(str1)); memset(str2, 0, sizeof(str2));
+    if (stmt.next() != 0) break;
+    cfg->mperms.insert(string(str1) + '\1' + str2);
+  }
+
+  oraconnpool.free(conn);
+
+  atomic_store(&paramcfg, shared_ptr<const struct st_paramcfg>(cfg));
+
+  logfile.Write("Parameter tables loaded, users=%d,interfaces=%d,permissions=%d.\n",
+                (int)cfg->musers.size(), (int)cfg->minters.size(), (int)cfg->mperms.size());
+
+  return true;
+}
+
+void *refreshmain(void *arg)    // Thread function to reload the parameter tables.
+{
+  while (true)
+  {
+    sleep(starg.refreshsecs);
+    LoadParamCfg();
+  }
+}
+
+void *checkpool(void *arg)    // Thread function to check the database connection pool.
+{
+  while (true)
+  {
+    oraconnpool.checkpool();
+    for (int ii = 0; ii < vreplicas.size(); ii++) vreplicas[ii]->pool.checkpool();
+    CheckReplicas();
+    sleep(30);
+  }
+}
+
+// Get a connection for the query of an interface from the available replica with the fewest requests in progress,
+// or from the primary if there is none. pool returns the pool of the connection.
+connection *GetReadConn(connpool *&pool)
+{
+  // The search starts at a different replica each time, so the replicas share the load when they are equally busy.
+  static atomic<unsigned int> start(0);
+  int count = vreplicas.size();
+  int first = (count == 0) ? 0 : (start++) % count;
+
+  struct st_replica *best = 0;
+  int bestload = 0;
+  for (int ii = 0; ii < count; ii++)
+  {
+    struct st_replica *replica = vreplicas[(first + ii) % count];
+    if (replica->bavailable == false) continue;
+
+    int load = replica->pool.outstanding();
+    if ((best == 0) || (load < bestload)) { best = replica; bestload = load; }
+  }
+
+  if (best != 0)
+  {
+    connection *conn = best->pool.get();
+    if (conn != 0) { pool = &best->pool; return conn; }
+
+    // No connection of the replica could be made, it is down, CheckReplicas() puts it back when it is up.
+    // If only its connections are all busy, the query goes to the primary this time.
+    if ((best->pool.connected() == 0) && (best->bavailable.exchange(false) == true))
+      logfile.Write("Replica %s is not available, it cannot be connected.\n", best->pool.m_name);
+  }
+
+  pool = &oraconnpool;
+  return oraconnpool.get();
+}
+
+// Run lagsql on a connection, return false if failed.
+bool QueryLag(connection *conn, double &value)
+{
+  sqlstatement stmt(conn);
+  stmt.prepare(starg.lagsql);
+  stmt.bindout(1, &value);
+  if ((stmt.execute() != 0) || (stmt.next() != 0))
+  {
+    logfile.Write("QueryLag() failed.\n%s\n%s\n", stmt.m_sql, stmt.m_cda.message);
+    return false;
+  }
+
+  return true;
+}
+
+// Measure the lag of the replicas and take them out of use or put them back.
+void CheckReplicas()
+{
+  if (vreplicas.size() == 0) return;
+
+  // The value of lagsql on the primary, the replicas are compared with it.
+  double primary = 0;
+  bool bprimary = false;
+  if (strlen(starg.lagsql) > 0)
+  {
+    connection *conn = oraconnpool.get();
+    if (conn != 0)
+    {
+      bprimary = QueryLag(conn, primary);
+      oraconnpool.free(conn);
+    }
+  }
+
+  for (int ii = 0; ii < vreplicas.size(); ii++)
+  {
+    struct st_replica *replica = vreplicas[ii];
+    bool bavailable = false;
+
+    connection *conn = replica->pool.get();
+    if (conn != 0)
+    {
+      bavailable = true;
+
+      // If the lag cannot be measured on the primary, the replicas are used as they are.
+      double value = 0;
+      if (bprimary == true)
+      {
+        if (QueryLag(conn, value) == false) bavailable = false;
+        else
+        {
+          replica->lag = primary - value;
+          if (replica->lag > starg.maxlag) bavailable = false;
+        }
+      }
+
+      replica->pool.free(conn);
+    }
+
+    if ((bavailable != replica->bavailable.exchange(bavailable)) || (replica->bchecked == false))
+      logfile.Write("Replica %s is %s, lag=%.0f.\n", replica->pool.m_name, (bavailable == true) ? "available" : "not available", replica->lag);
+    replica->bchecked = true;
+  }
+}
+
+void *checkthmain(void *arg)    // Main function for the monitoring thread.
+{
+  while (true)
+  {
+    // Write the long requests to the log. A worker thread is never cancelled in the middle of a request, a slow
+    // client is bounded by SENDTIMEOUT, but a thread waiting for a hung database call is only reported here.
+    pthread_spin_lock(&spin);
+    for (int ii = 0; ii < vthid.size(); ii++)
+    {
+      if ((vthid[ii].brun == true) && (vthid[ii].bbusy == true) && ((time(0) - vthid[ii].atime) > 25))
+      {
+        logfile.Write("Thread %d(%lu) has been processing a client for %d seconds.\n", ii, vthid[ii].pthid, time(0) - vthid[ii].atime);
+        vthid[ii].atime = time(0);
+      }
+    }
+    int count = nthreads;
+    pthread_spin_unlock(&spin);
+
+    // Keep at least minthreads worker threads.
+    for (; count < starg.minthreads; count++)
+    {
+      if (StartThread() == false) break;
+    }
+
+    sleep(3);
+  }
+}
+
+// Start a worker thread in a free slot, return false if maxthreads threads are running or pthread_create() failed.
+bool StartThread()
+{
+  pthread_spin_lock(&spin);
+
+  int pos = -1;
+  for (int ii = 0; (ii < vthid.size()) && (pos == -1); ii++)
+  {
+    if (vthid[ii].brun == false) pos = ii;
+  }
+
+  if (pos == -1)
+  {
+    pthread_spin_unlock(&spin); return false;
+  }
+
+  // The accumulator of the metrics of the slot is created for the first thread in the slot and kept for the next ones.
+  if (vmetrics[pos] == 0) vmetrics[pos] = new struct st_metrics();
+
+  vthid[pos].atime = time(0); // Set the activity time of the thread to the current time.
+  vthid[pos].bbusy = false;
+  if (pthread_create(&vthid[pos].pthid, NULL, thmain, (void *)(long)pos) != 0)
+  {
+    pthread_spin_unlock(&spin);
+    logfile.Write("pthread_create() failed.\n"); return false;
+  }
+  vthid[pos].brun = true;
+  nthreads++;
+
+  pthread_spin_unlock(&spin);
+
+  return true;
+}
+
+// Answer a request with 503 and close the connection, when too many requests are waiting for the worker threads.
+void ShedClient(const int sockfd)
+{
+  const char *strresponse = "HTTP/1.1 503 Service Unavailable\r\n"\
+                            "Server: webserver\r\n"\
+                            "Content-Type: text/html;charset=utf-8\r\n"\
+                            "Content-Length: 59\r\n"\
+                            "Retry-After: 1\r\n"\
+                            "Connection: close\r\n\r\n"\
+                            "<retcode>-1</retcode><message>Server is too busy.</message>";
+
+  // The main thread must not block, the response is small enough for the empty send buffer of the socket.
+  send(sockfd, strresponse, strlen(strresponse), MSG_DONTWAIT | MSG_NOSIGNAL);
+
+  shedcount++;
+  CloseClient(sockfd);
+}
+
+// Find the user of the request for the fair queue and take a token from the bucket of the user.
+bool Admit(const int sockfd, int &flow, int &weight)
+{
+  flow = -1; weight = 1;
+
+  struct st_params params;
+  ParseParams(clientrbuf[sockfd].c_str(), params);
 
-  // Allocate memory space for the database connection pool.
-  m_conns = new struct st_conn[m_maxconns];
+  char username[31], passwd[31];
+  getvalue(params, "username", username, 30);
+  getvalue(params, "passwd", passwd, 30);
 
-  for (int ii = 0; ii < m_maxconns; ii++)
+  // Only a valid user has a queue and a bucket, otherwise the name of another user could use up its tokens.
+  shared_ptr<const struct st_paramcfg> cfg = atomic_load(&paramcfg);
+  unordered_map<string, struct st_usercfg>::const_iterator it = cfg->musers.find(username);
+  if ((it == cfg->musers.end()) || (it->second.passwd != passwd)) return true;
+
+  const struct st_usercfg &user = it->second;
+  if (user.index >= MAXUSERS) return true;
+
+  flow = user.index;
+  weight = user.weight;
+
+  if (user.ratelimit <= 0) return true;
+
+  // Add the tokens of the time since the last request, the bucket is full at the first request.
+  pthread_mutex_lock(&bucketmutex);
+  struct st_bucket &bucket = buckets[user.index];
+  long now = MonoUs();
+  if (bucket.lastus == 0) bucket.tokens = user.burst;
+  else bucket.tokens = min((double)user.burst, bucket.tokens + user.ratelimit * (now - bucket.lastus) / 1000000);
+  bucket.lastus = now;
+
+  if (bucket.tokens < 1)
   {
-    pthread_mutex_init(&m_conns[ii].mutex, 0);    // Initialize locks.
-    m_conns[ii].atime = 0;                       // Initialize the last usage time of the database connection to 0.
+    pthread_mutex_unlock(&bucketmutex);
+    userthrottled[user.index]++;
+    return false;
   }
 
+  bucket.tokens = bucket.tokens - 1;
+  pthread_mutex_unlock(&bucketmutex);
+
   return true;
 }
 
+// Answer the first request of the client with 429, its user has exceeded its rate.
+bool Throttle(const int sockfd)
+{
+  string request;
+  GetRequest(sockfd, request);   // It also tells whether the connection is kept.
+
+  const char *body = "<retcode>-1</retcode><message>Too many requests.</message>";
 
-connpool::~connpool()
+  char strresponse[512];
+  int len = snprintf(strresponse, sizeof(strresponse), \
+                     "HTTP/1.1 429 Too Many Requests\r\n"\
+                     "Server: webserver\r\n"\
+                     "Content-Type: text/html;charset=utf-8\r\n"\
+                     "Content-Length: %d\r\n"\
+                     "Retry-After: 1\r\n"\
+                     "Connection: %s\r\n\r\n"\
+                     "%s", (int)strlen(body), clientkeepalive[sockfd] == true ? "keep-alive" : "close", body);
+
+  throttlecount++;
+
+  // The main thread must not block, a client that does not read its responses is disconnected.
+  if (send(sockfd, strresponse, len, MSG_DONTWAIT | MSG_NOSIGNAL) != len) return false;
+
+  return clientkeepalive[sockfd];
+}
+
+// Put the socket of a request of user flow into the queue.
+void fairqueue::push(const int sockfd, const int flow, const int weight)
 {
-  destroy();
+  struct st_flow &fl = m_flows[flow];   // A new queue has finish time 0.
+
+  // A user that has been idle starts at the current virtual time, it gets no credit for the time it was idle.
+  double finish = max(m_vtime, fl.finish) + 1.0 / weight;
+  fl.finish = finish;
+
+  if (fl.items.empty() == true) m_heads.insert(make_pair(finish, flow));
+  fl.items.push_back(make_pair(sockfd, finish));
+  m_size++;
 }
 
-// Disconnect the database connections, destroy locks, and release the connection pool.
-void connpool::destroy()
+// Take the socket of the request with the earliest finish time, -1 if the queue is empty.
+int fairqueue::pop()
 {
-  for (int ii = 0; ii < m_maxconns; ii++)
+  if (m_heads.empty() == true) return -1;
+
+  int flow = m_heads.begin()->second;
+  m_heads.erase(m_heads.begin());
+
+  struct st_flow &fl = m_flows[flow];
+  int sockfd = fl.items.front().first;
+  m_vtime = fl.items.front().second;
+  fl.items.pop_front();
+  m_size--;
+
+  // The finish time of an empty queue is not later than the virtual time now, the queue can be removed.
+  if (fl.items.empty() == true) m_flows.erase(flow);
+  else m_heads.insert(make_pair(fl.items.front().second, flow));
+
+  return sockfd;
+}
+
+// Write the number of the worker threads, their utilization and the shed requests to the log.
+void ReportThreads()
+{
+  double elapsed = reporttimer.Elapsed();
+  long busy = busyus.exchange(0);
+  long shed = shedcount.exchange(0);
+  long throttled = throttlecount.exchange(0);
+
+  pthread_mutex_lock(&mutex);
+  int queue = sockqueue.size();
+  int idle = nidle;
+  pthread_mutex_unlock(&mutex);
+
+  pthread_spin_lock(&spin);
+  int count = nthreads;
+  pthread_spin_unlock(&spin);
+
+  if ((busy == 0) && (shed == 0) && (throttled == 0) && (queue == 0)) return;
+
+  logfile.Write("Worker threads: threads=%d,idle=%d,queue=%d,utilization=%.1f%%,shed=%ld,throttled=%ld\n",
+                count, idle, queue, (count == 0) ? 0 : 100.0 * busy / 1000000 / elapsed / count, shed, throttled);
+}
+
+// Microseconds of the monotonic clock, for the time of the phases.
+long MonoUs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// The accumulator is written only by its own thread, a relaxed load and store is enough and the reader
+// of /metrics still sees whole values.
+static inline void AddCounter(atomic<long> &counter, const long value)
+{
+  counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+// Add the statistics of a request and the bytes sent to the accumulator of the current thread.
+void AddMetrics(struct st_metrics *metrics, const struct st_reqstat &stat, const long bytes)
+{
+  if (stat.bauthfailed == true) AddCounter(metrics->authfailures, 1);
+
+  if ((stat.userindex >= 0) && (stat.userindex < MAXUSERS))
   {
-    m_conns[ii].conn.disconnect();             // Disconnect the database connection.
-    pthread_mutex_destroy(&m_conns[ii].mutex); // Destroy the lock.
+    AddCounter(metrics->userrequests[stat.userindex], 1);
+    if (stat.interindex == -1) AddCounter(metrics->userdenied[stat.userindex], 1);
+    AddCounter(metrics->userbytes[stat.userindex], bytes);
   }
 
-  delete[] m_conns;         // Release the memory space of the database connection pool.
-  m_conns = 0;
+  if ((stat.interindex < 0) || (stat.interindex >= MAXINTERS)) return;
 
-  memset(m_connstr, 0, sizeof(m_connstr));
-  memset(m_charset, 0, sizeof(m_charset));
-  m_maxconns = 0;
-  m_timeout = 0;
+  int ii = stat.interindex;
+  AddCounter(metrics->requests[ii], 1);
+  if (stat.berror == true) AddCounter(metrics->errors[ii], 1);
+  if (stat.bcached == true) AddCounter(metrics->cachehits[ii], 1);
+  if (stat.bshared == true) AddCounter(metrics->shared[ii], 1);
+  AddCounter(metrics->rows[ii], stat.rows);
+  AddCounter(metrics->bytes[ii], bytes);
+
+  for (int jj = 0; jj < PHASES; jj++)
+  {
+    if (stat.phaseus[jj] < 0) continue;   // The request has not gone through the phase.
+
+    int kk = 0;
+    while ((kk < BUCKETS - 1) && (stat.phaseus[jj] > bucketbound[kk])) kk++;
+
+    AddCounter(metrics->buckets[ii][jj][kk], 1);
+    AddCounter(metrics->sumus[ii][jj], stat.phaseus[jj]);
+  }
 }
 
-// 1) Find an idle and already connected connection from the database connection pool. If found, return its address.
-// 2) If not found, find an unconnected connection from the connection pool, connect to the database, and if successful, return the connection's address.
-// 3) If an unconnected connection is found in step 2), but connecting to the database fails, return NULL.
-// 4) If step 2) does not find an unconnected connection, it means that the database connection pool is full, also return NULL.
-connection *connpool::get()
+// Append a metric without labels with its HELP and TYPE lines to the body of /metrics, the help text is not limited.
+static void AppendMetric(string &sendbuf, const char *name, const char *type, const char *help, const long value)
 {
-  int pos = -1;       // Used to record the first array position of an unconnected database connection.
+  char strvalue[32];
+  snprintf(strvalue, sizeof(strvalue), " %ld\n", value);
 
-  for (int ii = 0; ii < m_maxconns; ii++)
+  sendbuf.append("# HELP ").append(name).append(" ").append(help).append("\n");
+  sendbuf.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+  sendbuf.append(name).append(strvalue);
+}
+
+// Send the metrics in the Prometheus text format to the client, only the programs on this host can get them.
+bool Metrics(const int sockfd, string &sendbuf)
+{
+  if (LocalPeer(sockfd) == false)
+  {
+    SendResponse(sockfd, "<retcode>-1</retcode><message>Permission denied</message>");
+    return clientkeepalive[sockfd];
+  }
+
+  // The accumulators of the slots, a slot may get its accumulator meanwhile.
+  pthread_spin_lock(&spin);
+  vector<struct st_metrics *> vm = vmetrics;
+  int threads = nthreads;
+  pthread_spin_unlock(&spin);
+
+  pthread_mutex_lock(&mutex);
+  int queue = sockqueue.size();
+  int idle = nidle;
+  pthread_mutex_unlock(&mutex);
+
+  // Sum the accumulators of all the slots.
+  struct st_metrics *total = new struct st_metrics();
+  for (int ss = 0; ss < vm.size(); ss++)
   {
-    if (pthread_mutex_trylock(&m_conns[ii].mutex) == 0)  // Try to acquire the lock.
+    struct st_metrics *m = vm[ss];
+    if (m == 0) continue;
+
+    for (int ii = 0; ii < MAXINTERS; ii++)
     {
-      if (m_conns[ii].atime > 0)        // If the database connection is already connected.
+      AddCounter(total->requests[ii], m->requests[ii].load(memory_order_relaxed));
+      AddCounter(total->errors[ii], m->errors[ii].load(memory_order_relaxed));
+      AddCounter(total->cachehits[ii], m->cachehits[ii].load(memory_order_relaxed));
+      AddCounter(total->shared[ii], m->shared[ii].load(memory_order_relaxed));
+      AddCounter(total->rows[ii], m->rows[ii].load(memory_order_relaxed));
+      AddCounter(total->bytes[ii], m->bytes[ii].load(memory_order_relaxed));
+      for (int jj = 0; jj < PHASES; jj++)
       {
-        printf("Obtained connection %d.\n", ii);
-        m_conns[ii].atime = time(0);    // Set the database connection's usage time to the current time.
-        return &m_conns[ii].conn;       // Return the address of the database connection.
+        for (int kk = 0; kk < BUCKETS; kk++)
+          AddCounter(total->buckets[ii][jj][kk], m->buckets[ii][jj][kk].load(memory_order_relaxed));
+        AddCounter(total->sumus[ii][jj], m->sumus[ii][jj].load(memory_order_relaxed));
       }
+    }
 
-      if (pos == -1)
-        pos = ii;   // Record the first array position of an unconnected database connection.
-      else
-        pthread_mutex_unlock(&m_conns[ii].mutex);  // Release the lock.
+    for (int ii = 0; ii < MAXUSERS; ii++)
+    {
+      AddCounter(total->userrequests[ii], m->userrequests[ii].load(memory_order_relaxed));
+      AddCounter(total->userdenied[ii], m->userdenied[ii].load(memory_order_relaxed));
+      AddCounter(total->userbytes[ii], m->userbytes[ii].load(memory_order_relaxed));
     }
+
+    AddCounter(total->authfailures, m->authfailures.load(memory_order_relaxed));
   }
 
-  if (pos == -1)   // If the connection pool is full, return NULL.
+  // The names of the interfaces and the users are taken from the current snapshot of the parameter tables.
+  shared_ptr<const struct st_paramcfg> cfg = atomic_load(&paramcfg);
+
+  sendbuf.clear();
+  char strline[512];
+
+  // Counters of the interfaces.
+  const char *countername[] = { "requests", "errors", "cache_hits", "shared", "rows", "response_bytes" };
+  const char *counterhelp[] = { "Requests of the interface.", "Requests of the interface failed for the database or the network.",
+                                "Requests of the interface answered from the result cache.",
+                                "Requests of the interface answered with the result of an identical request in flight.",
+                                "Rows sent by the interface.", "Bytes of the response bodies sent by the interface." };
+  atomic<long> *counters[] = { total->requests, total->errors, total->cachehits, total->shared, total->rows, total->bytes };
+
+  for (int cc = 0; cc < 6; cc++)
   {
-    printf("Connection pool is full.\n");
-    return NULL;
+    snprintf(strline, sizeof(strline), "# HELP webserver_%s_total %s\n# TYPE webserver_%s_total counter\n",
+             countername[cc], counterhelp[cc], countername[cc]);
+    sendbuf.append(strline);
+
+    for (unordered_map<string, struct st_intercfg>::const_iterator it = cfg->minters.begin(); it != cfg->minters.end(); it++)
+    {
+      if (it->second.index >= MAXINTERS) continue;
+      snprintf(strline, sizeof(strline), "webserver_%s_total{intername=\"%s\"} %ld\n",
+               countername[cc], it->first.c_str(), counters[cc][it->second.index].load());
+      sendbuf.append(strline);
+    }
   }
 
-  // If the connection pool is not full, let m_conns[pos].conn connect to the database.
-  printf("New connection %d.\n");
+  // Latency histograms of the interfaces, the buckets are cumulative in the Prometheus format.
+  sendbuf.append("# HELP webserver_phase_seconds Latency of each phase of the requests of the interface.\n"\
+                 "# TYPE webserver_phase_seconds histogram\n");
+  for (unordered_map<string, struct st_intercfg>::const_iterator it = cfg->minters.begin(); it != cfg->minters.end(); it++)
+  {
+    int ii = it->second.index;
+    if (ii >= MAXINTERS) continue;
 
-  // Connect to the database.
-  if (m_conns[pos].conn.connecttodb(m_connstr, m_charset) != 0)
+    for (int jj = 0; jj < PHASES; jj++)
+    {
+      long count = 0;
+      for (int kk = 0; kk < BUCKETS; kk++)
+      {
+        count = count + total->buckets[ii][jj][kk].load();
+        if (kk < BUCKETS - 1)
+          snprintf(strline, sizeof(strline), "webserver_phase_seconds_bucket{intername=\"%s\",phase=\"%s\",le=\"%g\"} %ld\n",
+                   it->first.c_str(), phasename[jj], bucketbound[kk] / 1000000.0, count);
+        else
+          snprintf(strline, sizeof(strline), "webserver_phase_seconds_bucket{intername=\"%s\",phase=\"%s\",le=\"+Inf\"} %ld\n",
+                   it->first.c_str(), phasename[jj], count);
+        sendbuf.append(strline);
+      }
+
+      snprintf(strline, sizeof(strline), "webserver_phase_seconds_sum{intername=\"%s\",phase=\"%s\"} %.6f\n"\
+               "webserver_phase_seconds_count{intername=\"%s\",phase=\"%s\"} %ld\n",
+               it->first.c_str(), phasename[jj], total->sumus[ii][jj].load() / 1000000.0,
+               it->first.c_str(), phasename[jj], count);
+      sendbuf.append(strline);
+    }
+  }
+
+  // Counters of the users.
+  const char *usercountername[] = { "user_requests", "user_denied", "user_response_bytes", "user_throttled" };
+  const char *usercounterhelp[] = { "Requests of the user.", "Requests of the user denied for permission.",
+                                    "Bytes of the response bodies sent to the user.", "Requests of the user over its rate, answered with 429." };
+  atomic<long> *usercounters[] = { total->userrequests, total->userdenied, total->userbytes, userthrottled };
+
+  for (int cc = 0; cc < 4; cc++)
   {
-    // If connecting to the database fails, release the lock and return NULL.
-    printf("Failed to connect to the database.\n");
-    pthread_mutex_unlock(&m_conns[pos].mutex);  // Release the lock.
-    return NULL;
+    snprintf(strline, sizeof(strline), "# HELP webserver_%s_total %s\n# TYPE webserver_%s_total counter\n",
+             usercountername[cc], usercounterhelp[cc], usercountername[cc]);
+    sendbuf.append(strline);
+
+    for (unordered_map<string, struct st_usercfg>::const_iterator it = cfg->musers.begin(); it != cfg->musers.end(); it++)
+    {
+      if (it->second.index >= MAXUSERS) continue;
+      snprintf(strline, sizeof(strline), "webserver_%s_total{username=\"%s\"} %ld\n",
+               usercountername[cc], it->first.c_str(), usercounters[cc][it->second.index].load());
+      sendbuf.append(strline);
+    }
   }
 
-  m_conns[pos].atime = time(0);      // Set the database connection's usage time to the current time.
+  AppendMetric(sendbuf, "webserver_auth_failures_total", "counter",
+               "Requests with an invalid username or password.", total->authfailures.load());
+  AppendMetric(sendbuf, "webserver_threads", "gauge", "Worker threads.", threads);
+  AppendMetric(sendbuf, "webserver_idle_threads", "gauge", "Worker threads waiting for a request.", idle);
+  AppendMetric(sendbuf, "webserver_queue", "gauge", "Requests waiting for a worker thread.", queue);
+
+  AppendMetric(sendbuf, "webserver_userlog_written_total", "counter", "Calls written to T_USERLOG.", userlogq.m_written.load());
+  AppendMetric(sendbuf, "webserver_userlog_dropped_total", "counter",
+               "Calls not written to T_USERLOG because the queue was full.", userlogq.m_dropped.load());
+  AppendMetric(sendbuf, "webserver_userlog_failed_total", "counter",
+               "Calls not written to T_USERLOG because the insert failed.", userlogq.m_failed.load());
+
+  AppendMetric(sendbuf, "webserver_stream_subscribers", "gauge", "Clients subscribed to the new rows.", streams.m_count.load());
+  AppendMetric(sendbuf, "webserver_stream_rows_total", "counter", "Rows polled for the subscribers.", streams.m_rows.load());
+  AppendMetric(sendbuf, "webserver_stream_events_total", "counter", "Rows sent to the subscribers.", streams.m_events.load());
+  AppendMetric(sendbuf, "webserver_stream_dropped_total", "counter",
+               "Subscribers disconnected because they were too slow or failed.", streams.m_dropped.load());
+
+  if (vreplicas.size() > 0)
+  {
+    sendbuf.append("# HELP webserver_replica_available Whether the read replica is used.\n"\
+                   "# TYPE webserver_replica_available gauge\n");
+    for (int ii = 0; ii < vreplicas.size(); ii++)
+    {
+      snprintf(strline, sizeof(strline), "webserver_replica_available{replica=\"%s\"} %d\n",
+               vreplicas[ii]->pool.m_name, (vreplicas[ii]->bavailable == true) ? 1 : 0);
+      sendbuf.append(strline);
+    }
 
-  return &m_conns[pos].conn;
+    sendbuf.append("# HELP webserver_replica_lag Lag of the read replica measured by lagsql.\n"\
+                   "# TYPE webserver_replica_lag gauge\n");
+    for (int ii = 0; ii < vreplicas.size(); ii++)
+    {
+      snprintf(strline, sizeof(strline), "webserver_replica_lag{replica=\"%s\"} %.0f\n", vreplicas[ii]->pool.m_name, vreplicas[ii]->lag);
+      sendbuf.append(strline);
+    }
+
+    sendbuf.append("# HELP webserver_replica_outstanding Requests using or waiting for a connection of the read replica.\n"\
+                   "# TYPE webserver_replica_outstanding gauge\n");
+    for (int ii = 0; ii < vreplicas.size(); ii++)
+    {
+      snprintf(strline, sizeof(strline), "webserver_replica_outstanding{replica=\"%s\"} %d\n",
+               vreplicas[ii]->pool.m_name, vreplicas[ii]->pool.outstanding());
+      sendbuf.append(strline);
+    }
+  }
+
+  delete total;
+
+  // The header and the body are sent with one system call.
+  char strheader[256];
+  int headerlen = snprintf(strheader, sizeof(strheader), \
+                           "HTTP/1.1 200 OK\r\n"\
+                           "Server: webserver\r\n"\
+                           "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"\
+                           "Content-Length: %d\r\n"\
+                           "Connection: %s\r\n\r\n", (int)sendbuf.size(), clientkeepalive[sockfd] == true ? "keep-alive" : "close");
+
+  struct iovec iov[2];
+  iov[0].iov_base = strheader;                 iov[0].iov_len = headerlen;
+  iov[1].iov_base = (char *)sendbuf.data();    iov[1].iov_len = sendbuf.size();
+
+  if (Writev(sockfd, iov, 2) == false) return false;
+
+  return clientkeepalive[sockfd];
 }
 
+userlogqueue::userlogqueue()
+{
+  m_cells = 0;
+  m_mask = 0;
+  m_enqpos = 0;
+  m_deqpos = 0;
+  m_queued = m_dropped = m_written = m_failed = 0;
+  m_lastqueued = 0;
+}
 
-// Return the database connection to the pool.
-bool connpool::free(connection *conn) 
+userlogqueue::~userlogqueue()
 {
-  for (int ii = 0; ii < m_maxconns; ii++)
+  delete[] m_cells;
+}
+
+// Create the queue with at least size cells.
+void userlogqueue::init(const size_t size)
+{
+  size_t cells = 2;
+  while (cells < size) cells = cells * 2;
+
+  m_cells = new struct st_cell[cells];
+  m_mask = cells - 1;
+
+  // The cell of position n is free for the producer of n when its sequence number is n.
+  for (size_t ii = 0; ii < cells; ii++) m_cells[ii].seq.store(ii, memory_order_relaxed);
+}
+
+// Put a record into the queue, return false if the queue is full.
+bool userlogqueue::push(const struct st_userlog &record)
+{
+  struct st_cell *cell;
+  size_t pos = m_enqpos.load(memory_order_relaxed);
+
+  while (true)
   {
-    if (&m_conns[ii].conn == conn)
+    cell = &m_cells[pos & m_mask];
+    long diff = (long)cell->seq.load(memory_order_acquire) - (long)pos;
+
+    if (diff == 0)
+    {
+      // The cell is free, take the position, another producer may have taken it first.
+      if (m_enqpos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed) == true) break;
+    }
+    else if (diff < 0)
     {
-      printf("Returning connection %d\n", ii);
-      m_conns[ii].atime = time(0);      // Set the database connection's usage time to the current time.
-      pthread_mutex_unlock(&m_conns[ii].mutex);        // Release the lock.
-      return true;
+      m_dropped++; return false;   // The cell still has the record of the previous round, the queue is full.
     }
+    else
+      pos = m_enqpos.load(memory_order_relaxed);   // Another producer has taken the position.
   }
 
-  return false;
+  cell->data = record;
+  cell->seq.store(pos + 1, memory_order_release);   // Publish the record to the consumer.
+
+  m_queued++;
+
+  return true;
 }
 
-// Check the connection pool and disconnect idle connections.
-void connpool::checkpool()
+// Take a record from the queue, return false if it is empty. Only the writer thread calls it.
+bool userlogqueue::pop(struct st_userlog &record)
 {
-  for (int ii = 0; ii < m_maxconns; ii++)
+  struct st_cell *cell = &m_cells[m_deqpos & m_mask];
+
+  if (cell->seq.load(memory_order_acquire) != m_deqpos + 1) return false;   // Not published yet.
+
+  record = cell->data;
+  cell->seq.store(m_deqpos + m_mask + 1, memory_order_release);   // Free the cell for the producer of the next round.
+  m_deqpos++;
+
+  return true;
+}
+
+// Write the counters to the log if there have been calls since the last report.
+void userlogqueue::report()
+{
+  long queued = m_queued.load();
+  long dropped = m_dropped.load();
+  if ((queued == m_lastqueued) && (dropped == 0)) return;
+
+  logfile.Write("T_USERLOG: queued=%ld,written=%ld,dropped=%ld,failed=%ld\n",
+                queued, m_written.load(), dropped, m_failed.load());
+
+  m_lastqueued = queued;
+}
+
+// Put the record of a successful call into the queue of T_USERLOG.
+void WriteUserLog(const int sockfd, const struct st_usercfg *user, const struct st_intercfg *inter, const long rows, const double elapsed)
+{
+  struct st_userlog record;
+
+  STRCPY(record.username, sizeof(record.username), user->username.c_str());
+  STRCPY(record.intername, sizeof(record.intername), inter->intername.c_str());
+  STRCPY(record.ip, sizeof(record.ip), clientip[sockfd]);
+  record.atime = time(0);
+  record.upttime[0] = 0;
+  record.rows = rows;
+  record.bytes = clientsent[sockfd];
+  record.elapsed = (long)(elapsed * 1000);
+
+  userlogq.push(record);   // It is dropped and counted if the queue is full.
+}
+
+void *userlogmain(void *arg)    // Thread function to write the records to T_USERLOG.
+{
+  pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+
+  connection conn;              // Connection of this thread, not from the pool.
+  sqlstatement stmt[8];         // Insert statements of 1, 2, 4, ..., USERLOGBATCH rows.
+  int nstmts = 0;               // Number of the prepared statements.
+  struct st_userlog batch[USERLOGBATCH];     // Rows bound to the statements.
+  struct st_userlog records[USERLOGBATCH];   // Records taken from the queue.
+
+  while (true)
   {
-    if (pthread_mutex_trylock(&m_conns[ii].mutex) == 0)  // Try to acquire the lock.
+    // Connect to the database and prepare the statements, again after a failure.
+    if (conn.m_state == 0)
     {
-      if (m_conns[ii].atime > 0)    // If it is an available connection.
+      nstmts = 0;
+      if (conn.connecttodb(starg.connstr, starg.charset) != 0)
+      {
+        logfile.Write("T_USERLOG: failed to connect to the database.\n%s\n", conn.m_cda.message);
+        sleep(10); continue;
+      }
+
+      // insert into T_USERLOG ... select SEQ_USERLOG.nextval,a.* from (select :1,...,:7 from dual union all select :8,... from dual) a
+      bool bok = true;
+      for (int rows = 1; (rows <= USERLOGBATCH) && (bok == true); rows = rows * 2)
       {
-        // Check if the connection has timed out.
-        if ((time(0) - m_conns[ii].atime) > m_timeout) 
+        string strsql = "insert into T_USERLOG(logid,username,intername,upttime,ip,rpc,bytes,elapsed) "\
+                        "select SEQ_USERLOG.nextval,a.* from (";
+        char strrow[256];
+        for (int ii = 0; ii < rows; ii++)
         {
-          printf("Connection %d has timed out.\n", ii);
-          m_conns[ii].conn.disconnect();     // Disconnect the database connection.
-          m_conns[ii].atime = 0;               // Reset the database connection's usage time.
+          int pos = ii * 7;
+          snprintf(strrow, sizeof(strrow), "%sselect :%d,:%d,to_date(:%d,'yyyymmddhh24miss'),:%d,:%d,:%d,:%d from dual",
+                   (ii == 0) ? "" : " union all ", pos + 1, pos + 2, pos + 3, pos + 4, pos + 5, pos + 6, pos + 7);
+          strsql.append(strrow);
         }
-        else  
+        strsql.append(") a");
+
+        sqlstatement &st = stmt[nstmts];
+        st.connect(&conn);
+        st.prepare(strsql.c_str());
+        for (int ii = 0; ii < rows; ii++)
         {
-          // If the connection has not timed out, execute a test SQL to verify if the connection is valid. If it's invalid, disconnect it.
-          // If the network is disconnected or the database is restarted, we just need to disconnect the connection, the reconnection is handled by the get() function.
-          if (m_conns[ii].conn.execute("select * from dual") != 0)
-          {
-            printf("Connection %d is faulty.\n", ii);
-            m_conns[ii].conn.disconnect();     // Disconnect the database connection.
-            m_conns[ii].atime = 0;               // Reset the database connection's usage time.
-          }
+          int pos = ii * 7;
+          st.bindin(pos + 1, batch[ii].username, 30);
+          st.bindin(pos + 2, batch[ii].intername, 30);
+          st.bindin(pos + 3, batch[ii].upttime, 14);
+          st.bindin(pos + 4, batch[ii].ip, 15);
+          st.bindin(pos + 5, &batch[ii].rows);
+          st.bindin(pos + 6, &batch[ii].bytes);
+          st.bindin(pos + 7, &batch[ii].elapsed);
+        }
+        if (st.m_cda.rc != 0)
+        {
+          logfile.Write("T_USERLOG: prepare failed.\n%s\n", st.m_cda.message);
+          bok = false;
+        }
+        nstmts++;
+      }
+
+      if (bok == false)
+      {
+        for (int ii = 0; ii < nstmts; ii++) stmt[ii].disconnect();
+        conn.disconnect(); sleep(10); continue;
+      }
+    }
+
+    // Take the records waiting in the queue, up to USERLOGBATCH.
+    int count = 0;
+    while ((count < USERLOGBATCH) && (userlogq.pop(records[count]) == true)) count++;
+
+    // A few records wait a little for the next ones, so they are inserted in larger batches.
+    if (count == 0) { usleep(200000); continue; }
+
+    // Insert the records with the statements of 64, 32, ..., 1 rows, for example 100 records are 64+32+4.
+    bool bok = true;
+    int done = 0;
+    for (int ii = nstmts - 1; (ii >= 0) && (bok == true); ii--)
+    {
+      int rows = 1 << ii;
+      while ((count - done >= rows) && (bok == true))
+      {
+        memcpy(batch, records + done, rows * sizeof(struct st_userlog));
+        for (int jj = 0; jj < rows; jj++) timetostr(batch[jj].atime, batch[jj].upttime, "yyyymmddhh24miss");
+
+        if (stmt[ii].execute() != 0)
+        {
+          logfile.Write("T_USERLOG: insert failed.\n%s\n", stmt[ii].m_cda.message);
+          bok = false;
         }
+        done = done + rows;
       }
+    }
+
+    if (bok == false)
+    {
+      conn.rollback();
+      userlogq.m_failed += count;
 
-      pthread_mutex_unlock(&m_conns[ii].mutex);   // Release the lock.
+      // Connect again, the statements are prepared again, the table may have been created meanwhile.
+      for (int ii = 0; ii < nstmts; ii++) stmt[ii].disconnect();
+      conn.disconnect(); sleep(10); continue;
     }
-    
-    // If trying to acquire the lock fails, it means the database connection is currently in use, no need to check.
+
+    conn.commit();
+    userlogq.m_written += count;
+
+    if (count < USERLOGBATCH) usleep(200000);
   }
 }
 
+streamer::streamer()
+{
+  pthread_mutex_init(&m_mutex, 0);
+  m_lastid = m_lastrows = 0;
+  m_binit = false;
+  m_idletime = 0;
+  m_count = 0;
+  m_rows = m_events = m_dropped = 0;
+
+  CCmdStr CmdStr;
+  CmdStr.SplitToCmd(STREAMCOLS, ",", true);
+  m_cols = CmdStr.m_vCmdStr;
+}
 
-void *checkpool(void *arg)    // Thread function to check the database connection pool.
+streamer::~streamer()
 {
-  while (true)
+  pthread_mutex_destroy(&m_mutex);
+}
+
+// Take over the socket of a new subscriber, the recent rows after its lastid are sent first.
+void streamer::add(struct st_subscriber *sub)
+{
+  pthread_mutex_lock(&m_mutex);
+
+  if (sub->lastid > 0)
   {
-    oraconnpool.checkpool();
-    sleep(30);
+    for (deque<struct st_streamrow>::iterator it = m_backlog.begin(); it != m_backlog.end(); it++)
+    {
+      if (it->keyid <= sub->lastid) continue;
+      if ((sub->obtids.empty() == false) && (sub->obtids.count(it->obtid) == 0)) continue;
+      sub->pending.append(it->event);
+      m_events++;
+    }
   }
+
+  m_subs.push_back(sub);
+  m_count++;
+
+  if ((flush(sub) == false) || (sub->pending.size() > STREAMPENDING)) drop(m_subs.size() - 1, "failed");
+
+  pthread_mutex_unlock(&m_mutex);
 }
 
-void *checkthmain(void *arg)    // Main function for the monitoring thread.
+// Query the rows added since the last poll and send them to the subscribers.
+void streamer::poll()
 {
-  while (true)
+  // Without subscribers the table is not queried. The position and the recent rows are kept for STREAMKEEP seconds
+  // for the clients reconnecting with Last-Event-ID, then the position is taken from the table again for the next one.
+  if (m_count == 0)
   {
-    // Iterate through the container of worker thread structures and check if each worker thread has timed out.
-    for (int ii = 0; ii < vthid.size(); ii++)
+    if (m_binit == false) return;
+    if (m_idletime == 0) m_idletime = time(0);
+    if (time(0) - m_idletime < STREAMKEEP) return;
+
+    pthread_mutex_lock(&m_mutex);
+    m_binit = false;
+    m_lastid = 0;
+    m_backlog.clear();
+    pthread_mutex_unlock(&m_mutex);
+    return;
+  }
+
+  m_idletime = 0;
+
+  // The query runs without the lock, a new subscriber does not wait for it.
+  vector<struct st_streamrow> vrows;
+
+  connpool *pool = 0;
+  connection *conn = GetReadConn(pool);
+  if (conn != 0)
+  {
+    sqlstatement stmt(conn);
+
+    if (m_binit == false)
     {
-      // Worker threads have a timeout of 20 seconds, here we use 25 seconds for timeout check, which is sufficient.
-      if ((time(0) - vthid[ii].atime) > 25)
-      {
-        // It has timed out.
-        logfile.Write("Thread %d(%lu) timed out (%d seconds).\n", ii, vthid[ii].pthid, time(0) - vthid[ii].atime);
+      // The first poll starts from the last row in the table, the clients have taken the earlier rows with getzhobtmind1.
+      stmt.prepare("select nvl(max(keyid),0) from T_ZHOBTMIND");
+      stmt.bindout(1, &m_lastid);
+      if ((stmt.execute() != 0) || (stmt.next() != 0))
+        logfile.Write("streamer::poll() failed.\n%s\n%s\n", stmt.m_sql, stmt.m_cda.message);
+      else
+        m_binit = true;
+    }
+    else
+    {
+      char *colvalue = new char[m_cols.size() * 2001];   // The values of the columns are 2001 bytes apart.
+      memset(colvalue, 0, m_cols.size() * 2001);
 
-        // Cancel the timed-out worker thread.
-        pthread_cancel(vthid[ii].pthid);
+      stmt.prepare(STREAMSQL);
+      stmt.bindin(1, &m_lastid);
+      for (int ii = 0; ii < m_cols.size(); ii++) stmt.bindout(ii + 1, colvalue + ii * 2001, 2000);
 
-        // Re-create the worker thread.
-        if (pthread_create(&vthid[ii].pthid, NULL, thmain, (void *)(long)ii) != 0)
+      if (stmt.execute() != 0)
+        logfile.Write("streamer::poll() failed.\n%s\n%s\n", stmt.m_sql, stmt.m_cda.message);
+      else
+      {
+        string json;
+        while (stmt.next() == 0)
         {
-          logfile.Write("pthread_create() failed.\n");
-          EXIT(-1);
+          // The data of the event is the row in JSON, without the line break before it.
+          json.clear();
+          serializer ser(json, FMT_JSON, m_cols);
+          ser.row(colvalue);
+
+          struct st_streamrow row;
+          row.keyid = atol(colvalue + (m_cols.size() - 1) * 2001);
+          row.obtid = colvalue;
+          row.event = "id: ";
+          row.event.append(colvalue + (m_cols.size() - 1) * 2001);
+          row.event.append("\ndata: ");
+          row.event.append(json, 1, string::npos);
+          row.event.append("\n\n");
+          vrows.push_back(row);
+
+          if (row.keyid > m_lastid) m_lastid = row.keyid;
         }
-
-        vthid[ii].atime = time(0);      // Set the activity time of the worker thread.
+        m_rows += vrows.size();
       }
+
+      delete[] colvalue;
     }
 
-    sleep(3);
-  } 
+    pool->free(conn);
+  }
+
+  pthread_mutex_lock(&m_mutex);
+
+  for (int ii = 0; ii < vrows.size(); ii++) m_backlog.push_back(vrows[ii]);
+  while (m_backlog.size() > STREAMBACKLOG) m_backlog.pop_front();
+
+  // Send the rows of its stations to each subscriber, from the last one, so a dropped one does not move the others.
+  time_t now = time(0);
+  for (int ii = m_subs.size() - 1; ii >= 0; ii--)
+  {
+    struct st_subscriber *sub = m_subs[ii];
+
+    for (int jj = 0; jj < vrows.size(); jj++)
+    {
+      if ((sub->obtids.empty() == false) && (sub->obtids.count(vrows[jj].obtid) == 0)) continue;
+      sub->pending.append(vrows[jj].event);
+      m_events++;
+    }
+
+    if ((sub->pending.empty() == true) && (now - sub->atime >= STREAMPING)) sub->pending.append(": ping\n\n");
+
+    if (flush(sub) == false) { drop(ii, "closed"); continue; }
+
+    if (sub->pending.size() > STREAMPENDING) drop(ii, "too slow");
+  }
+
+  pthread_mutex_unlock(&m_mutex);
+}
+
+// Send the data of the subscriber without blocking, return false if the client has closed the connection or failed.
+bool streamer::flush(struct st_subscriber *sub)
+{
+  // The client sends nothing on the stream, a readable socket is a closed one.
+  char ch;
+  if (recv(sub->sockfd, &ch, 1, MSG_PEEK | MSG_DONTWAIT) == 0) return false;
+
+  while (sub->pending.empty() == false)
+  {
+    int sendlen = send(sub->sockfd, sub->pending.data(), sub->pending.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sendlen < 0)
+    {
+      if (errno == EINTR) continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return true;   // The rest is sent at the next poll.
+      return false;
+    }
+
+    sub->pending.erase(0, sendlen);
+    sub->atime = time(0);
+  }
+
+  return true;
+}
+
+// Close the connection of a subscriber and free it, the caller holds m_mutex.
+void streamer::drop(const int pos, const char *reason)
+{
+  struct st_subscriber *sub = m_subs[pos];
+
+  logfile.Write("Client(%d) unsubscribed, %s.\n", sub->sockfd, reason);
+  if (strcmp(reason, "closed") != 0) m_dropped++;
+
+  CloseClient(sub->sockfd);
+  delete sub;
+
+  m_subs.erase(m_subs.begin() + pos);
+  m_count--;
+}
+
+// Write the counters to the log if there are subscribers.
+void streamer::report()
+{
+  long rows = m_rows.load();
+  if ((m_count == 0) && (rows == m_lastrows)) return;
+
+  logfile.Write("Streams: subscribers=%d,rows=%ld,events=%ld,dropped=%ld\n",
+                m_count.load(), rows - m_lastrows, m_events.load(), m_dropped.load());
+
+  m_lastrows = rows;
+}
+
+void *streammain(void *arg)    // Thread function to poll the new rows for the subscribers.
+{
+  pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+
+  while (true)
+  {
+    sleep(starg.streamsecs);
+    streams.poll();
+  }
 }
 
 
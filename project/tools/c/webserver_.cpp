@@ -54,9 +54,43 @@ void _help(char *argv[]);
 // Parse XML into the starg structure.
 bool _xmltoarg(char *strxmlbuffer);
 
-// Read client messages.
+// Read client messages, return the number of bytes read, 0 if timeout, -1 if the connection is closed or failed.
 int ReadT(const int sockfd, char *buffer, const int size, const int itimeout);
 
+// Incremental HTTP/1.1 request parser of a persistent connection.
+// The data received from the client is appended to rbuf, a request is complete when its header and its body
+// (Content-Length) have arrived, the requests the client has pipelined after it stay in rbuf for the next call.
+#define MAXREQSIZE 8192         // Maximum size of a request message header or body.
+struct st_httpreq
+{
+  string rbuf;          // Data received from the client that has not been parsed yet.
+  size_t scanpos;       // Position in rbuf before which there is no end of the header, so the search does not restart from 0.
+  size_t headlen;       // Length of the header of the current request, including the blank line, 0 if it is not complete.
+  size_t bodylen;       // Length of the body of the current request (Content-Length).
+  bool   keepalive;     // Whether the connection is kept after the response of the current request.
+  string request;       // Header of the current complete request.
+};
+
+// Parse the next request in req->rbuf into req->request.
+// Return 1 if a request is complete, 0 if more data is needed, -1 if the request is malformed.
+int ParseRequest(struct st_httpreq *req);
+
+// Process one request of the client, return true if the connection can be kept for the next request.
+bool DoRequest(const int sockfd, const char *buffer);
+
+#define MAXSOCK 10240           // Maximum value of the client socket.
+bool clientkeepalive[MAXSOCK];  // Whether the connection is kept after the response of the current request.
+
+// Send a complete response message with the body to the client.
+bool SendResponse(const int sockfd, const char *body);
+
+// Send a response with only a status line to the client, for a request that is not processed, the connection is then closed.
+bool SendStatus(const int sockfd, const char *status);
+
+// Send a piece of the response body of ExecSQL to the client, with chunked transfer encoding on a keep-alive connection.
+// len=0 ends the response body.
+bool WriteBody(const int sockfd, const char *buffer, const int len);
+
 // Get parameters from the GET request.
 bool getvalue(const char *buffer, const char *name, char *value, const int len);
 
@@ -214,8 +248,8 @@ void *thmain(void *arg)
   pthread_detach(pthread_self()); // Detach the thread.
 
   int connfd;                   // Client socket.
-  char strrecvbuf[1024];        // Buffer to receive client request messages.
-  char strsendbuf[1024];        // Buffer to send response messages to the client.
+  char strrecvbuf[4096];        // Buffer to receive client request messages.
+  struct st_httpreq req;        // Request parser of the connection.
 
   while (true)
   {
@@ -240,91 +274,250 @@ void *thmain(void *arg)
     // The following is the business processing code.
     logfile.Write("phid=%lu(num=%d),connfd=%d\n", pthread_self(), pthnum, connfd);
 
+    if (connfd >= MAXSOCK)
+    {
+      logfile.Write("The number of connections has exceeded the maximum value %d.\n", MAXSOCK);
+      close(connfd);
+      continue;
+    }
+
+    req.rbuf.clear(); req.scanpos = req.headlen = req.bodylen = 0;
+
     while (true)
     {
-      // Read the client's message, close the client's socket and continue to the loop if timeout or fails.
-      memset(strrecvbuf, 0, sizeof(strrecvbuf));
+      // Take the next request from the data received, the client may have sent several requests without waiting.
+      int iret = ParseRequest(&req);
 
-      int iret = 0;
-      iret = ReadT(connfd, strrecvbuf, sizeof(strrecvbuf), 20);
-      if (iret == 0)
-      {
-        logfile.Write("timeout\n");
-        vthid[pthnum].atime = time(0);
-        continue;
-      }
       if (iret < 0)
       {
-        logfile.Write("disconnect\n");
-        vthid[pthnum].atime = time(0);
-        close(connfd);
+        SendStatus(connfd, "400 Bad Request");
         break;
       }
 
-      // Do not process if it is not a GET request message, close the client's socket and continue to the loop.
-      if (strncmp(strrecvbuf, "GET", 3) != 0)
+      // The request is not complete, read more data from the client.
+      if (iret == 0)
       {
-        close(connfd);
-        break;
+        iret = ReadT(connfd, strrecvbuf, sizeof(strrecvbuf), 20);
+        // An idle keep-alive client, or a request that has not been completed in time, would hold the
+        // worker thread for ever, close the connection.
+        if (iret == 0)
+        {
+          if (req.rbuf.empty() == true) logfile.Write("keep-alive timeout\n");
+          else { logfile.Write("timeout\n"); SendStatus(connfd, "408 Request Timeout"); }
+          vthid[pthnum].atime = time(0);
+          break;
+        }
+        if (iret < 0)
+        {
+          logfile.Write("disconnect\n");
+          vthid[pthnum].atime = time(0);
+          break;
+        }
+
+        req.rbuf.append(strrecvbuf, iret);
+        continue;
       }
 
-      logfile.Write("%s\n", strrecvbuf);
+      vthid[pthnum].atime = time(0);
 
-      connection *conn = oraconnpool.get(); // Get a database connection.
+      clientkeepalive[connfd] = req.keepalive;
 
-      // If the database connection is empty, return internal error to the client, close the client's socket, and continue to the loop.
-      if (conn == 0)
-      {
-        memset(strsendbuf, 0, sizeof(strsendbuf));
-        sprintf(strsendbuf, \
-          "HTTP/1.1 200 OK\r\n"\
-          "Server: webserver_\r\n"\
-          "Content-Type: text/html;charset=utf-8\r\n\r\n"\
-          "<retcode>-1</retcode><message>internal error.</message>");
-        Writen(connfd, strsendbuf, strlen(strsendbuf));
-        close(connfd);
-        break;
-      }
+      if (DoRequest(connfd, req.request.c_str()) == false) break;
+    }
+
+    close(connfd);
+  }
+
+  pthread_cleanup_pop(1); // Pop the thread cleanup function.
+}
+
+// Process one request of the client, return true if the connection can be kept for the next request.
+bool DoRequest(const int sockfd, const char *buffer)
+{
+  // Do not process if it is not a GET request message, and close the client's socket.
+  if (strncmp(buffer, "GET ", 4) != 0)
+  {
+    SendStatus(sockfd, "405 Method Not Allowed");
+    return false;
+  }
+
+  logfile.Write("%s\n", buffer);
+
+  connection *conn = oraconnpool.get(); // Get a database connection.
+
+  // If the database connection is empty, return internal error to the client.
+  if (conn == 0)
+  {
+    SendResponse(sockfd, "<retcode>-1</retcode><message>internal error.</message>");
+    return clientkeepalive[sockfd];
+  }
+
+  // Check the username and password in the URL, return authentication failure to the client.
+  if (Login(conn, buffer, sockfd) == false)
+  {
+    oraconnpool.free(conn);
+    return clientkeepalive[sockfd];
+  }
+
+  // Check if the user has permission to call the interface, return no permission to the client.
+  if (CheckPerm(conn, buffer, sockfd) == false)
+  {
+    oraconnpool.free(conn);
+    return clientkeepalive[sockfd];
+  }
 
-      // Check the username and password in the URL, return authentication failure to the client, close the client's socket, and continue to the loop.
-      if (Login(conn, strrecvbuf, connfd) == false)
+  // First, send the response message header to the client. The length of the data is not known before the query,
+  // so the body is sent in chunks on a keep-alive connection, otherwise it ends with the close of the connection.
+  char strsendbuf[1024];
+  memset(strsendbuf, 0, sizeof(strsendbuf));
+  sprintf(strsendbuf, \
+    "HTTP/1.1 200 OK\r\n"\
+    "Server: webserver_\r\n"\
+    "Content-Type: text/html;charset=utf-8\r\n"\
+    "%s\r\n", clientkeepalive[sockfd] == true ? "Transfer-Encoding: chunked\r\nConnection: keep-alive\r\n" : "Connection: close\r\n");
+  if (Writen(sockfd, strsendbuf, strlen(strsendbuf)) == false)
+  {
+    oraconnpool.free(conn);
+    return false;
+  }
+
+  // Then execute the interface's SQL statement and return the data to the client.
+  if (ExecSQL(conn, buffer, sockfd) == false)
+  {
+    oraconnpool.free(conn);
+    return false;
+  }
+
+  oraconnpool.free(conn);
+
+  // End the response body.
+  if (WriteBody(sockfd, 0, 0) == false) return false;
+
+  return clientkeepalive[sockfd];
+}
+
+// Parse the next request in req->rbuf into req->request.
+// Return 1 if a request is complete, 0 if more data is needed, -1 if the request is malformed.
+int ParseRequest(struct st_httpreq *req)
+{
+  if (req->headlen == 0)
+  {
+    // Only the data after scanpos is searched, the 3 bytes before it are included in case "\r\n\r\n" spans two reads.
+    size_t pos = req->rbuf.find("\r\n\r\n", req->scanpos);
+    if (pos == string::npos)
+    {
+      if (req->rbuf.size() > MAXREQSIZE) return -1;
+      req->scanpos = (req->rbuf.size() > 3) ? req->rbuf.size() - 3 : 0;
+      return 0;
+    }
+
+    req->headlen = pos + 4;
+    req->bodylen = 0;
+    if (req->headlen > MAXREQSIZE) return -1;
+
+    // Request line: method SP request-target SP HTTP-version.
+    size_t eol = req->rbuf.find("\r\n");
+    size_t sp1 = req->rbuf.find(' ');
+    size_t sp2 = (sp1 < eol) ? req->rbuf.find(' ', sp1 + 1) : string::npos;
+    if ((sp1 == 0) || (sp1 >= eol) || (sp2 >= eol) || (sp2 == sp1 + 1)) return -1;
+    if (req->rbuf.compare(sp2 + 1, 7, "HTTP/1.") != 0) return -1;
+    bool http11 = (req->rbuf.compare(sp2 + 1, eol - sp2 - 1, "HTTP/1.1") == 0);
+
+    // Header fields, only the ones that decide the framing of the request and the connection are used.
+    bool bclose = false;
+    size_t start = eol + 2;
+    while (start < pos + 2)
+    {
+      size_t end = req->rbuf.find("\r\n", start);
+      const char *line = req->rbuf.c_str() + start;
+      int linelen = end - start;
+
+      if ((linelen > 15) && (strncasecmp(line, "Content-Length:", 15) == 0))
       {
-        oraconnpool.free(conn);
-        close(connfd);
-        break;
+        char *endptr = 0;
+        long len = strtol(line + 15, &endptr, 10);
+        if ((len < 0) || (len > MAXREQSIZE) || (endptr == line + 15)) return -1;
+        req->bodylen = len;
       }
-
-      // Check if the user has permission to call the interface, return no permission to the client, close the client's socket, and continue to the loop.
-      if (CheckPerm(conn, strrecvbuf, connfd) == false)
+      else if ((linelen > 18) && (strncasecmp(line, "Transfer-Encoding:", 18) == 0))
       {
-        oraconnpool.free(conn);
-        close(connfd);
-        break;
+        return -1;   // A request of the data service bus has no chunked body.
       }
-
-      // First, send the response message header to the client.
-      memset(strsendbuf, 0, sizeof(strsendbuf));
-      sprintf(strsendbuf, \
-        "HTTP/1.1 200 OK\r\n"\
-        "Server: webserver_\r\n"\
-        "Content-Type: text/html;charset=utf-8\r\n\r\n");
-      Writen(connfd, strsendbuf, strlen(strsendbuf));
-
-      // Then execute the interface's SQL statement and return the data to the client.
-      if (ExecSQL(conn, strrecvbuf, connfd) == false)
+      else if ((linelen > 11) && (strncasecmp(line, "Connection:", 11) == 0))
       {
-        oraconnpool.free(conn);
-        close(connfd);
-        break;
+        string value(line + 11, linelen - 11);
+        if (strcasestr(value.c_str(), "close") != 0) bclose = true;
       }
 
-      oraconnpool.free(conn);;
+      start = end + 2;
     }
 
-    close(connfd);
+    // HTTP/1.1 keeps the connection unless the client asks to close it.
+    // A response of HTTP/1.0 cannot be chunked, so HTTP/1.0 connections are always closed.
+    req->keepalive = http11 && (bclose == false);
   }
 
-  pthread_cleanup_pop(1); // Pop the thread cleanup function.
+  // Wait for the body, it is skipped, the parameters of the data service bus are in the request-target.
+  if (req->rbuf.size() < req->headlen + req->bodylen) return 0;
+
+  req->request.assign(req->rbuf, 0, req->headlen);
+  req->rbuf.erase(0, req->headlen + req->bodylen);
+  req->scanpos = req->headlen = req->bodylen = 0;
+
+  return 1;
+}
+
+// Send a complete response message with the body to the client.
+bool SendResponse(const int sockfd, const char *body)
+{
+  char strbuffer[1024];
+  memset(strbuffer, 0, sizeof(strbuffer));
+
+  snprintf(strbuffer, sizeof(strbuffer), \
+           "HTTP/1.1 200 OK\r\n" \
+           "Server: webserver_\r\n" \
+           "Content-Type: text/html;charset=utf-8\r\n" \
+           "Content-Length: %d\r\n" \
+           "Connection: %s\r\n\r\n" \
+           "%s", (int)strlen(body), clientkeepalive[sockfd] == true ? "keep-alive" : "close", body);
+
+  return Writen(sockfd, strbuffer, strlen(strbuffer));
+}
+
+// Send a response with only a status line to the client, for a request that is not processed, the connection is then closed.
+bool SendStatus(const int sockfd, const char *status)
+{
+  char strbuffer[256];
+  memset(strbuffer, 0, sizeof(strbuffer));
+
+  snprintf(strbuffer, sizeof(strbuffer), \
+           "HTTP/1.1 %s\r\n" \
+           "Server: webserver_\r\n" \
+           "Content-Length: 0\r\n" \
+           "Connection: close\r\n\r\n", status);
+
+  return Writen(sockfd, strbuffer, strlen(strbuffer));
+}
+
+// Send a piece of the response body of ExecSQL to the client, with chunked transfer encoding on a keep-alive connection.
+// len=0 ends the response body.
+bool WriteBody(const int sockfd, const char *buffer, const int len)
+{
+  if (clientkeepalive[sockfd] == false)
+  {
+    if (len == 0) return true;
+    return Writen(sockfd, buffer, len);
+  }
+
+  if (len == 0) return Writen(sockfd, "0\r\n\r\n", 5);   // The last chunk.
+
+  char strsize[21];
+  int sizelen = snprintf(strsize, sizeof(strsize), "%x\r\n", len);
+
+  if (Writen(sockfd, strsize, sizelen) == false) return false;
+  if (Writen(sockfd, buffer, len) == false) return false;
+
+  return Writen(sockfd, "\r\n", 2);
 }
 
 // Process exit function.
@@ -422,7 +615,7 @@ bool _xmltoarg(char *strxmlbuffer)
 }
 
 
-// Read the client's message.
+// Read the client's message, return the number of bytes read, 0 if timeout, -1 if the connection is closed or failed.
 int ReadT(const int sockfd, char *buffer, const int size, const int itimeout)
 {
   if (itimeout > 0)
@@ -435,7 +628,10 @@ int ReadT(const int sockfd, char *buffer, const int size, const int itimeout)
       return iret;
   }
 
-  return recv(sockfd, buffer, size, 0);
+  int iret = recv(sockfd, buffer, size, 0);
+  if (iret == 0) return -1;   // The client has closed the connection, do not confuse it with a timeout.
+
+  return iret;
 }
 
 // Check if the username and password in the URL are correct, return authentication failure response message if not.
@@ -459,15 +655,7 @@ bool Login(connection *conn, const char *buffer, const int sockfd)
 
   if (icount == 0) // Authentication failed, return authentication failure response message.
   {
-    char strbuffer[256];
-    memset(strbuffer, 0, sizeof(strbuffer));
-
-    sprintf(strbuffer, \
-            "HTTP/1.1 200 OK\r\n" \
-            "Server: webserver_\r\n" \
-            "Content-Type: text/html;charset=utf-8\r\n\r\n" \
-            "<retcode>-1</retcode><message>username or passwd is invalid</message>");
-    Writen(sockfd, strbuffer, strlen(strbuffer));
+    SendResponse(sockfd, "<retcode>-1</retcode><message>username or passwd is invalid</message>");
 
     return false;
   }
@@ -525,16 +713,7 @@ bool CheckPerm(connection *conn, const char *buffer, const int sockfd)
 
   if (icount != 1)
   {
-    char strbuffer[256];
-    memset(strbuffer, 0, sizeof(strbuffer));
-
-    sprintf(strbuffer, \
-            "HTTP/1.1 200 OK\r\n" \
-            "Server: webserver_\r\n" \
-            "Content-Type: text/html;charset=utf-8\r\n\n\n" \
-            "<retcode>-1</retcode><message>permission denied</message>");
-
-    Writen(sockfd, strbuffer, strlen(strbuffer));
+    SendResponse(sockfd, "<retcode>-1</retcode><message>permission denied</message>");
 
     return false;
   }
@@ -615,15 +794,16 @@ bool ExecSQL(connection *conn, const char *buffer, const int sockfd)
   if (stmt.execute() != 0)
   {
     sprintf(strsendbuffer, "<retcode>%d</retcode><message>%s</message>\n", stmt.m_cda.rc, stmt.m_cda.message);
-    Writen(sockfd, strsendbuffer, strlen(strsendbuffer));
+    WriteBody(sockfd, strsendbuffer, strlen(strsendbuffer));
+    WriteBody(sockfd, 0, 0);
     logfile.Write("stmt.execute() failed.\n%s\n%s\n", stmt.m_sql, stmt.m_cda.message);
     return false;
   }
   strcpy(strsendbuffer, "<retcode>0</retcode><message>ok</message>\n");
-  Writen(sockfd, strsendbuffer, strlen(strsendbuffer));
+  WriteBody(sockfd, strsendbuffer, strlen(strsendbuffer));
 
   // Send the XML header tag <data> to the client.
-  Writen(sockfd, "<data>\n", strlen("<data>\n"));
+  WriteBody(sockfd, "<data>\n", strlen("<data>\n"));
 
   // Fetch the result set, concatenate XML, and send it to the client for each record.
   //////////////////////////////////////////////////
@@ -648,12 +828,12 @@ bool ExecSQL(connection *conn, const char *buffer, const int sockfd)
 
     strcat(strsendbuffer, "<endl/>\n"); // XML end-of-line tag.
 
-    Writen(sockfd, strsendbuffer, strlen(strsendbuffer)); // Send this line of data to the client.
+    WriteBody(sockfd, strsendbuffer, strlen(strsendbuffer)); // Send this line of data to the client.
   }
   //////////////////////////////////////////////////
 
   // Send the XML closing tag </data> to the client.
-  Writen(sockfd, "</data>\n", strlen("</data>\n"));
+  WriteBody(sockfd, "</data>\n", strlen("</data>\n"));
 
   logfile.Write("intername=%s,count=%d\n", intername, stmt.m_cda.rpc);
 